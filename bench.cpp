@@ -0,0 +1,575 @@
+#include "bench.h"
+
+#include "glm/ext/matrix_transform.hpp" // glm::translate, glm::scale
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+    struct Draw_Path_Option {
+        char const* name; //!< Short form used in options and reports
+        Draw_Path path;
+    };
+
+    Draw_Path_Option const draw_path_options[] = {
+        { "uniform", Draw_Path::Uniform_Dynamic },
+        { "push", Draw_Path::Push_Constant },
+        { "instanced", Draw_Path::Instanced },
+    };
+
+    char const* draw_path_option_name(Draw_Path path) {
+        for (Draw_Path_Option const& option : draw_path_options) {
+            if (option.path == path) {
+                return option.name;
+            }
+        }
+        return "unknown";
+    }
+
+    bool parse_draw_path(char const* name, Draw_Path* path) {
+        for (Draw_Path_Option const& option : draw_path_options) {
+            if (strcmp(option.name, name) == 0) {
+                *path = option.path;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool parse_vertex_format(char const* name, Vertex_Format* format) {
+        for (Vertex_Format candidate : { Vertex_Format::Packed, Vertex_Format::Float }) {
+            if (strcmp(vertex_format_name(candidate), name) == 0) {
+                *format = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool parse_count(char const* text, uint32_t* count) {
+        char* end;
+        const unsigned long value = strtoul(text, &end, 10);
+        if (end == text || *end != '\0' || value == 0 || value > UINT32_MAX) {
+            return false;
+        }
+        *count = static_cast<uint32_t>(value);
+        return true;
+    }
+
+    /**
+     * Parse a comma separated list, replacing the list's contents.
+     */
+    template <typename T>
+    bool parse_list(char const* text, bool (*parse_item)(char const*, T*), std::vector<T>* list) {
+        list->clear();
+        std::string item;
+        for (char const* c = text;; ++c) {
+            if (*c != ',' && *c != '\0') {
+                item.push_back(*c);
+                continue;
+            }
+
+            T value;
+            if (!parse_item(item.c_str(), &value)) {
+                return false;
+            }
+            list->push_back(value);
+            item.clear();
+
+            if (*c == '\0') {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * \param sorted_ms Ascending.
+     */
+    double sorted_percentile(std::vector<double> const& sorted_ms, double fraction) {
+        assert(!sorted_ms.empty());
+        const size_t rank = static_cast<size_t>(std::ceil(fraction * sorted_ms.size()));
+        return sorted_ms[std::min(std::max(rank, size_t(1)), sorted_ms.size()) - 1];
+    }
+
+    /**
+     * Fill the view with a flat grid of small cubes, one draw each.
+     */
+    void make_cube_grid(uint32_t num_draws, std::vector<glm::mat4>* models) {
+        const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(num_draws))));
+        const float spacing = 8.0f / side;
+
+        models->clear();
+        models->reserve(num_draws);
+        for (uint32_t i = 0; i < num_draws; ++i) {
+            const float x = (i % side) * spacing - 4.0f;
+            const float z = (i / side) * spacing - 4.0f;
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z));
+            model = glm::scale(model, glm::vec3(spacing * 0.25f));
+            models->push_back(model);
+        }
+    }
+
+    /**
+     * Time recording the scene alone, without submitting it. The GPU must be idle.
+     *
+     * \param parallel Record through frame slot 0's secondary command buffers, see
+     *  Vulkan_Instance_Info::setup_parallel_recording().
+     */
+    Status time_recording(Vulkan_Instance_Info& vulkan, uint32_t num_frames, bool parallel, double* elapsed_ms) {
+        VkCommandBuffer cmd_buf;
+        VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+        cmd_buf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmd_buf_alloc_info.pNext = nullptr;
+        cmd_buf_alloc_info.commandPool = vulkan.logical.gr_cmd_pool;
+        cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmd_buf_alloc_info.commandBufferCount = 1;
+        VK_CHECK(vkAllocateCommandBuffers(vulkan.logical.device, &cmd_buf_alloc_info, &cmd_buf));
+
+        const double time_start_ms = get_perf_counter_ms();
+        for (uint32_t i = 0; i < num_frames; ++i) {
+            vulkan.uniform_data.ring.begin_frame(0);
+            VK_CHECK(vulkan.exec_begin_gr_command_buffer(cmd_buf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
+            if (parallel) {
+                STATUS_CHECK(vulkan.reset_record_pools(vulkan.frames[0]));
+                STATUS_CHECK(vulkan.record_scene_commands_parallel(cmd_buf, 0, vulkan.frames[0]));
+            }
+            else {
+                STATUS_CHECK(vulkan.record_scene_commands(cmd_buf, 0));
+            }
+            VK_CHECK(vulkan.exec_end_gr_command_buffer(cmd_buf));
+        }
+        *elapsed_ms = get_perf_counter_ms() - time_start_ms;
+
+        vkFreeCommandBuffers(vulkan.logical.device, vulkan.logical.gr_cmd_pool, 1, &cmd_buf);
+        return STATUS_OK;
+    }
+
+    void empty_job(void*) {
+    }
+
+    /**
+     * Tens of microseconds of arithmetic, the result is written back so it is not optimized out.
+     */
+    void work_job(void* data) {
+        uint32_t* value = static_cast<uint32_t*>(data);
+        uint32_t x = *value | 1;
+        for (uint32_t i = 0; i < 20000; ++i) {
+            x = x * 1664525u + 1013904223u;
+        }
+        *value = x;
+    }
+
+    struct Split_Job {
+        Job_System* jobs;
+        uint32_t depth; //!< Levels of children below this job
+    };
+
+    /**
+     * Binary tree of jobs, every inner job waits on its two children.
+     */
+    void split_job(void* data) {
+        Split_Job const* split = static_cast<Split_Job const*>(data);
+        if (split->depth == 0) {
+            return;
+        }
+
+        Split_Job children[2] = { { split->jobs, split->depth - 1 }, { split->jobs, split->depth - 1 } };
+        Job child_jobs[2] = { { split_job, &children[0], nullptr }, { split_job, &children[1], nullptr } };
+        Job_Counter done = {};
+        split->jobs->run(child_jobs, 2, &done);
+        split->jobs->wait(&done);
+    }
+
+    /**
+     * Run num_jobs jobs in batches the size of a deque, waiting after each.
+     *
+     * \return ms taken.
+     */
+    double time_jobs(Job_System& jobs, void (*function)(void*), std::vector<uint32_t>* data, uint32_t num_jobs) {
+        static constexpr uint32_t batch_size = Job_Deque::capacity / 4;
+        std::vector<Job> batch(batch_size);
+
+        const double time_start_ms = get_perf_counter_ms();
+        for (uint32_t first = 0; first < num_jobs; first += batch_size) {
+            const uint32_t count = std::min(batch_size, num_jobs - first);
+            for (uint32_t i = 0; i < count; ++i) {
+                batch[i].function = function;
+                batch[i].data = data ? &(*data)[first + i] : nullptr;
+            }
+
+            Job_Counter done = {};
+            jobs.run(batch.data(), count, &done);
+            jobs.wait(&done);
+        }
+        return get_perf_counter_ms() - time_start_ms;
+    }
+}
+
+/**
+ * Compare the per-draw transform paths by drawing num_draws small cubes a frame.
+ *
+ * Reports recording throughput (CPU only), serial and split across the recording threads, and
+ * the full frame time of each path. Frame times include presentation, so they are capped by
+ * the present mode.
+ *
+ * NOTE: The uniform ring and the instance buffer must have room for num_draws draws a frame.
+ */
+Status bench_draw_paths(Vulkan_Instance_Info& vulkan, Window const& window, uint32_t num_draws, uint32_t num_frames) {
+    assert(num_draws > 0 && num_frames > 0);
+    static constexpr uint32_t num_warmup_frames = 16;
+    static constexpr Draw_Path paths[] = { Draw_Path::Uniform_Dynamic, Draw_Path::Push_Constant, Draw_Path::Instanced };
+
+    // Otherwise paths still compiling would be measured through the fallback
+    for (Draw_Path path : paths) {
+        vulkan.draw_path_pipeline(path);
+    }
+    STATUS_CHECK(vulkan.pipelines.wait_all());
+
+    std::vector<glm::mat4> saved_models = vulkan.draw_models;
+    const Draw_Path saved_path = vulkan.draw_path;
+    const bool saved_prerecord = vulkan.prerecord_cmd_bufs;
+
+    // Every frame is recorded, otherwise only submission would be measured
+    make_cube_grid(num_draws, &vulkan.draw_models);
+    vulkan.prerecord_cmd_bufs = false;
+
+    // Same cubes as one instanced draw
+    std::vector<Instance_Data> instances(num_draws);
+    for (uint32_t i = 0; i < num_draws; ++i) {
+        instances[i].model = vulkan.draw_models[i];
+        instances[i].color = glm::vec4(1.0f);
+    }
+
+    log_info("Draw path benchmark: %u draws, %u frames\n", num_draws, num_frames);
+    for (Draw_Path path : paths) {
+        vulkan.draw_path = path;
+
+        const bool instanced = path == Draw_Path::Instanced;
+        for (uint32_t i = 0; i < num_warmup_frames; ++i) {
+            process_window_messages(window);
+            if (instanced) {
+                STATUS_CHECK(vulkan.write_instances(instances.data(), num_draws));
+            }
+            STATUS_CHECK(vulkan.render());
+        }
+
+        // Instanced frames include writing the instance stream
+        const double frames_start_ms = get_perf_counter_ms();
+        for (uint32_t i = 0; i < num_frames; ++i) {
+            process_window_messages(window);
+            if (instanced) {
+                STATUS_CHECK(vulkan.write_instances(instances.data(), num_draws));
+            }
+            STATUS_CHECK(vulkan.render());
+        }
+        const double frames_ms = get_perf_counter_ms() - frames_start_ms;
+
+        // Recording reuses frame slot 0's uniform region
+        VK_CHECK(vkDeviceWaitIdle(vulkan.logical.device));
+        double record_ms;
+        STATUS_CHECK(time_recording(vulkan, num_frames, false, &record_ms));
+        double parallel_record_ms = 0.0;
+        if (!vulkan.frames[0].record_cmd_bufs.empty()) {
+            STATUS_CHECK(time_recording(vulkan, num_frames, true, &parallel_record_ms));
+        }
+
+        const double total_draws = static_cast<double>(num_draws) * num_frames;
+        log_info("  %-16s record %8.3f ms/frame %12.0f draws/s | parallel %8.3f ms/frame %12.0f draws/s"
+            " | frame %8.3f ms %12.0f draws/s\n",
+            draw_path_name(path),
+            record_ms / num_frames, total_draws / (record_ms / 1000.0),
+            parallel_record_ms / num_frames, total_draws / (parallel_record_ms / 1000.0),
+            frames_ms / num_frames, total_draws / (frames_ms / 1000.0));
+    }
+
+    VK_CHECK(vkDeviceWaitIdle(vulkan.logical.device));
+    vulkan.draw_models = saved_models;
+    vulkan.draw_path = saved_path;
+    vulkan.prerecord_cmd_bufs = saved_prerecord;
+    vulkan.mark_cmd_bufs_dirty();
+    return STATUS_OK;
+}
+
+/**
+ * Measure Job_System overhead and scaling with 1, 2, 4, ... threads up to max_threads.
+ *
+ * - empty: jobs doing nothing, the cost of running a job. With one thread every job is pushed
+ *   and popped by the same thread, with more most are stolen.
+ * - work: short compute jobs, speedup over one thread shows how well the work spreads.
+ * - split: a binary tree of jobs waiting on their children, covers waiting while running jobs.
+ */
+void bench_job_system(uint32_t max_threads) {
+    assert(max_threads > 0);
+    static constexpr uint32_t num_empty_jobs = 1 << 20;
+    static constexpr uint32_t num_work_jobs = 1 << 14;
+    static constexpr uint32_t split_depth = 16;
+
+    std::vector<uint32_t> work_data(num_work_jobs);
+    double single_thread_work_ms = 0.0;
+
+    log_info("Job system benchmark: %u empty jobs, %u work jobs, split depth %u\n",
+        num_empty_jobs, num_work_jobs, split_depth);
+    for (uint32_t num_threads = 1;; num_threads = std::min(num_threads * 2, max_threads)) {
+        Job_System jobs;
+        jobs.init(num_threads - 1);
+
+        const double empty_ms = time_jobs(jobs, empty_job, nullptr, num_empty_jobs);
+
+        for (uint32_t i = 0; i < num_work_jobs; ++i) {
+            work_data[i] = i;
+        }
+        const double work_ms = time_jobs(jobs, work_job, &work_data, num_work_jobs);
+        if (num_threads == 1) {
+            single_thread_work_ms = work_ms;
+        }
+
+        const double split_start_ms = get_perf_counter_ms();
+        Split_Job root = { &jobs, split_depth };
+        Job root_job = { split_job, &root, nullptr };
+        Job_Counter done = {};
+        jobs.run(&root_job, 1, &done);
+        jobs.wait(&done);
+        const double split_ms = get_perf_counter_ms() - split_start_ms;
+        const uint32_t num_split_jobs = (2u << split_depth) - 1;
+
+        jobs.destroy();
+
+        const double speedup = single_thread_work_ms / work_ms;
+        log_info("  %2u threads | empty %7.1f ns/job | work %8.2f ms, speedup %5.2f, efficiency %3.0f%%"
+            " | split %7.1f ns/job\n",
+            num_threads,
+            empty_ms * 1e6 / num_empty_jobs,
+            work_ms, speedup, 100.0 * speedup / num_threads,
+            split_ms * 1e6 / num_split_jobs);
+
+        if (num_threads == max_threads) {
+            break;
+        }
+    }
+}
+
+/**
+ * Default matrix: a light and a heavy scene in both vertex formats on every draw path,
+ * recorded serially and on every job thread.
+ */
+void Bench_Config::init(uint32_t max_threads) {
+    object_counts = { 1024, 16384 };
+    vertex_formats = { Vertex_Format::Packed, Vertex_Format::Float };
+    draw_paths = { Draw_Path::Uniform_Dynamic, Draw_Path::Push_Constant, Draw_Path::Instanced };
+    thread_counts = { 1 };
+    if (max_threads > 1) {
+        thread_counts.push_back(max_threads);
+    }
+    num_warmup_frames = 32;
+    num_frames = 256;
+
+    json_path.clear();
+    csv_path.clear();
+    baseline_path.clear();
+    regression_threshold = 0.1;
+}
+
+uint32_t Bench_Config::max_objects() const {
+    uint32_t max_count = 0;
+    for (uint32_t count : object_counts) {
+        max_count = std::max(max_count, count);
+    }
+    return max_count;
+}
+
+/**
+ * Apply a --bench-* command line option.
+ *
+ * --bench-objects <n,...>
+ * --bench-formats <packed|float,...>
+ * --bench-paths <uniform|push|instanced,...>
+ * --bench-threads <n,...>
+ * --bench-warmup <n>
+ * --bench-frames <n>
+ * --bench-json <path>
+ * --bench-csv <path>
+ * --bench-baseline <path>: JSON written by an earlier run
+ * --bench-threshold <percent>: regression threshold, 10 by default
+ *
+ * \return false if the option is unknown or the value is invalid.
+ */
+bool parse_bench_option(char const* option, char const* value, Bench_Config* config) {
+    assert(option && value && config);
+    if (strcmp(option, "--bench-objects") == 0) {
+        return parse_list(value, parse_count, &config->object_counts);
+    }
+    if (strcmp(option, "--bench-formats") == 0) {
+        return parse_list(value, parse_vertex_format, &config->vertex_formats);
+    }
+    if (strcmp(option, "--bench-paths") == 0) {
+        return parse_list(value, parse_draw_path, &config->draw_paths);
+    }
+    if (strcmp(option, "--bench-threads") == 0) {
+        return parse_list(value, parse_count, &config->thread_counts);
+    }
+    if (strcmp(option, "--bench-warmup") == 0) {
+        config->num_warmup_frames = static_cast<uint32_t>(std::max(atoi(value), 0));
+        return true;
+    }
+    if (strcmp(option, "--bench-frames") == 0) {
+        return parse_count(value, &config->num_frames);
+    }
+    if (strcmp(option, "--bench-json") == 0) {
+        config->json_path = value;
+        return true;
+    }
+    if (strcmp(option, "--bench-csv") == 0) {
+        config->csv_path = value;
+        return true;
+    }
+    if (strcmp(option, "--bench-baseline") == 0) {
+        config->baseline_path = value;
+        return true;
+    }
+    if (strcmp(option, "--bench-threshold") == 0) {
+        char* end;
+        const double percent = strtod(value, &end);
+        if (end == value || *end != '\0' || percent < 0.0) {
+            return false;
+        }
+        config->regression_threshold = percent / 100.0;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Render every scene of the matrix and measure it.
+ *
+ * Each scene renders the warmup frames, then the measured ones. Frame times are the wall time
+ * between render() calls returning, with frames in flight they settle at the GPU's rate when it
+ * is the bottleneck. Phase times are the means of render()'s own.
+ *
+ * NOTE: The uniform ring and the instance buffer must have room for config.max_objects() draws
+ * a frame.
+ */
+Status bench_scenes(Vulkan_Instance_Info& vulkan, Bench_Config const& config, std::vector<Bench_Result>* results) {
+    assert(results && config.num_frames > 0);
+
+    std::vector<glm::mat4> saved_models = vulkan.draw_models;
+    const Draw_Path saved_path = vulkan.draw_path;
+    const Vertex_Format saved_format = vulkan.vertex_format;
+    const bool saved_prerecord = vulkan.prerecord_cmd_bufs;
+    const bool saved_parallel = vulkan.parallel_recording;
+    const uint32_t saved_max_ranges = vulkan.max_record_ranges;
+
+    // Every frame is recorded, otherwise only submission would be measured
+    vulkan.prerecord_cmd_bufs = false;
+    const uint32_t max_record_threads = static_cast<uint32_t>(vulkan.frames[0].record_cmd_bufs.size());
+
+    std::vector<Instance_Data> instances;
+    std::vector<double> frame_ms(config.num_frames);
+
+    log_info("Scene benchmark: %u warmup frames, %u measured frames\n", config.num_warmup_frames, config.num_frames);
+    for (Vertex_Format format : config.vertex_formats) {
+        STATUS_CHECK(vulkan.set_vertex_format(format));
+
+        // Otherwise paths still compiling would be measured through the fallback
+        for (Draw_Path path : config.draw_paths) {
+            vulkan.draw_path_pipeline(path);
+        }
+        STATUS_CHECK(vulkan.pipelines.wait_all());
+
+        for (uint32_t num_objects : config.object_counts) {
+            make_cube_grid(num_objects, &vulkan.draw_models);
+            instances.resize(num_objects);
+            for (uint32_t i = 0; i < num_objects; ++i) {
+                instances[i].model = vulkan.draw_models[i];
+                instances[i].color = glm::vec4(1.0f);
+            }
+
+            for (Draw_Path path : config.draw_paths) {
+                vulkan.draw_path = path;
+                const bool instanced = path == Draw_Path::Instanced;
+
+                for (uint32_t num_threads : config.thread_counts) {
+                    // Recording is split into at most one range per job thread
+                    const uint32_t num_record_threads = std::max(std::min(num_threads, max_record_threads), 1u);
+                    vulkan.parallel_recording = num_record_threads > 1;
+                    vulkan.max_record_ranges = num_record_threads;
+
+                    for (uint32_t i = 0; i < config.num_warmup_frames; ++i) {
+                        if (instanced) {
+                            STATUS_CHECK(vulkan.write_instances(instances.data(), num_objects));
+                        }
+                        STATUS_CHECK(vulkan.render());
+                    }
+
+                    // Instanced frames include writing the instance stream
+                    Frame_Phase_Times phase_sums = {};
+                    double frame_start_ms = get_perf_counter_ms();
+                    for (uint32_t i = 0; i < config.num_frames; ++i) {
+                        if (instanced) {
+                            STATUS_CHECK(vulkan.write_instances(instances.data(), num_objects));
+                        }
+                        STATUS_CHECK(vulkan.render());
+
+                        const double frame_end_ms = get_perf_counter_ms();
+                        frame_ms[i] = frame_end_ms - frame_start_ms;
+                        frame_start_ms = frame_end_ms;
+
+                        Frame_Phase_Times const& phases = vulkan.phase_times;
+                        phase_sums.wait_ms += phases.wait_ms;
+                        phase_sums.acquire_ms += phases.acquire_ms;
+                        phase_sums.record_ms += phases.record_ms;
+                        phase_sums.submit_ms += phases.submit_ms;
+                        phase_sums.present_ms += phases.present_ms;
+                    }
+                    VK_CHECK(vkDeviceWaitIdle(vulkan.logical.device));
+
+                    char scene[128];
+                    snprintf(scene, sizeof(scene), "objects=%u format=%s path=%s threads=%u", num_objects,
+                        vertex_format_name(format), draw_path_option_name(path), num_threads);
+
+                    Bench_Result result = {};
+                    result.scene = scene;
+                    result.num_objects = num_objects;
+                    result.vertex_format = vertex_format_name(format);
+                    result.draw_path = draw_path_option_name(path);
+                    result.num_threads = num_record_threads;
+                    result.num_frames = config.num_frames;
+
+                    double total_ms = 0.0;
+                    for (double ms : frame_ms) {
+                        total_ms += ms;
+                    }
+                    std::sort(frame_ms.begin(), frame_ms.end());
+                    result.frame_mean_ms = total_ms / config.num_frames;
+                    result.frame_p50_ms = sorted_percentile(frame_ms, 0.50);
+                    result.frame_p95_ms = sorted_percentile(frame_ms, 0.95);
+                    result.frame_p99_ms = sorted_percentile(frame_ms, 0.99);
+                    result.frame_max_ms = frame_ms.back();
+
+                    result.wait_ms = phase_sums.wait_ms / config.num_frames;
+                    result.acquire_ms = phase_sums.acquire_ms / config.num_frames;
+                    result.record_ms = phase_sums.record_ms / config.num_frames;
+                    result.submit_ms = phase_sums.submit_ms / config.num_frames;
+                    result.present_ms = phase_sums.present_ms / config.num_frames;
+
+                    log_info("  %-48s frame mean %8.3f p50 %8.3f p99 %8.3f ms | wait %7.3f record %7.3f"
+                        " submit %7.3f present %7.3f ms\n",
+                        scene, result.frame_mean_ms, result.frame_p50_ms, result.frame_p99_ms,
+                        result.wait_ms, result.record_ms, result.submit_ms, result.present_ms);
+                    results->push_back(result);
+                }
+            }
+        }
+    }
+
+    STATUS_CHECK(vulkan.set_vertex_format(saved_format));
+    vulkan.draw_models = saved_models;
+    vulkan.draw_path = saved_path;
+    vulkan.prerecord_cmd_bufs = saved_prerecord;
+    vulkan.parallel_recording = saved_parallel;
+    vulkan.max_record_ranges = saved_max_ranges;
+    vulkan.mark_cmd_bufs_dirty();
+    return STATUS_OK;
+}
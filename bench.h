@@ -0,0 +1,35 @@
+#pragma once
+
+#include "bench_report.h"
+#include "job_system.h"
+#include "platform.h"
+#include "renderer.h"
+#include "status.h"
+#include <string>
+#include <vector>
+
+/**
+ * Matrix of scenes measured by bench_scenes(), every combination of the lists is a scene.
+ */
+struct Bench_Config {
+    std::vector<uint32_t> object_counts;       //!< Cubes drawn, one draw each except when instanced
+    std::vector<Vertex_Format> vertex_formats;
+    std::vector<Draw_Path> draw_paths;
+    std::vector<uint32_t> thread_counts;       //!< Recording threads, 1 records serially
+    uint32_t num_warmup_frames;
+    uint32_t num_frames;
+
+    std::string json_path;                     //!< Results written here if set
+    std::string csv_path;                      //!< Results written here if set
+    std::string baseline_path;                 //!< JSON results to compare against if set
+    double regression_threshold;               //!< Fraction a metric may exceed its baseline by
+
+    void init(uint32_t max_threads);
+    uint32_t max_objects() const;
+};
+
+bool parse_bench_option(char const* option, char const* value, Bench_Config* config);
+Status bench_scenes(Vulkan_Instance_Info& vulkan, Bench_Config const& config, std::vector<Bench_Result>* results);
+
+Status bench_draw_paths(Vulkan_Instance_Info& vulkan, Window const& window, uint32_t num_draws, uint32_t num_frames);
+void bench_job_system(uint32_t max_threads);
@@ -0,0 +1,324 @@
+#include "bench_report.h"
+
+#include "platform.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    // Differences below this are timer noise whatever the threshold
+    static constexpr double min_regression_ms = 0.05;
+
+    void write_json_string(std::ostream& out, std::string const& value) {
+        out << '"';
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out << '\\';
+            }
+            out << c;
+        }
+        out << '"';
+    }
+
+    void write_number(std::ostream& out, double value) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.4f", value);
+        out << buf;
+    }
+
+    Bench_Metric const* find_metric(std::string const& name) {
+        for (uint32_t i = 0; i < num_bench_metrics; ++i) {
+            if (name == bench_metrics[i].name) {
+                return &bench_metrics[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Cursor over the text of a results file.
+     */
+    struct Json_Reader {
+        char const* pos;
+        char const* end;
+
+        void skip_space() {
+            while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r')) {
+                ++pos;
+            }
+        }
+
+        bool consume(char c) {
+            skip_space();
+            if (pos < end && *pos == c) {
+                ++pos;
+                return true;
+            }
+            return false;
+        }
+
+        bool read_string(std::string* value) {
+            if (!consume('"')) {
+                return false;
+            }
+            value->clear();
+            while (pos < end && *pos != '"') {
+                if (*pos == '\\' && pos + 1 < end) {
+                    ++pos;
+                }
+                value->push_back(*pos++);
+            }
+            return consume('"');
+        }
+
+        bool read_number(double* value) {
+            skip_space();
+            // The text is not null terminated, copy the number out
+            char buf[64];
+            size_t length = 0;
+            while (pos < end && length < sizeof(buf) - 1 && strchr("+-.0123456789eE", *pos)) {
+                buf[length++] = *pos++;
+            }
+            buf[length] = '\0';
+            char* number_end;
+            *value = strtod(buf, &number_end);
+            return length > 0 && *number_end == '\0';
+        }
+
+        /**
+         * A flat object of string and number values.
+         */
+        bool read_result(Bench_Result* result) {
+            if (!consume('{')) {
+                return false;
+            }
+            if (consume('}')) {
+                return true;
+            }
+
+            do {
+                std::string key;
+                if (!read_string(&key) || !consume(':')) {
+                    return false;
+                }
+
+                skip_space();
+                if (pos < end && *pos == '"') {
+                    std::string value;
+                    if (!read_string(&value)) {
+                        return false;
+                    }
+                    if (key == "scene") {
+                        result->scene = value;
+                    }
+                    else if (key == "vertex_format") {
+                        result->vertex_format = value;
+                    }
+                    else if (key == "draw_path") {
+                        result->draw_path = value;
+                    }
+                }
+                else {
+                    double value;
+                    if (!read_number(&value)) {
+                        return false;
+                    }
+                    if (key == "objects") {
+                        result->num_objects = static_cast<uint32_t>(value);
+                    }
+                    else if (key == "threads") {
+                        result->num_threads = static_cast<uint32_t>(value);
+                    }
+                    else if (key == "frames") {
+                        result->num_frames = static_cast<uint32_t>(value);
+                    }
+                    else if (Bench_Metric const* metric = find_metric(key)) {
+                        result->*metric->value = value;
+                    }
+                }
+            } while (consume(','));
+
+            return consume('}');
+        }
+    };
+}
+
+Bench_Metric const bench_metrics[] = {
+    { "frame_mean_ms", &Bench_Result::frame_mean_ms, true },
+    { "frame_p50_ms", &Bench_Result::frame_p50_ms, false },
+    { "frame_p95_ms", &Bench_Result::frame_p95_ms, false },
+    { "frame_p99_ms", &Bench_Result::frame_p99_ms, true },
+    { "frame_max_ms", &Bench_Result::frame_max_ms, false },
+    { "wait_ms", &Bench_Result::wait_ms, false },
+    { "acquire_ms", &Bench_Result::acquire_ms, false },
+    { "record_ms", &Bench_Result::record_ms, true },
+    { "submit_ms", &Bench_Result::submit_ms, true },
+    { "present_ms", &Bench_Result::present_ms, false },
+};
+uint32_t const num_bench_metrics = static_cast<uint32_t>(sizeof(bench_metrics) / sizeof(bench_metrics[0]));
+
+/**
+ * One object per scene under "results", read back by read_bench_json().
+ */
+bool write_bench_json(char const* path, std::vector<Bench_Result> const& results) {
+    assert(path);
+    std::ofstream f(path, std::ios::trunc);
+    if (!f.is_open()) {
+        log_error("Unable to write %s\n", path);
+        return false;
+    }
+
+    f << "{\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        Bench_Result const& result = results[i];
+        f << (i == 0 ? "\n" : ",\n") << "    { \"scene\": ";
+        write_json_string(f, result.scene);
+        f << ", \"objects\": " << result.num_objects << ", \"vertex_format\": ";
+        write_json_string(f, result.vertex_format);
+        f << ", \"draw_path\": ";
+        write_json_string(f, result.draw_path);
+        f << ", \"threads\": " << result.num_threads << ", \"frames\": " << result.num_frames;
+        for (uint32_t j = 0; j < num_bench_metrics; ++j) {
+            f << ", \"" << bench_metrics[j].name << "\": ";
+            write_number(f, result.*bench_metrics[j].value);
+        }
+        f << " }";
+    }
+    f << "\n  ]\n}\n";
+
+    if (!f) {
+        log_error("Unable to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Header row, then one row per scene. Scene names contain no commas.
+ */
+bool write_bench_csv(char const* path, std::vector<Bench_Result> const& results) {
+    assert(path);
+    std::ofstream f(path, std::ios::trunc);
+    if (!f.is_open()) {
+        log_error("Unable to write %s\n", path);
+        return false;
+    }
+
+    f << "scene,objects,vertex_format,draw_path,threads,frames";
+    for (uint32_t i = 0; i < num_bench_metrics; ++i) {
+        f << ',' << bench_metrics[i].name;
+    }
+    f << '\n';
+
+    for (Bench_Result const& result : results) {
+        f << result.scene << ',' << result.num_objects << ',' << result.vertex_format << ','
+            << result.draw_path << ',' << result.num_threads << ',' << result.num_frames;
+        for (uint32_t i = 0; i < num_bench_metrics; ++i) {
+            f << ',';
+            write_number(f, result.*bench_metrics[i].value);
+        }
+        f << '\n';
+    }
+
+    if (!f) {
+        log_error("Unable to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read results written by write_bench_json(). Not a general JSON parser, values must be
+ * strings or numbers and unknown keys are skipped.
+ */
+bool read_bench_json(char const* path, std::vector<Bench_Result>* results) {
+    assert(path && results);
+    std::ifstream f(path);
+    if (!f.is_open()) {
+        log_error("Unable to open %s\n", path);
+        return false;
+    }
+    std::stringstream text;
+    text << f.rdbuf();
+    const std::string contents = text.str();
+
+    results->clear();
+    const size_t results_pos = contents.find("\"results\"");
+    if (results_pos == std::string::npos) {
+        log_error("%s has no results\n", path);
+        return false;
+    }
+
+    Json_Reader reader = { contents.data() + results_pos + strlen("\"results\""), contents.data() + contents.size() };
+    if (!reader.consume(':') || !reader.consume('[')) {
+        log_error("%s: results is not an array\n", path);
+        return false;
+    }
+    if (reader.consume(']')) {
+        return true;
+    }
+
+    do {
+        Bench_Result result = {};
+        if (!reader.read_result(&result)) {
+            log_error("%s: malformed result at offset %zu\n", path, static_cast<size_t>(reader.pos - contents.data()));
+            return false;
+        }
+        results->push_back(result);
+    } while (reader.consume(','));
+
+    if (!reader.consume(']')) {
+        log_error("%s: results array is not closed\n", path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Print every compared metric more than threshold slower than in the baseline. Scenes
+ * missing from the baseline are listed but don't count as regressions.
+ *
+ * \param threshold Fraction a metric may exceed its baseline value by, 0.1 for 10%.
+ * \return Number of regressed metrics.
+ */
+uint32_t compare_bench_results(std::vector<Bench_Result> const& results, std::vector<Bench_Result> const& baseline,
+    double threshold)
+{
+    assert(threshold >= 0.0);
+    uint32_t num_regressions = 0;
+
+    log_info("Baseline comparison, threshold %.1f%%\n", threshold * 100.0);
+    for (Bench_Result const& result : results) {
+        Bench_Result const* base = nullptr;
+        for (Bench_Result const& candidate : baseline) {
+            if (candidate.scene == result.scene) {
+                base = &candidate;
+                break;
+            }
+        }
+        if (!base) {
+            log_info("  %-48s not in baseline\n", result.scene.c_str());
+            continue;
+        }
+
+        for (uint32_t i = 0; i < num_bench_metrics; ++i) {
+            Bench_Metric const& metric = bench_metrics[i];
+            if (!metric.compared) {
+                continue;
+            }
+
+            const double base_value = base->*metric.value;
+            const double value = result.*metric.value;
+            if (value > base_value * (1.0 + threshold) && value - base_value > min_regression_ms) {
+                log_error("  %-48s %-14s %9.3f ms -> %9.3f ms (%+.1f%%) REGRESSION\n", result.scene.c_str(), metric.name,
+                    base_value, value, base_value > 0.0 ? (value / base_value - 1.0) * 100.0 : 100.0);
+                ++num_regressions;
+            }
+        }
+    }
+
+    log_info("  %u regressions\n", num_regressions);
+    return num_regressions;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Measurements of one benchmark scene. Times are CPU milliseconds per frame.
+ */
+struct Bench_Result {
+    std::string scene;         //!< Unique within a run, results are matched to a baseline by it
+    uint32_t num_objects;
+    std::string vertex_format;
+    std::string draw_path;
+    uint32_t num_threads;
+    uint32_t num_frames;       //!< Measured, warmup frames excluded
+
+    double frame_mean_ms;
+    double frame_p50_ms;
+    double frame_p95_ms;
+    double frame_p99_ms;
+    double frame_max_ms;
+
+    // Mean of each render() phase, see Frame_Phase_Times
+    double wait_ms;
+    double acquire_ms;
+    double record_ms;
+    double submit_ms;
+    double present_ms;
+};
+
+/**
+ * A metric of Bench_Result, in the order reports list them.
+ */
+struct Bench_Metric {
+    char const* name;
+    double Bench_Result::* value;
+    bool compared; //!< Checked against the baseline, the others are for reading only
+};
+
+extern Bench_Metric const bench_metrics[];
+extern uint32_t const num_bench_metrics;
+
+bool write_bench_json(char const* path, std::vector<Bench_Result> const& results);
+bool write_bench_csv(char const* path, std::vector<Bench_Result> const& results);
+bool read_bench_json(char const* path, std::vector<Bench_Result>* results);
+
+uint32_t compare_bench_results(std::vector<Bench_Result> const& results, std::vector<Bench_Result> const& baseline,
+    double threshold);
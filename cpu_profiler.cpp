@@ -0,0 +1,211 @@
+#include "cpu_profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace {
+    // Every buffer ever allocated, newest first. Buffers are never freed so a dump still has the
+    // zones of threads that have exited.
+    std::atomic<Cpu_Thread_Buffer*> g_thread_buffers(nullptr);
+    std::atomic<uint32_t> g_num_threads(0);
+
+    // Buffers of exited threads, handed to the next threads to start so short lived threads
+    // don't each leave a buffer behind. Only touched on thread start and exit.
+    std::mutex g_free_buffers_mutex;
+    std::vector<Cpu_Thread_Buffer*> g_free_buffers;
+
+    /**
+     * Returns the thread's buffer to the free list when the thread exits.
+     */
+    struct Thread_Buffer_Owner {
+        Cpu_Thread_Buffer* buffer = nullptr;
+
+        ~Thread_Buffer_Owner() {
+            if (buffer) {
+                std::lock_guard<std::mutex> lock(g_free_buffers_mutex);
+                g_free_buffers.push_back(buffer);
+            }
+        }
+    };
+
+    thread_local Cpu_Thread_Buffer* tls_buffer = nullptr; // Trivial, so the record path has no init guard
+    thread_local Thread_Buffer_Owner tls_owner;
+
+    Cpu_Thread_Buffer* reuse_free_buffer() {
+        std::lock_guard<std::mutex> lock(g_free_buffers_mutex);
+        if (g_free_buffers.empty()) {
+            return nullptr;
+        }
+        Cpu_Thread_Buffer* buffer = g_free_buffers.back();
+        g_free_buffers.pop_back();
+        return buffer;
+    }
+
+    Cpu_Thread_Buffer* thread_buffer() {
+        if (tls_buffer) {
+            return tls_buffer;
+        }
+
+        // A reused buffer keeps counting zones, a dump running now sees the old thread's zones
+        // replaced like any wrapped ring. They stay in the trace under the new thread's name
+        // until overwritten.
+        Cpu_Thread_Buffer* buffer = reuse_free_buffer();
+        if (buffer) {
+            buffer->name.store(nullptr, std::memory_order_release);
+        }
+        else {
+            buffer = new Cpu_Thread_Buffer;
+            buffer->num_written.store(0, std::memory_order_relaxed);
+            buffer->name.store(nullptr, std::memory_order_relaxed);
+            buffer->thread_id = g_num_threads.fetch_add(1, std::memory_order_relaxed) + 1;
+
+            // Release publishes the initialized buffer to dumps acquiring the list
+            buffer->next = g_thread_buffers.load(std::memory_order_relaxed);
+            while (!g_thread_buffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release,
+                std::memory_order_relaxed)) {
+            }
+        }
+
+        tls_owner.buffer = buffer;
+        tls_buffer = buffer;
+        return buffer;
+    }
+
+    /**
+     * Copy the zones of a buffer its thread won't overwrite before the copy is done.
+     */
+    void copy_events(Cpu_Thread_Buffer const& buffer, std::vector<Cpu_Zone_Event>* events) {
+        const uint64_t capacity = Cpu_Thread_Buffer::capacity;
+        const uint64_t end = buffer.num_written.load(std::memory_order_acquire);
+        uint64_t begin = end > capacity ? end - capacity : 0;
+
+        const size_t first = events->size();
+        for (uint64_t i = begin; i < end; ++i) {
+            Cpu_Zone_Slot const& slot = buffer.events[i & (capacity - 1)];
+            events->push_back(Cpu_Zone_Event{ slot.name.load(std::memory_order_relaxed),
+                slot.start_ns.load(std::memory_order_relaxed), slot.end_ns.load(std::memory_order_relaxed) });
+        }
+
+        // Zones written meanwhile may have replaced the oldest copied ones, including the one
+        // being written now that is not counted yet. Once any field of a zone has been read,
+        // the fence pairs with the one in cpu_profiler_record(), so end_after counts every zone
+        // before it.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t end_after = buffer.num_written.load(std::memory_order_relaxed);
+        if (end_after + 1 > capacity && end_after + 1 - capacity > begin) {
+            const uint64_t num_torn = std::min(end_after + 1 - capacity - begin, end - begin);
+            events->erase(events->begin() + first, events->begin() + first + static_cast<size_t>(num_torn));
+        }
+    }
+
+    void write_json_string(std::ostream& out, char const* value) {
+        out << '"';
+        for (char const* c = value; *c; ++c) {
+            if (*c == '"' || *c == '\\') {
+                out << '\\';
+            }
+            out << *c;
+        }
+        out << '"';
+    }
+
+    void write_us(std::ostream& out, uint64_t ns) {
+        // Trace times are microseconds, keep the nanoseconds as decimals
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%llu.%03u", static_cast<unsigned long long>(ns / 1000),
+            static_cast<unsigned>(ns % 1000));
+        out << buf;
+    }
+}
+
+/**
+ * Add a finished zone to the calling thread's buffer, replacing its oldest zone once full.
+ * Never blocks, except for the first zone of a thread which takes a free buffer or allocates
+ * one.
+ */
+void cpu_profiler_record(char const* name, uint64_t start_ns, uint64_t end_ns) {
+    Cpu_Thread_Buffer* buffer = thread_buffer();
+    const uint64_t n = buffer->num_written.load(std::memory_order_relaxed);
+    Cpu_Zone_Slot& slot = buffer->events[n & (Cpu_Thread_Buffer::capacity - 1)];
+
+    // A dump reading the new fields also sees num_written at n, and discards the slot as torn
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start_ns.store(start_ns, std::memory_order_relaxed);
+    slot.end_ns.store(end_ns, std::memory_order_relaxed);
+    buffer->num_written.store(n + 1, std::memory_order_release);
+}
+
+/**
+ * \param name Shown for the calling thread in the trace, must outlive the profiler.
+ */
+void cpu_profiler_set_thread_name(char const* name) {
+    thread_buffer()->name.store(name, std::memory_order_release);
+}
+
+/**
+ * Write the zones of every thread as a Chrome trace event file, for chrome://tracing or
+ * Perfetto. May be called at any time from any thread, the others keep recording.
+ */
+bool cpu_profiler_dump(char const* path) {
+    assert(path);
+    std::ofstream f(path, std::ios::trunc);
+    if (!f.is_open()) {
+        log_error("Unable to write %s\n", path);
+        return false;
+    }
+
+    struct Thread_Events {
+        Cpu_Thread_Buffer const* buffer;
+        std::vector<Cpu_Zone_Event> events;
+    };
+    std::vector<Thread_Events> threads;
+    uint64_t base_ns = UINT64_MAX;
+    size_t num_events = 0;
+    for (Cpu_Thread_Buffer const* buffer = g_thread_buffers.load(std::memory_order_acquire); buffer;
+        buffer = buffer->next)
+    {
+        threads.push_back(Thread_Events{ buffer, {} });
+        copy_events(*buffer, &threads.back().events);
+        for (Cpu_Zone_Event const& event : threads.back().events) {
+            base_ns = std::min(base_ns, event.start_ns);
+        }
+        num_events += threads.back().events.size();
+    }
+
+    // Complete events ("X"), with the threads named by metadata events ("M")
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (Thread_Events const& thread : threads) {
+        const uint32_t tid = thread.buffer->thread_id;
+        if (char const* name = thread.buffer->name.load(std::memory_order_acquire)) {
+            f << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                << ",\"args\":{\"name\":";
+            write_json_string(f, name);
+            f << "}}";
+            first = false;
+        }
+
+        for (Cpu_Zone_Event const& event : thread.events) {
+            f << (first ? "\n" : ",\n") << "{\"name\":";
+            write_json_string(f, event.name);
+            f << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"ts\":";
+            write_us(f, event.start_ns - base_ns);
+            f << ",\"dur\":";
+            write_us(f, event.end_ns - event.start_ns);
+            f << "}";
+            first = false;
+        }
+    }
+    f << "\n]}\n";
+
+    if (!f) {
+        log_error("Unable to write %s\n", path);
+        return false;
+    }
+    log_info("CPU trace: %zu zones of %zu threads written to %s\n", num_events, threads.size(), path);
+    return true;
+}
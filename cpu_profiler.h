@@ -0,0 +1,86 @@
+#pragma once
+
+#include "platform.h"
+#include "types.h"
+#include <atomic>
+#include <cstdint>
+
+// Build with CPU_PROFILER_ENABLED=0 to compile every zone out
+#ifndef CPU_PROFILER_ENABLED
+#   define CPU_PROFILER_ENABLED 1
+#endif
+
+struct Cpu_Zone_Event {
+    char const* name;   //!< Must outlive the profiler, a literal or __func__
+    uint64_t start_ns;  //!< get_perf_counter_ns()
+    uint64_t end_ns;
+};
+
+/**
+ * Ring entry of a Cpu_Zone_Event. Relaxed atomics, a dump may read it while the owning thread
+ * overwrites it and discards what it read then.
+ */
+struct Cpu_Zone_Slot {
+    std::atomic<char const*> name;
+    std::atomic<uint64_t> start_ns;
+    std::atomic<uint64_t> end_ns;
+};
+
+/**
+ * Zones recorded by one thread, the latest capacity of them. Only the owning thread writes,
+ * cpu_profiler_dump() reads from any thread without stopping it. Once the thread exits the
+ * buffer passes to the next thread to start, so there are only as many buffers as threads
+ * ever alive at once.
+ */
+struct Cpu_Thread_Buffer {
+    static constexpr uint32_t capacity = 64 * 1024;
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+    Cpu_Zone_Slot events[capacity];          //!< Ring, zone n is at n % capacity
+    std::atomic<uint64_t> num_written;       //!< Zones ever written, released after each one
+    std::atomic<char const*> name;           //!< Shown for the thread, null until named
+    uint32_t thread_id;
+    Cpu_Thread_Buffer* next;                 //!< Previously registered thread
+};
+
+void cpu_profiler_record(char const* name, uint64_t start_ns, uint64_t end_ns);
+void cpu_profiler_set_thread_name(char const* name);
+bool cpu_profiler_dump(char const* path);
+
+/**
+ * Records the time from its creation to its destruction on the calling thread.
+ */
+struct Cpu_Zone {
+    char const* name;
+    uint64_t start_ns;
+
+    explicit Cpu_Zone(char const* name) : name(name), start_ns(get_perf_counter_ns()) {}
+    ~Cpu_Zone() { cpu_profiler_record(name, start_ns, get_perf_counter_ns()); }
+
+    /**
+     * End the zone and start the next one, for a sequence of phases in one scope.
+     */
+    void next(char const* next_name) {
+        const uint64_t now_ns = get_perf_counter_ns();
+        cpu_profiler_record(name, start_ns, now_ns);
+        name = next_name;
+        start_ns = now_ns;
+    }
+
+    Cpu_Zone(Cpu_Zone const&) = delete;
+    Cpu_Zone& operator=(Cpu_Zone const&) = delete;
+};
+
+#if CPU_PROFILER_ENABLED
+#   define PROFILE_ZONE(Name) Cpu_Zone UNIQUE_IDENT(cpu_zone)(Name)
+#   define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#   define PROFILE_PHASE(Zone, Name) Cpu_Zone Zone(Name)
+#   define PROFILE_NEXT_PHASE(Zone, Name) Zone.next(Name)
+#   define PROFILE_THREAD_NAME(Name) cpu_profiler_set_thread_name(Name)
+#else
+#   define PROFILE_ZONE(Name) ((void)0)
+#   define PROFILE_FUNCTION() ((void)0)
+#   define PROFILE_PHASE(Zone, Name) ((void)0)
+#   define PROFILE_NEXT_PHASE(Zone, Name) ((void)0)
+#   define PROFILE_THREAD_NAME(Name) ((void)0)
+#endif
@@ -0,0 +1,437 @@
+#include "device_memory.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+    /**
+     * \param alignment Power of two.
+     */
+    VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    /**
+     * True if the last byte of one resource and the first byte of the next share a
+     * bufferImageGranularity sized page.
+     */
+    bool on_same_page(VkDeviceSize a_last_byte, VkDeviceSize b_first_byte, VkDeviceSize page_size) {
+        return (a_last_byte & ~(page_size - 1)) == (b_first_byte & ~(page_size - 1));
+    }
+}
+
+void Device_Allocator::init(VkDevice device, VkPhysicalDeviceMemoryProperties const& memory_properties,
+    VkDeviceSize buffer_image_granularity)
+{
+    this->device = device;
+    this->memory_properties = memory_properties;
+    this->buffer_image_granularity = std::max<VkDeviceSize>(buffer_image_granularity, 1);
+    block_size = default_block_size;
+    blocks.clear();
+}
+
+void Device_Allocator::destroy() {
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].mem == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        if (blocks[i].num_allocations != 0) {
+            log_error("Device memory block %u destroyed with %u live allocations\n", i, blocks[i].num_allocations);
+        }
+        destroy_block(i);
+    }
+    blocks.clear();
+}
+
+bool Device_Allocator::find_memory_type(uint32_t type_bits, VkFlags requirements_mask, uint32_t* type_index) const {
+    // Seach memory types and find the first index with desired properties
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
+        if ((type_bits & 1) == 1) {
+            // Type is available
+
+            if ((memory_properties.memoryTypes[i].propertyFlags & requirements_mask) == requirements_mask) {
+                *type_index = i;
+                return true;
+            }
+        }
+
+        type_bits >>= 1;
+    }
+
+    // No matches
+    return false;
+}
+
+/**
+ * \param memory_type Memory type index, see find_memory_type().
+ * \param owner Opaque pointer handed to the defragment callback. nullptr pins the allocation.
+ */
+Status Device_Allocator::allocate(uint32_t memory_type, VkMemoryRequirements const& mem_reqs, Resource_Kind kind,
+    Alloc_Strategy strategy, void* owner, Device_Allocation* alloc)
+{
+    assert(alloc);
+    assert(memory_type < memory_properties.memoryTypeCount);
+    assert((mem_reqs.memoryTypeBits & (1u << memory_type)) != 0);
+
+    const VkDeviceSize type_block_size = block_size_for_type(memory_type);
+
+    // Large resources would waste most of a shared block, give them their own
+    if (mem_reqs.size > type_block_size / 2) {
+        uint32_t block_index;
+        STATUS_CHECK(create_block(memory_type, mem_reqs.size, Alloc_Strategy::Free_List, true, &block_index));
+        if (!try_allocate_from_block(block_index, mem_reqs, kind, owner, alloc)) {
+            assert(!"Dedicated block too small for its allocation");
+            return !STATUS_OK;
+        }
+        return STATUS_OK;
+    }
+
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        Memory_Block const& block = blocks[i];
+        if (block.mem == VK_NULL_HANDLE || block.dedicated || block.memory_type != memory_type || block.strategy != strategy) {
+            continue;
+        }
+
+        if (try_allocate_from_block(i, mem_reqs, kind, owner, alloc)) {
+            return STATUS_OK;
+        }
+    }
+
+    // No room in the existing blocks
+    uint32_t block_index;
+    STATUS_CHECK(create_block(memory_type, type_block_size, strategy, false, &block_index));
+    if (!try_allocate_from_block(block_index, mem_reqs, kind, owner, alloc)) {
+        log_error("Unable to sub-allocate %llu bytes from a new block\n", static_cast<unsigned long long>(mem_reqs.size));
+        return !STATUS_OK;
+    }
+
+    return STATUS_OK;
+}
+
+void Device_Allocator::free(Device_Allocation* alloc) {
+    assert(alloc);
+    if (alloc->mem == VK_NULL_HANDLE) {
+        return;
+    }
+
+    assert(alloc->block_index < blocks.size());
+    Memory_Block& block = blocks[alloc->block_index];
+    assert(block.mem == alloc->mem);
+    assert(block.num_allocations > 0);
+
+    --block.num_allocations;
+    block.used_bytes -= alloc->size;
+
+    if (block.strategy == Alloc_Strategy::Linear) {
+        // Space is only reclaimed once the whole block is empty
+        if (block.num_allocations == 0) {
+            block.linear_offset = 0;
+        }
+    }
+    else {
+        auto it = std::lower_bound(block.ranges.begin(), block.ranges.end(), alloc->offset,
+            [](Memory_Block::Range const& range, VkDeviceSize offset) { return range.offset < offset; });
+        assert(it != block.ranges.end() && it->offset == alloc->offset && !it->free);
+        it->free = true;
+        it->owner = nullptr;
+
+        // Coalesce with neighbouring free ranges
+        size_t i = static_cast<size_t>(it - block.ranges.begin());
+        if (i + 1 < block.ranges.size() && block.ranges[i + 1].free) {
+            block.ranges[i].size += block.ranges[i + 1].size;
+            block.ranges.erase(block.ranges.begin() + i + 1);
+        }
+        if (i > 0 && block.ranges[i - 1].free) {
+            block.ranges[i - 1].size += block.ranges[i].size;
+            block.ranges.erase(block.ranges.begin() + i);
+        }
+    }
+
+    if (block.dedicated && block.num_allocations == 0) {
+        destroy_block(alloc->block_index);
+    }
+
+    *alloc = {};
+}
+
+/**
+ * Compact free list blocks of each memory type by moving allocations out of the least used
+ * blocks into the fuller ones, then release the blocks left empty.
+ *
+ * Only allocations made with an owner are moved. With a null move_fn this only releases
+ * empty blocks.
+ *
+ * NOTE: The caller must ensure the GPU is not using any movable resource.
+ */
+Status Device_Allocator::defragment(Defrag_Move_Fn move_fn, void* user_data) {
+    if (move_fn) {
+        for (uint32_t type = 0; type < memory_properties.memoryTypeCount; ++type) {
+            std::vector<uint32_t> type_blocks;
+            for (uint32_t i = 0; i < blocks.size(); ++i) {
+                Memory_Block const& block = blocks[i];
+                if (block.mem != VK_NULL_HANDLE && !block.dedicated && block.memory_type == type
+                    && block.strategy == Alloc_Strategy::Free_List)
+                {
+                    type_blocks.push_back(i);
+                }
+            }
+            if (type_blocks.size() < 2) {
+                continue;
+            }
+
+            // Fullest blocks first, they are the destinations
+            std::sort(type_blocks.begin(), type_blocks.end(), [this](uint32_t a, uint32_t b) {
+                return blocks[a].used_bytes > blocks[b].used_bytes;
+            });
+
+            for (size_t src_pos = type_blocks.size() - 1; src_pos > 0; --src_pos) {
+                const uint32_t src_index = type_blocks[src_pos];
+
+                // Copy out, the source ranges change as allocations leave
+                std::vector<Memory_Block::Range> movable;
+                for (Memory_Block::Range const& range : blocks[src_index].ranges) {
+                    if (!range.free && range.owner) {
+                        movable.push_back(range);
+                    }
+                }
+
+                for (Memory_Block::Range const& range : movable) {
+                    VkMemoryRequirements mem_reqs = {};
+                    mem_reqs.size = range.size;
+                    mem_reqs.alignment = range.alignment;
+                    mem_reqs.memoryTypeBits = 1u << type;
+
+                    Device_Allocation new_alloc = {};
+                    bool moved = false;
+                    for (size_t dst_pos = 0; dst_pos < src_pos && !moved; ++dst_pos) {
+                        moved = try_allocate_from_block(type_blocks[dst_pos], mem_reqs, range.kind, range.owner, &new_alloc);
+                    }
+                    if (!moved) {
+                        continue;
+                    }
+
+                    Memory_Block const& src = blocks[src_index];
+                    Device_Allocation old_alloc = {};
+                    old_alloc.mem = src.mem;
+                    old_alloc.offset = range.offset;
+                    old_alloc.size = range.size;
+                    old_alloc.mapped = src.mapped ? src.mapped + range.offset : nullptr;
+                    old_alloc.memory_type = type;
+                    old_alloc.block_index = src_index;
+
+                    STATUS_CHECK(move_fn(user_data, range.owner, old_alloc, new_alloc));
+                    free(&old_alloc);
+                }
+            }
+        }
+    }
+
+    release_empty_blocks();
+    return STATUS_OK;
+}
+
+void Device_Allocator::release_empty_blocks() {
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].mem != VK_NULL_HANDLE && blocks[i].num_allocations == 0) {
+            destroy_block(i);
+        }
+    }
+}
+
+Device_Allocator_Stats Device_Allocator::get_stats() const {
+    Device_Allocator_Stats stats = {};
+
+    for (Memory_Block const& block : blocks) {
+        if (block.mem == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        ++stats.num_blocks;
+        stats.num_allocations += block.num_allocations;
+        stats.block_bytes += block.size;
+        stats.used_bytes += block.used_bytes;
+
+        if (block.strategy == Alloc_Strategy::Linear) {
+            const VkDeviceSize tail = block.size - block.linear_offset;
+            stats.free_bytes += tail;
+            stats.largest_free_range = std::max(stats.largest_free_range, tail);
+        }
+        else {
+            for (Memory_Block::Range const& range : block.ranges) {
+                if (range.free) {
+                    stats.free_bytes += range.size;
+                    stats.largest_free_range = std::max(stats.largest_free_range, range.size);
+                }
+            }
+        }
+    }
+
+    if (stats.free_bytes > 0) {
+        stats.fragmentation = 1.0f - static_cast<float>(stats.largest_free_range) / static_cast<float>(stats.free_bytes);
+    }
+
+    return stats;
+}
+
+/**
+ * \param label Tells apart the points the stats were taken at, eg. "before defragment".
+ */
+void Device_Allocator::log_stats(char const* label) const {
+    const Device_Allocator_Stats stats = get_stats();
+    log_info("Device memory (%s): %u blocks, %u allocations, %llu of %llu bytes used, %llu free, largest free range %llu, fragmentation %.2f\n",
+        label, stats.num_blocks, stats.num_allocations, static_cast<unsigned long long>(stats.used_bytes),
+        static_cast<unsigned long long>(stats.block_bytes), static_cast<unsigned long long>(stats.free_bytes),
+        static_cast<unsigned long long>(stats.largest_free_range), stats.fragmentation);
+}
+
+/**
+ * Blocks are capped to a fraction of their heap so small heaps (eg. host visible device
+ * memory on discrete GPUs) are not exhausted by a single block.
+ */
+VkDeviceSize Device_Allocator::block_size_for_type(uint32_t memory_type) const {
+    const uint32_t heap_index = memory_properties.memoryTypes[memory_type].heapIndex;
+    const VkDeviceSize heap_size = memory_properties.memoryHeaps[heap_index].size;
+    return std::min(block_size, heap_size / 8);
+}
+
+Status Device_Allocator::create_block(uint32_t memory_type, VkDeviceSize size, Alloc_Strategy strategy, bool dedicated,
+    uint32_t* block_index)
+{
+    assert(block_index);
+
+    VkMemoryAllocateInfo mem_alloc = {};
+    mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    mem_alloc.pNext = nullptr;
+    mem_alloc.allocationSize = size;
+    mem_alloc.memoryTypeIndex = memory_type;
+
+    Memory_Block block = {};
+    VK_CHECK(vkAllocateMemory(device, &mem_alloc, nullptr, &block.mem));
+    block.size = size;
+    block.memory_type = memory_type;
+    block.strategy = strategy;
+    block.dedicated = dedicated;
+    block.ranges.push_back({ 0, size, true, 1, Resource_Kind::Linear, nullptr });
+
+    // Host visible blocks stay mapped for their lifetime, memory can only be mapped once
+    if (memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VK_CHECK(vkMapMemory(device, block.mem, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&block.mapped)));
+    }
+
+    // Reuse a released slot so block indices held by live allocations stay valid
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].mem == VK_NULL_HANDLE) {
+            blocks[i] = std::move(block);
+            *block_index = i;
+            return STATUS_OK;
+        }
+    }
+
+    blocks.push_back(std::move(block));
+    *block_index = static_cast<uint32_t>(blocks.size() - 1);
+    return STATUS_OK;
+}
+
+void Device_Allocator::destroy_block(uint32_t block_index) {
+    Memory_Block& block = blocks[block_index];
+    assert(block.mem != VK_NULL_HANDLE);
+
+    if (block.mapped) {
+        vkUnmapMemory(device, block.mem);
+    }
+    vkFreeMemory(device, block.mem, nullptr);
+    block = {};
+}
+
+bool Device_Allocator::try_allocate_from_block(uint32_t block_index, VkMemoryRequirements const& mem_reqs,
+    Resource_Kind kind, void* owner, Device_Allocation* alloc)
+{
+    Memory_Block& block = blocks[block_index];
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(mem_reqs.alignment, 1);
+    const VkDeviceSize granularity = buffer_image_granularity;
+    VkDeviceSize offset = 0;
+
+    if (block.strategy == Alloc_Strategy::Linear) {
+        offset = align_up(block.linear_offset, alignment);
+
+        // Previous allocation of a different kind may share the page
+        if (block.num_allocations > 0 && block.linear_last_kind != kind && block.linear_offset > 0
+            && on_same_page(block.linear_offset - 1, offset, granularity))
+        {
+            offset = align_up(offset, granularity);
+        }
+
+        if (offset + mem_reqs.size > block.size) {
+            return false;
+        }
+
+        block.linear_offset = offset + mem_reqs.size;
+        block.linear_last_kind = kind;
+    }
+    else {
+        bool found = false;
+        size_t i = 0;
+        for (; i < block.ranges.size(); ++i) {
+            Memory_Block::Range const& range = block.ranges[i];
+            if (!range.free || range.size < mem_reqs.size) {
+                continue;
+            }
+
+            offset = align_up(range.offset, alignment);
+
+            // NOTE: Free ranges are always coalesced, so neighbours of a free range are in use.
+            if (i > 0) {
+                Memory_Block::Range const& prev = block.ranges[i - 1];
+                if (prev.kind != kind && on_same_page(prev.offset + prev.size - 1, offset, granularity)) {
+                    offset = align_up(offset, granularity);
+                }
+            }
+
+            if (offset + mem_reqs.size > range.offset + range.size) {
+                continue;
+            }
+
+            if (i + 1 < block.ranges.size()) {
+                Memory_Block::Range const& next = block.ranges[i + 1];
+                if (next.kind != kind && on_same_page(offset + mem_reqs.size - 1, next.offset, granularity)) {
+                    continue;
+                }
+            }
+
+            found = true;
+            break;
+        }
+
+        if (!found) {
+            return false;
+        }
+
+        // Split the free range into [padding][allocation][remainder]
+        const Memory_Block::Range range = block.ranges[i];
+        const VkDeviceSize padding = offset - range.offset;
+        const VkDeviceSize remainder = range.offset + range.size - (offset + mem_reqs.size);
+
+        Memory_Block::Range used = { offset, mem_reqs.size, false, alignment, kind, owner };
+        block.ranges[i] = used;
+        if (remainder > 0) {
+            block.ranges.insert(block.ranges.begin() + i + 1,
+                { offset + mem_reqs.size, remainder, true, 1, Resource_Kind::Linear, nullptr });
+        }
+        if (padding > 0) {
+            block.ranges.insert(block.ranges.begin() + i,
+                { range.offset, padding, true, 1, Resource_Kind::Linear, nullptr });
+        }
+    }
+
+    ++block.num_allocations;
+    block.used_bytes += mem_reqs.size;
+
+    alloc->mem = block.mem;
+    alloc->offset = offset;
+    alloc->size = mem_reqs.size;
+    alloc->mapped = block.mapped ? block.mapped + offset : nullptr;
+    alloc->memory_type = block.memory_type;
+    alloc->block_index = block_index;
+    return true;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "status.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+#include <vector>
+
+/**
+ * How a memory block hands out space.
+ *
+ * Linear: bump pointer, space is only reclaimed once every allocation in the block is freed.
+ *  Cheapest option for resources with a shared lifetime.
+ * Free_List: first fit over an offset sorted list of ranges, freed ranges are coalesced with
+ *  their neighbours. General purpose.
+ */
+enum class Alloc_Strategy : uint8_t {
+    Linear,
+    Free_List,
+};
+
+/**
+ * Resource tiling, needed to honour bufferImageGranularity between neighbouring allocations.
+ */
+enum class Resource_Kind : uint8_t {
+    Linear,  //!< Buffers and linear tiled images
+    Optimal, //!< Optimal tiled images
+};
+
+struct Device_Allocation {
+    VkDeviceMemory mem;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;         //!< Host address of offset, nullptr if the memory is not host visible
+    uint32_t memory_type;
+    uint32_t block_index;
+};
+
+struct Memory_Block {
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        bool free;
+        VkDeviceSize alignment;
+        Resource_Kind kind;
+        void* owner; //!< Passed back to the defragment callback, nullptr if the allocation can't move
+    };
+
+    VkDeviceMemory mem; //!< VK_NULL_HANDLE if the block slot is unused
+    VkDeviceSize size;
+    uint8_t* mapped;    //!< Persistent mapping of the whole block, nullptr if not host visible
+    uint32_t memory_type;
+    Alloc_Strategy strategy;
+    bool dedicated;     //!< Sized for a single allocation, released as soon as it is freed
+
+    VkDeviceSize used_bytes;
+    uint32_t num_allocations;
+
+    // Linear strategy
+    VkDeviceSize linear_offset;
+    Resource_Kind linear_last_kind;
+
+    // Free list strategy, sorted by offset and covering the whole block
+    std::vector<Range> ranges;
+};
+
+struct Device_Allocator_Stats {
+    uint32_t num_blocks;
+    uint32_t num_allocations;
+    VkDeviceSize block_bytes;        //!< Memory allocated from the driver
+    VkDeviceSize used_bytes;         //!< Memory handed out to allocations
+    VkDeviceSize free_bytes;
+    VkDeviceSize largest_free_range;
+    float fragmentation;             //!< 0 when all free memory is contiguous, approaches 1 as it scatters
+};
+
+/**
+ * Called by Device_Allocator::defragment() for every allocation it relocates. The callee must
+ * move the resource to the new allocation (recreate, bind and copy). The old allocation is
+ * released by the allocator after the callback returns.
+ */
+using Defrag_Move_Fn = Status (*)(void* user_data, void* owner, Device_Allocation const& old_alloc,
+    Device_Allocation const& new_alloc);
+
+/**
+ * Sub-allocates buffers and images out of large vkAllocateMemory blocks, one set of blocks per
+ * memory type. Keeps the driver allocation count low (maxMemoryAllocationCount can be as
+ * small as 4096) and avoids the cost of an allocation per resource.
+ */
+struct Device_Allocator {
+    static constexpr VkDeviceSize default_block_size = 64 * 1024 * 1024;
+
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize buffer_image_granularity;
+    VkDeviceSize block_size;
+    std::vector<Memory_Block> blocks;
+
+    void init(VkDevice device, VkPhysicalDeviceMemoryProperties const& memory_properties,
+        VkDeviceSize buffer_image_granularity);
+    void destroy();
+
+    bool find_memory_type(uint32_t type_bits, VkFlags requirements_mask, uint32_t* type_index) const;
+    Status allocate(uint32_t memory_type, VkMemoryRequirements const& mem_reqs, Resource_Kind kind,
+        Alloc_Strategy strategy, void* owner, Device_Allocation* alloc);
+    void free(Device_Allocation* alloc);
+
+    Status defragment(Defrag_Move_Fn move_fn, void* user_data);
+    void release_empty_blocks();
+
+    Device_Allocator_Stats get_stats() const;
+    void log_stats(char const* label) const;
+
+    VkDeviceSize block_size_for_type(uint32_t memory_type) const;
+    Status create_block(uint32_t memory_type, VkDeviceSize size, Alloc_Strategy strategy, bool dedicated,
+        uint32_t* block_index);
+    void destroy_block(uint32_t block_index);
+    bool try_allocate_from_block(uint32_t block_index, VkMemoryRequirements const& mem_reqs,
+        Resource_Kind kind, void* owner, Device_Allocation* alloc);
+};
@@ -0,0 +1,136 @@
+#include "frame_pacer.h"
+
+#include "platform.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+void Frame_Time_Histogram::reset() {
+    for (uint32_t& count : counts) {
+        count = 0;
+    }
+    num_samples = 0;
+    sum_ms = 0.0;
+    max_sample_ms = 0.0;
+}
+
+void Frame_Time_Histogram::add(double frame_ms) {
+    const double clamped_ms = std::min(std::max(frame_ms, 0.0), max_ms);
+    const uint32_t bucket = std::min(static_cast<uint32_t>(clamped_ms / bucket_ms), num_buckets - 1);
+    ++counts[bucket];
+    ++num_samples;
+    sum_ms += frame_ms;
+    max_sample_ms = std::max(max_sample_ms, frame_ms);
+}
+
+/**
+ * \param fraction In [0, 1], 0.99 for the 99th percentile.
+ * \return Frame time not exceeded by that fraction of frames, 0 without samples.
+ */
+double Frame_Time_Histogram::percentile(double fraction) const {
+    assert(fraction >= 0.0 && fraction <= 1.0);
+    if (num_samples == 0) {
+        return 0.0;
+    }
+
+    // Nearest rank
+    const uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * num_samples)), 1);
+    uint64_t num_below = 0;
+    for (uint32_t i = 0; i < num_buckets; ++i) {
+        num_below += counts[i];
+        if (num_below >= rank) {
+            return i == num_buckets - 1 ? max_sample_ms : (i + 1) * bucket_ms;
+        }
+    }
+    return max_sample_ms;
+}
+
+/**
+ * Sleep then spin until deadline_ms on the get_perf_counter_ms() clock.
+ *
+ * \param spin_ms Time before the deadline spent spinning, at least the sleep granularity
+ *  for the deadline to be hit.
+ */
+void wait_until(double deadline_ms, double spin_ms) {
+    for (;;) {
+        const double remaining_ms = deadline_ms - get_perf_counter_ms();
+        if (remaining_ms <= 0.0) {
+            return;
+        }
+        if (remaining_ms > spin_ms) {
+            sleep(remaining_ms - spin_ms);
+        }
+        else {
+            spin_pause();
+        }
+    }
+}
+
+/**
+ * \param target_fps Frames per second, 0 for uncapped.
+ */
+void Frame_Pacer::init(double target_fps) {
+    spin_ms = get_sleep_granularity_ms();
+    frame_start_ms = get_perf_counter_ms();
+    set_target_fps(target_fps);
+    reset_stats();
+}
+
+/**
+ * Takes effect from the next frame on.
+ */
+void Frame_Pacer::set_target_fps(double target_fps) {
+    assert(target_fps >= 0.0);
+    period_ms = target_fps > 0.0 ? 1000.0 / target_fps : 0.0;
+    next_deadline_ms = frame_start_ms + period_ms;
+}
+
+/**
+ * Wait for the current frame's deadline and start the next frame.
+ */
+void Frame_Pacer::end_frame() {
+    double now_ms = get_perf_counter_ms();
+    if (period_ms > 0.0) {
+        if (now_ms > next_deadline_ms) {
+            ++num_missed;
+            if (now_ms - next_deadline_ms > period_ms) {
+                next_deadline_ms = now_ms;
+            }
+        }
+        else {
+            wait_until(next_deadline_ms, spin_ms);
+            now_ms = get_perf_counter_ms();
+        }
+        next_deadline_ms += period_ms;
+    }
+
+    histogram.add(now_ms - frame_start_ms);
+    frame_start_ms = now_ms;
+}
+
+/**
+ * NOTE: Not synchronized with end_frame(), call from the thread being paced.
+ */
+void Frame_Pacer::get_stats(Frame_Time_Stats* stats) const {
+    assert(stats);
+    stats->num_frames = histogram.num_samples;
+    stats->num_missed = num_missed;
+    stats->mean_ms = histogram.num_samples > 0 ? histogram.sum_ms / histogram.num_samples : 0.0;
+    stats->p50_ms = histogram.percentile(0.50);
+    stats->p95_ms = histogram.percentile(0.95);
+    stats->p99_ms = histogram.percentile(0.99);
+    stats->max_ms = histogram.max_sample_ms;
+}
+
+void Frame_Pacer::reset_stats() {
+    num_missed = 0;
+    histogram.reset();
+}
+
+void Frame_Pacer::log_stats(char const* name) const {
+    Frame_Time_Stats stats;
+    get_stats(&stats);
+    log_info("%s: %llu frames, %llu missed, mean %.2f ms, p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.2f ms\n",
+        name, static_cast<unsigned long long>(stats.num_frames), static_cast<unsigned long long>(stats.num_missed),
+        stats.mean_ms, stats.p50_ms, stats.p95_ms, stats.p99_ms, stats.max_ms);
+}
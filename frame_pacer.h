@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Frame time distribution in fixed 0.1 ms buckets up to max_ms, longer frames share the last
+ * bucket. Percentiles are the upper edge of their bucket.
+ */
+struct Frame_Time_Histogram {
+    static constexpr double bucket_ms = 0.1;
+    static constexpr double max_ms = 100.0;
+    static constexpr uint32_t num_buckets = static_cast<uint32_t>(max_ms / bucket_ms) + 1;
+
+    uint32_t counts[num_buckets];
+    uint64_t num_samples;
+    double sum_ms;
+    double max_sample_ms;
+
+    void reset();
+    void add(double frame_ms);
+    double percentile(double fraction) const;
+};
+
+struct Frame_Time_Stats {
+    uint64_t num_frames;
+    uint64_t num_missed; //!< Frames that ended after their deadline
+    double mean_ms;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+};
+
+/**
+ * Holds a loop to a target rate by waiting for absolute deadlines, deadline n is
+ * start + n * period, so rounding errors and late wakeups don't accumulate into drift.
+ *
+ * Waits sleep until get_sleep_granularity_ms() before the deadline and spin for the rest.
+ * A frame late by more than a whole period restarts the deadlines from now rather than
+ * running frames back to back to catch up. With a target of 0 frames are not paced, only
+ * measured.
+ */
+struct Frame_Pacer {
+    double period_ms;          //!< 0 when uncapped
+    double spin_ms;            //!< Stretch before a deadline spun instead of slept
+    double next_deadline_ms;
+    double frame_start_ms;     //!< When the current frame began, the last end_frame()
+
+    uint64_t num_missed;
+    Frame_Time_Histogram histogram;
+
+    void init(double target_fps);
+    void set_target_fps(double target_fps);
+    void end_frame();
+
+    void get_stats(Frame_Time_Stats* stats) const;
+    void reset_stats();
+    void log_stats(char const* name) const;
+};
+
+void wait_until(double deadline_ms, double spin_ms);
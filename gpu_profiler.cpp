@@ -0,0 +1,253 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+/**
+ * \param timestamp_period VkPhysicalDeviceLimits::timestampPeriod.
+ * \param timestamp_valid_bits VkQueueFamilyProperties::timestampValidBits of the queue the
+ *  scopes are submitted to, 0 disables the profiler.
+ * \param num_frames Frames in flight, one query pool each.
+ * \param log_interval_ms Time between rolling log lines, 0 to never log.
+ */
+Status Gpu_Profiler::init(VkDevice device, float timestamp_period, uint32_t timestamp_valid_bits,
+    uint32_t num_frames, double log_interval_ms)
+{
+    assert(num_frames > 0);
+    this->device = device;
+    this->log_interval_ms = log_interval_ms;
+    timestamp_period_ns = timestamp_period;
+    timestamp_mask = timestamp_valid_bits >= 64 ? UINT64_MAX : (uint64_t(1) << timestamp_valid_bits) - 1;
+    current_frame = 0;
+    depth = 0;
+    num_collected = 0;
+    num_dropped = 0;
+    last_log_ms = get_perf_counter_ms();
+    log_stats.clear();
+
+    enabled = timestamp_valid_bits > 0;
+    if (!enabled) {
+        log_info("GPU profiler disabled, the queue has no timestamp support\n");
+        return STATUS_OK;
+    }
+
+    frames.resize(num_frames);
+    for (Frame& frame : frames) {
+        VkQueryPoolCreateInfo pool_ci = {};
+        pool_ci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        pool_ci.pNext = nullptr;
+        pool_ci.flags = 0;
+        pool_ci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        pool_ci.queryCount = max_queries;
+        pool_ci.pipelineStatistics = 0;
+        VK_CHECK(vkCreateQueryPool(device, &pool_ci, nullptr, &frame.pool));
+
+        frame.frame_number = 0;
+        frame.scopes.reserve(Gpu_Frame_Times::max_scopes);
+        frame.num_queries = 0;
+        frame.recorded = false;
+    }
+
+    return STATUS_OK;
+}
+
+void Gpu_Profiler::destroy() {
+    for (Frame& frame : frames) {
+        vkDestroyQueryPool(device, frame.pool, nullptr);
+    }
+    frames.clear();
+    enabled = false;
+}
+
+/**
+ * Start recording a frame's scopes into a frame slot's query pool.
+ *
+ * \param cmd_buf Submitted before every other buffer holding the frame's scopes, the queries
+ *  are reset in it. Must be outside a render pass.
+ * \param frame_index Frame slot, its previous results must have been collected.
+ */
+void Gpu_Profiler::begin_frame(VkCommandBuffer cmd_buf, uint32_t frame_index, uint64_t frame_number) {
+    if (!enabled) {
+        return;
+    }
+    assert(frame_index < frames.size());
+    assert(depth == 0);
+
+    current_frame = frame_index;
+    Frame& frame = frames[frame_index];
+    frame.frame_number = frame_number;
+    frame.scopes.clear();
+    frame.num_queries = 0;
+    frame.recorded = true;
+    vkCmdResetQueryPool(cmd_buf, frame.pool, 0, max_queries);
+}
+
+/**
+ * \return Pass to end_scope(), no_scope if the profiler is disabled or the frame is out of
+ *  scopes.
+ */
+uint32_t Gpu_Profiler::begin_scope(VkCommandBuffer cmd_buf, char const* name) {
+    if (!enabled) {
+        return no_scope;
+    }
+
+    Frame& frame = frames[current_frame];
+    if (frame.scopes.size() >= Gpu_Frame_Times::max_scopes) {
+        return no_scope;
+    }
+
+    Pending_Scope scope;
+    scope.name = name;
+    scope.depth = depth++;
+    scope.begin_query = frame.num_queries++;
+    scope.end_query = no_scope;
+    frame.scopes.push_back(scope);
+
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.pool, scope.begin_query);
+    return static_cast<uint32_t>(frame.scopes.size() - 1);
+}
+
+/**
+ * \param cmd_buf May differ from the one the scope began in, as long as it is submitted after it.
+ */
+void Gpu_Profiler::end_scope(VkCommandBuffer cmd_buf, uint32_t scope) {
+    if (scope == no_scope) {
+        return;
+    }
+
+    Frame& frame = frames[current_frame];
+    assert(scope < frame.scopes.size());
+    assert(depth > 0);
+    --depth;
+
+    Pending_Scope& pending = frame.scopes[scope];
+    pending.end_query = frame.num_queries++;
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.pool, pending.end_query);
+}
+
+/**
+ * Read a frame slot's results into the history. Call once its submission has completed, the
+ * results are then available and nothing waits. A frame whose results are not is dropped.
+ */
+void Gpu_Profiler::collect(uint32_t frame_index) {
+    if (!enabled) {
+        return;
+    }
+    assert(frame_index < frames.size());
+
+    Frame& frame = frames[frame_index];
+    if (!frame.recorded || frame.num_queries == 0) {
+        return;
+    }
+    frame.recorded = false;
+
+    uint64_t timestamps[max_queries];
+    const VkResult res = vkGetQueryPoolResults(device, frame.pool, 0, frame.num_queries, sizeof(timestamps),
+        timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS) {
+        // VK_NOT_READY, waiting would stall the frame this is called from
+        ++num_dropped;
+        return;
+    }
+
+    Gpu_Frame_Times& times = history[num_collected % history_size];
+    times.frame_number = frame.frame_number;
+    times.num_scopes = 0;
+
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    const double ticks_to_ms = timestamp_period_ns / 1000000.0;
+    for (Pending_Scope const& scope : frame.scopes) {
+        if (scope.end_query == no_scope) {
+            continue;
+        }
+
+        const uint64_t begin = timestamps[scope.begin_query] & timestamp_mask;
+        const uint64_t end = timestamps[scope.end_query] & timestamp_mask;
+        first = std::min(first, begin);
+        last = std::max(last, end);
+
+        Gpu_Scope_Time& time = times.scopes[times.num_scopes++];
+        time.name = scope.name;
+        time.depth = scope.depth;
+        time.ms = static_cast<double>((end - begin) & timestamp_mask) * ticks_to_ms;
+
+        auto stats = std::find_if(log_stats.begin(), log_stats.end(),
+            [&](Gpu_Scope_Stats const& s) { return strcmp(s.name, scope.name) == 0; });
+        if (stats == log_stats.end()) {
+            log_stats.push_back(Gpu_Scope_Stats{ scope.name, 0.0, 0.0, 0 });
+            stats = log_stats.end() - 1;
+        }
+        stats->total_ms += time.ms;
+        stats->max_ms = std::max(stats->max_ms, time.ms);
+        ++stats->count;
+    }
+    times.frame_ms = last > first ? static_cast<double>((last - first) & timestamp_mask) * ticks_to_ms : 0.0;
+    ++num_collected;
+
+    if (log_interval_ms > 0.0 && get_perf_counter_ms() - last_log_ms >= log_interval_ms) {
+        log_rolling_stats();
+    }
+}
+
+/**
+ * \return The most recently collected frame, null if there is none yet.
+ */
+Gpu_Frame_Times const* Gpu_Profiler::latest() const {
+    return num_collected > 0 ? &history[(num_collected - 1) % history_size] : nullptr;
+}
+
+/**
+ * GPU time of the first scope called name in the latest collected frame.
+ */
+bool Gpu_Profiler::latest_scope_ms(char const* name, double* ms) const {
+    assert(name && ms);
+    Gpu_Frame_Times const* times = latest();
+    if (!times) {
+        return false;
+    }
+    for (uint32_t i = 0; i < times->num_scopes; ++i) {
+        if (strcmp(times->scopes[i].name, name) == 0) {
+            *ms = times->scopes[i].ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Log the mean and max of every scope since the last line, then start over.
+ */
+void Gpu_Profiler::log_rolling_stats() {
+    last_log_ms = get_perf_counter_ms();
+    if (log_stats.empty()) {
+        return;
+    }
+
+    char line[512];
+    int length = snprintf(line, sizeof(line), "GPU:");
+    for (Gpu_Scope_Stats const& stats : log_stats) {
+        if (length < 0 || static_cast<size_t>(length) >= sizeof(line)) {
+            break;
+        }
+        length += snprintf(line + length, sizeof(line) - length, " %s %.3f ms (max %.3f)", stats.name,
+            stats.total_ms / stats.count, stats.max_ms);
+    }
+    log_info("%s, %u frames dropped\n", line, num_dropped);
+    log_stats.clear();
+}
+
+Gpu_Scope::Gpu_Scope(Gpu_Profiler* profiler, VkCommandBuffer cmd_buf, char const* name)
+    : profiler(profiler), cmd_buf(cmd_buf), scope(Gpu_Profiler::no_scope)
+{
+    if (profiler) {
+        scope = profiler->begin_scope(cmd_buf, name);
+    }
+}
+
+Gpu_Scope::~Gpu_Scope() {
+    if (profiler) {
+        profiler->end_scope(cmd_buf, scope);
+    }
+}
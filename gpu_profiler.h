@@ -0,0 +1,110 @@
+#pragma once
+
+#include "status.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+struct Gpu_Scope_Time {
+    char const* name;
+    uint32_t depth;   //!< Number of scopes it is nested in
+    double ms;
+};
+
+/**
+ * GPU time of one frame's scopes.
+ */
+struct Gpu_Frame_Times {
+    static constexpr uint32_t max_scopes = 16;
+
+    uint64_t frame_number;
+    double frame_ms;                      //!< From the first timestamp to the last
+    Gpu_Scope_Time scopes[max_scopes];    //!< In the order they began
+    uint32_t num_scopes;
+};
+
+/**
+ * Running totals of a scope between two rolling log lines.
+ */
+struct Gpu_Scope_Stats {
+    char const* name;
+    double total_ms;
+    double max_ms;
+    uint32_t count;
+};
+
+/**
+ * Times command buffer regions on the GPU with timestamp queries.
+ *
+ * Each frame in flight has its own query pool. Scopes write a timestamp at the top of the
+ * pipe when they begin and at the bottom when they end. A frame's results are read once its
+ * fence has signaled, frames.size() frames later, so reading never stalls. Results go to a
+ * ring of the latest frames and to a log line every log_interval_ms.
+ *
+ * Not thread safe, scopes are recorded and results read by the thread that renders.
+ */
+struct Gpu_Profiler {
+    static constexpr uint32_t max_queries = 2 * Gpu_Frame_Times::max_scopes;
+    static constexpr uint32_t history_size = 128;
+    static constexpr uint32_t no_scope = UINT32_MAX;
+
+    struct Pending_Scope {
+        char const* name;
+        uint32_t depth;
+        uint32_t begin_query;
+        uint32_t end_query; //!< no_scope until the scope ends
+    };
+
+    struct Frame {
+        VkQueryPool pool;
+        uint64_t frame_number;
+        std::vector<Pending_Scope> scopes;
+        uint32_t num_queries;               //!< Written this frame
+        bool recorded;                      //!< Holds results not yet collected
+    };
+
+    VkDevice device;
+    bool enabled;                           //!< False if the queue can't write timestamps
+    double timestamp_period_ns;             //!< Nanoseconds per timestamp tick
+    uint64_t timestamp_mask;                //!< Valid bits of a timestamp
+    std::vector<Frame> frames;
+    uint32_t current_frame;                 //!< Slot being recorded
+    uint32_t depth;                         //!< Open scopes in the current frame
+
+    Gpu_Frame_Times history[history_size];  //!< Ring of collected frames
+    uint64_t num_collected;                 //!< Frames collected, the latest is at (num_collected - 1) % history_size
+    uint32_t num_dropped;                   //!< Frames whose results were not available
+
+    double log_interval_ms;                 //!< 0 to never log
+    double last_log_ms;
+    std::vector<Gpu_Scope_Stats> log_stats;
+
+    Status init(VkDevice device, float timestamp_period, uint32_t timestamp_valid_bits, uint32_t num_frames,
+        double log_interval_ms);
+    void destroy();
+
+    void begin_frame(VkCommandBuffer cmd_buf, uint32_t frame_index, uint64_t frame_number);
+    uint32_t begin_scope(VkCommandBuffer cmd_buf, char const* name);
+    void end_scope(VkCommandBuffer cmd_buf, uint32_t scope);
+    void collect(uint32_t frame_index);
+
+    Gpu_Frame_Times const* latest() const;
+    bool latest_scope_ms(char const* name, double* ms) const;
+    void log_rolling_stats();
+};
+
+/**
+ * Times the commands recorded during its lifetime. Does nothing if profiler is null.
+ */
+struct Gpu_Scope {
+    Gpu_Profiler* profiler;
+    VkCommandBuffer cmd_buf;
+    uint32_t scope;
+
+    Gpu_Scope(Gpu_Profiler* profiler, VkCommandBuffer cmd_buf, char const* name);
+    ~Gpu_Scope();
+
+    Gpu_Scope(Gpu_Scope const&) = delete;
+    Gpu_Scope& operator=(Gpu_Scope const&) = delete;
+};
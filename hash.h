@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+static constexpr uint64_t fnv1a_offset_basis = 14695981039346656037ull;
+
+/**
+ * FNV-1a. Pass the previous result as seed to hash several ranges as one.
+ */
+inline uint64_t hash_bytes(void const* data, size_t size, uint64_t seed = fnv1a_offset_basis) {
+    uint8_t const* bytes = static_cast<uint8_t const*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
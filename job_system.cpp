@@ -0,0 +1,304 @@
+#include "job_system.h"
+
+#include "cpu_profiler.h"
+#include <cassert>
+
+namespace {
+    // Deque owned by the current thread, if any
+    thread_local Job_System* tls_system = nullptr;
+    thread_local uint32_t tls_deque_index = 0;
+    thread_local uint32_t tls_steal_seed = 0;
+
+    // Rounds of looking for work before a worker goes to sleep
+    static constexpr uint32_t num_spins_before_sleep = 64;
+
+    Job_Deque* own_deque(Job_System* system) {
+        return tls_system == system ? &system->deques[tls_deque_index] : nullptr;
+    }
+
+    uint32_t next_random(uint32_t* state) {
+        // xorshift32, only spreads thieves over victims
+        uint32_t x = *state ? *state : 0x9e3779b9u;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *state = x;
+        return x;
+    }
+}
+
+void Job_Deque::init() {
+    top.store(0, std::memory_order_relaxed);
+    bottom.store(0, std::memory_order_relaxed);
+}
+
+bool Job_Deque::push(Job* job) {
+    const int64_t b = bottom.load(std::memory_order_relaxed);
+    const int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= static_cast<int64_t>(capacity)) {
+        return false;
+    }
+
+    // Release publishes the job to thieves acquiring bottom
+    jobs[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+Job* Job_Deque::pop() {
+    const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        // Empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Job* job = jobs[b & (capacity - 1)].load(std::memory_order_relaxed);
+    if (t == b) {
+        // Last job, race thieves for it
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            job = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job* Job_Deque::steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+        return nullptr;
+    }
+
+    Job* job = jobs[t & (capacity - 1)].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        // Lost to the owner or another thief
+        return nullptr;
+    }
+    return job;
+}
+
+bool Job_Deque::empty() const {
+    return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+}
+
+/**
+ * \param num_workers Threads started in addition to the calling thread, may be 0 in which case
+ *  jobs only run inside wait().
+ */
+void Job_System::init(uint32_t num_workers) {
+    num_injected.store(0);
+    num_sleeping.store(0);
+    stopping.store(false);
+
+    for (uint32_t i = 0; i < num_workers + 1; ++i) {
+        deques.emplace_back();
+        deques.back().init();
+    }
+
+    tls_system = this;
+    tls_deque_index = 0;
+    tls_steal_seed = 1;
+
+    workers.reserve(num_workers);
+    for (uint32_t i = 0; i < num_workers; ++i) {
+        workers.emplace_back(&Job_System::worker_loop, this, i + 1);
+    }
+}
+
+/**
+ * Join the workers. Every counter must have been waited on.
+ */
+void Job_System::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping.store(true);
+    }
+    wake_cv.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+
+    for (Job_Deque const& deque : deques) {
+        assert(deque.empty());
+        (void)deque;
+    }
+    deques.clear();
+    assert(injected.empty());
+
+    if (tls_system == this) {
+        tls_system = nullptr;
+    }
+}
+
+/**
+ * Threads running jobs, the workers and the thread that called init().
+ */
+uint32_t Job_System::num_threads() const {
+    return static_cast<uint32_t>(workers.size()) + 1;
+}
+
+/**
+ * Queue jobs to run in any order on any thread.
+ *
+ * \param jobs Must stay alive until counter has been waited on.
+ * \param counter Incremented by count, decremented as each job finishes. Several batches may
+ *  share a counter.
+ */
+void Job_System::run(Job* jobs, uint32_t count, Job_Counter* counter) {
+    assert(jobs && counter);
+    counter->pending.fetch_add(count, std::memory_order_relaxed);
+
+    Job_Deque* deque = own_deque(this);
+    uint32_t num_queued = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        jobs[i].counter = counter;
+
+        if (deque) {
+            if (!deque->push(&jobs[i])) {
+                // Full, the deque only drains if this thread keeps going
+                execute(&jobs[i]);
+                continue;
+            }
+        }
+        else {
+            std::lock_guard<std::mutex> lock(injected_mutex);
+            injected.push_back(&jobs[i]);
+            num_injected.fetch_add(1, std::memory_order_relaxed);
+        }
+        ++num_queued;
+    }
+
+    // Pairs with the fence in worker_loop(), either the sleeper sees the jobs or the
+    // count of sleepers is seen here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake_workers(num_queued);
+}
+
+/**
+ * Run jobs until counter has dropped to zero. Jobs finished on other threads are visible once
+ * this returns.
+ */
+void Job_System::wait(Job_Counter const* counter) {
+    assert(counter);
+    while (counter->pending.load(std::memory_order_acquire) != 0) {
+        if (!run_one()) {
+            // The remaining jobs are running elsewhere
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+ * Run one pending job on the calling thread.
+ *
+ * \return false if there was none.
+ */
+bool Job_System::run_one() {
+    Job* job = find_job();
+    if (!job) {
+        return false;
+    }
+    execute(job);
+    return true;
+}
+
+/**
+ * Own deque first, newest job first since its data is likely still in cache, then the shared
+ * queue, then steal the oldest job of another thread.
+ */
+Job* Job_System::find_job() {
+    Job_Deque* deque = own_deque(this);
+    if (deque) {
+        if (Job* job = deque->pop()) {
+            return job;
+        }
+    }
+
+    if (num_injected.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(injected_mutex);
+        if (!injected.empty()) {
+            Job* job = injected.front();
+            injected.pop_front();
+            num_injected.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    const uint32_t num_deques = static_cast<uint32_t>(deques.size());
+    const uint32_t first_victim = next_random(&tls_steal_seed) % num_deques;
+    for (uint32_t i = 0; i < num_deques; ++i) {
+        Job_Deque& victim = deques[(first_victim + i) % num_deques];
+        if (&victim == deque) {
+            continue;
+        }
+        if (Job* job = victim.steal()) {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void Job_System::execute(Job* job) {
+    job->function(job->data);
+    // Last access, the waiter may free the job and its counter once the count drops
+    job->counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void Job_System::wake_workers(uint32_t count) {
+    if (count == 0 || num_sleeping.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    // Taking the lock orders the notify after a sleeper's last look for work
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    if (count == 1) {
+        wake_cv.notify_one();
+    }
+    else {
+        wake_cv.notify_all();
+    }
+}
+
+void Job_System::worker_loop(uint32_t deque_index) {
+    PROFILE_THREAD_NAME("job worker");
+    tls_system = this;
+    tls_deque_index = deque_index;
+    tls_steal_seed = deque_index * 0x9e3779b9u;
+
+    uint32_t num_idle_spins = 0;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        if (run_one()) {
+            num_idle_spins = 0;
+            continue;
+        }
+
+        if (++num_idle_spins < num_spins_before_sleep) {
+            std::this_thread::yield();
+            continue;
+        }
+        num_idle_spins = 0;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        num_sleeping.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // A job run before the count went up would otherwise never wake this thread
+        bool has_work = num_injected.load(std::memory_order_relaxed) > 0;
+        for (uint32_t i = 0; i < deques.size() && !has_work; ++i) {
+            has_work = !deques[i].empty();
+        }
+        if (!has_work && !stopping.load(std::memory_order_relaxed)) {
+            wake_cv.wait(lock);
+        }
+        num_sleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Counts the unfinished jobs of a batch. Zero when every job run with it has finished.
+ */
+struct Job_Counter {
+    std::atomic<uint32_t> pending;
+};
+
+/**
+ * A unit of work for Job_System. The job only points at its data, both must stay alive until
+ * the job's counter has been waited on.
+ */
+struct Job {
+    void (*function)(void* data);
+    void* data;
+    Job_Counter* counter; //!< Set by Job_System::run()
+};
+
+/**
+ * Lock-free work-stealing deque of jobs (Chase-Lev). The owning thread pushes and pops at the
+ * bottom, any thread steals from the top.
+ */
+struct Job_Deque {
+    static constexpr uint32_t capacity = 4096; //!< Power of two
+
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<Job*> jobs[capacity];
+
+    void init();
+    bool push(Job* job); //!< Owner only, false if full
+    Job* pop();          //!< Owner only, most recently pushed first
+    Job* steal();        //!< Any thread, least recently pushed first
+    bool empty() const;
+};
+
+/**
+ * Work-stealing scheduler for short CPU jobs (culling, transform updates, command recording,
+ * decoding).
+ *
+ * Every worker and the thread that called init() own a deque. Jobs run from those threads go
+ * on their own deque, idle workers steal from the others. Jobs run from any other thread go on
+ * a shared queue. wait() runs pending jobs until the counter drops to zero, so jobs can wait on
+ * the jobs they spawned without blocking a worker.
+ *
+ * Work that blocks for long (pipeline compilation, file IO) belongs on a Thread_Pool, it would
+ * stall every job queued behind it.
+ */
+struct Job_System {
+    std::vector<std::thread> workers;
+    std::deque<Job_Deque> deques;          //!< deques[0] is owned by the thread that called init()
+
+    std::mutex injected_mutex;
+    std::deque<Job*> injected;             //!< Jobs run from threads without a deque
+    std::atomic<uint32_t> num_injected;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_cv;       //!< Signaled when a job is run or the system stops
+    std::atomic<uint32_t> num_sleeping;
+    std::atomic<bool> stopping;
+
+    void init(uint32_t num_workers);
+    void destroy();
+
+    uint32_t num_threads() const;
+
+    void run(Job* jobs, uint32_t count, Job_Counter* counter);
+    void wait(Job_Counter const* counter);
+    bool run_one();
+
+    Job* find_job();
+    void execute(Job* job);
+    void wake_workers(uint32_t count);
+    void worker_loop(uint32_t deque_index);
+};
@@ -1,22 +1,164 @@
+#include "bench.h"
+#include "cpu_profiler.h"
+#include "frame_pacer.h"
 #include "platform.h"
+#include "render_thread.h"
 #include "renderer.h"
 #include "status.h"
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include <vulkan/vulkan.h>
 
 static bool g_running = true;
 
+// Latest client area size, handed to the render thread by the main loop
+static bool g_resize_pending = false;
+static uint32_t g_resize_width = 0;
+static uint32_t g_resize_height = 0;
+
+// Set by F12 in the window, or SIGUSR1 on Linux, to write the CPU trace while running
+static bool g_trace_dump_pending = false;
+
 void window_destroy_callback() {
     g_running = false;
 }
 
-int main()
+void window_resize_callback(int width, int height) {
+    g_resize_pending = true;
+    g_resize_width = static_cast<uint32_t>(width);
+    g_resize_height = static_cast<uint32_t>(height);
+}
+
+#ifdef _WIN32
+void window_key_callback(uint32_t virtual_key) {
+    if (virtual_key == VK_F12) {
+        g_trace_dump_pending = true;
+    }
+}
+#endif
+
+/**
+ * \param path Null if no trace was asked for.
+ */
+void write_cpu_trace(char const* path) {
+    if (path) {
+        cpu_profiler_dump(path);
+    }
+}
+
+/**
+ * Write the CPU trace if a dump was asked for since the last call. Every dump goes to the
+ * same file, the latest one wins.
+ *
+ * \param path Null if no trace was asked for, cpu_trace.json is written then.
+ */
+void poll_cpu_trace_dump(char const* path) {
+#ifndef _WIN32
+    if (take_user_signal()) {
+        g_trace_dump_pending = true;
+    }
+#endif
+    if (g_trace_dump_pending) {
+        g_trace_dump_pending = false;
+        cpu_profiler_dump(path ? path : "cpu_trace.json");
+    }
+}
+
+int main(int argc, char** argv)
 {
+    // --bench-draw-paths: compare the per-draw transform paths and exit
+    // --bench-jobs: measure job system overhead and scaling and exit
+    // --fps <n>: cap the render rate, 0 (default) renders as fast as presentation allows
+    // --present <vsync|adaptive|low-latency|uncapped>: present mode profile, vsync by default
+    // --headless: render offscreen without a window, always on where there is no window system
+    // --frames <n>: frames rendered when headless before reporting throughput and exiting
+    // --bench: measure the scene matrix headless and exit, with 2 if slower than the baseline.
+    //   The matrix, frame counts, reports and baseline are set with --bench-*, see
+    //   parse_bench_option()
+    // --trace <path>: write the CPU zones as a Chrome trace (chrome://tracing, Perfetto) on exit.
+    //   F12 in the window, or SIGUSR1 on Linux, writes it while running, to cpu_trace.json
+    //   without --trace
+    bool bench_draw_paths_only = false;
+    bool bench_jobs_only = false;
+    bool bench_scenes_only = false;
+    Bench_Config bench_config;
+    bench_config.init(std::max(std::thread::hardware_concurrency(), 1u));
+    double render_fps = 0.0;
+    Present_Profile present_profile = Present_Profile::Vsync;
+    bool headless = false;
+    uint32_t headless_num_frames = 1000;
+    char const* trace_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bench-draw-paths") == 0) {
+            bench_draw_paths_only = true;
+        }
+        else if (strcmp(argv[i], "--bench-jobs") == 0) {
+            bench_jobs_only = true;
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            render_fps = std::max(atof(argv[++i]), 0.0);
+        }
+        else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc) {
+            if (!parse_present_profile(argv[++i], &present_profile)) {
+                log_error("Unknown present profile %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            headless_num_frames = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bench") == 0) {
+            bench_scenes_only = true;
+        }
+        else if (strncmp(argv[i], "--bench-", strlen("--bench-")) == 0 && i + 1 < argc) {
+            if (!parse_bench_option(argv[i], argv[i + 1], &bench_config)) {
+                log_error("Invalid benchmark option %s %s\n", argv[i], argv[i + 1]);
+                return 1;
+            }
+            ++i;
+        }
+    }
+#ifndef _WIN32
+    headless = true;
+#endif
+    if (bench_scenes_only) {
+        // Frame rates must not depend on a display
+        headless = true;
+    }
+    constexpr uint32_t bench_num_draws = 16384;
+    constexpr uint32_t bench_num_frames = 256;
+
     init_platform();
+    PROFILE_THREAD_NAME("main");
+#ifndef _WIN32
+    watch_user_signal();
+#endif
+
+    if (bench_jobs_only) {
+        bench_job_system(std::max(std::thread::hardware_concurrency(), 1u));
+        return 0;
+    }
+
+    const double startup_start_ms = get_perf_counter_ms();
+
+    // The main thread runs jobs too while it waits on them
+    const uint32_t num_job_workers = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    Job_System jobs;
+    jobs.init(num_job_workers);
 
     Vulkan_Instance_Info vulkan = {};
+    vulkan.headless = headless;
 
     constexpr char const* app_name = "Vulkan Practice";
     constexpr uint32_t app_ver = 1;
@@ -30,14 +172,16 @@ int main()
 
     // Want the Window System Integration (WSI) extensions.
     // - requires general surface extension
-    vulkan.instance_extension_names.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+    // Headless needs none, so it runs on implementations without any (e.g. lavapipe on a
+    // machine without a display).
+    if (!headless) {
+        vulkan.instance_extension_names.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #ifdef _WIN32
-    vulkan.instance_extension_names.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
-#else
-#   error Unsupported platform
+        vulkan.instance_extension_names.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #endif
 
-    vulkan.device_extension_names.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        vulkan.device_extension_names.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 
     uint32_t use_api_version = VK_API_VERSION_1_0;
 
@@ -71,50 +215,174 @@ int main()
 
     constexpr int window_width = 640;
     constexpr int window_height = 480;
-    Rect window_rect = {};
-    window_rect.x = CW_USEDEFAULT;
-    window_rect.y = CW_USEDEFAULT;
-    window_rect.width = window_width;
-    window_rect.height = window_height;
-    Window window = create_window(window_rect, window_destroy_callback);
-    process_window_messages(window);
-
-    STATUS_CHECK(vulkan.create_surface(window));
+    Window window = {};
+#ifdef _WIN32
+    if (!headless) {
+        Rect window_rect = {};
+        window_rect.x = CW_USEDEFAULT;
+        window_rect.y = CW_USEDEFAULT;
+        window_rect.width = window_width;
+        window_rect.height = window_height;
+        window = create_window(window_rect, window_destroy_callback, window_resize_callback, window_key_callback);
+        process_window_messages(window);
+
+        STATUS_CHECK(vulkan.create_surface(window));
+    }
+#endif
     STATUS_CHECK(vulkan.find_graphics_and_present_queue());
     STATUS_CHECK(vulkan.create_logical_device());
     STATUS_CHECK(vulkan.setup_device_queue());
     STATUS_CHECK(vulkan.create_command_pool());
-    STATUS_CHECK(vulkan.create_command_buffer());
+    STATUS_CHECK(vulkan.setup_pipeline_cache("pipeline_cache.bin"));
+
+    // Leave a core for the render thread
+    const uint32_t num_compile_threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    STATUS_CHECK(vulkan.setup_pipeline_manager(num_compile_threads));
+
+    // Number of frames the CPU may record while the GPU is still rendering previous ones
+    constexpr uint32_t frames_in_flight = 2;
+    STATUS_CHECK(vulkan.setup_frames_in_flight(frames_in_flight));
+
+    // Per-frame recordings split their draws across the job threads, pre-recorded buffers stay serial
+    STATUS_CHECK(vulkan.setup_parallel_recording(&jobs));
 
-    constexpr uint32_t desired_buf_strategy = 2;
-    STATUS_CHECK(vulkan.setup_swapchain(desired_buf_strategy, window_width, window_height));
+    // Timestamps around each frame's GPU work, read back once the frame slot comes round again
+    STATUS_CHECK(vulkan.setup_gpu_profiler());
+
+    // Static data is staged through host visible memory into DEVICE_LOCAL memory
+    constexpr VkDeviceSize staging_size = 8 * 1024 * 1024;
+    STATUS_CHECK(vulkan.setup_upload_service(staging_size));
+
+    // Image count follows the present mode and the frames in flight
+    if (headless) {
+        STATUS_CHECK(vulkan.setup_offscreen_target(window_width, window_height));
+    }
+    else {
+        STATUS_CHECK(vulkan.setup_swapchain(present_profile, window_width, window_height));
+    }
 	STATUS_CHECK(vulkan.setup_depth_buffer());
     STATUS_CHECK(vulkan.setup_model_view_projection());
-    STATUS_CHECK(vulkan.setup_uniform_buffer());
+    uint32_t max_draws_per_frame = bench_draw_paths_only ? bench_num_draws : 1024;
+    if (bench_scenes_only) {
+        max_draws_per_frame = std::max(max_draws_per_frame, bench_config.max_objects());
+    }
+    STATUS_CHECK(vulkan.setup_uniform_buffer(max_draws_per_frame));
     STATUS_CHECK(vulkan.setup_pipeline());
     STATUS_CHECK(vulkan.setup_render_pass());
 	STATUS_CHECK(vulkan.setup_shaders());
 	STATUS_CHECK(vulkan.setup_framebuffer());
 	STATUS_CHECK(vulkan.setup_vertex_buffer());
+
+    const uint32_t max_instances = std::max(128u * 1024u, bench_scenes_only ? bench_config.max_objects() : 0u);
+    STATUS_CHECK(vulkan.setup_instance_buffer(max_instances));
     STATUS_CHECK(vulkan.setup_graphics_pipeline());
 
-    const double desired_fps = 60;
-    const double ms_per_frame = 1000.0 / desired_fps;
-        
-    while (g_running) {
-        const double time_start_ms = get_perf_counter_ms();
+    // Variants still compiling are not included, the cache stats are complete on shutdown
+    log_info("Startup: %.2f ms\n", get_perf_counter_ms() - startup_start_ms);
+
+    // Nothing in the scene changes between frames, record the command buffers once and resubmit them.
+    vulkan.prerecord_cmd_bufs = true;
+
+    if (bench_draw_paths_only) {
+        STATUS_CHECK(bench_draw_paths(vulkan, window, bench_num_draws, bench_num_frames));
+        vulkan.cleanup();
+        jobs.destroy();
+        write_cpu_trace(trace_path);
+        return 0;
+    }
+
+    if (bench_scenes_only) {
+        std::vector<Bench_Result> results;
+        STATUS_CHECK(bench_scenes(vulkan, bench_config, &results));
+        vulkan.cleanup();
+        jobs.destroy();
+        write_cpu_trace(trace_path);
+
+        if (!bench_config.json_path.empty() && !write_bench_json(bench_config.json_path.c_str(), results)) {
+            return 1;
+        }
+        if (!bench_config.csv_path.empty() && !write_bench_csv(bench_config.csv_path.c_str(), results)) {
+            return 1;
+        }
+        if (!bench_config.baseline_path.empty()) {
+            std::vector<Bench_Result> baseline;
+            if (!read_bench_json(bench_config.baseline_path.c_str(), &baseline)) {
+                return 1;
+            }
+            if (compare_bench_results(results, baseline, bench_config.regression_threshold) > 0) {
+                return 2;
+            }
+        }
+        return 0;
+    }
+
+    if (headless) {
+        // Frames go back to back from this thread, capped by --fps if given
+        Frame_Pacer headless_pacer;
+        headless_pacer.init(render_fps);
+        const double frames_start_ms = get_perf_counter_ms();
+        for (uint32_t i = 0; i < headless_num_frames; ++i) {
+            STATUS_CHECK(vulkan.render());
+            poll_cpu_trace_dump(trace_path);
+            headless_pacer.end_frame();
+        }
+        VK_CHECK(vkDeviceWaitIdle(vulkan.logical.device));
+        const double frames_ms = get_perf_counter_ms() - frames_start_ms;
 
+        log_info("Headless: %u frames in %.1f ms, %.1f fps\n", headless_num_frames, frames_ms,
+            1000.0 * headless_num_frames / frames_ms);
+        headless_pacer.log_stats("Headless");
+        vulkan.cleanup();
+        jobs.destroy();
+        write_cpu_trace(trace_path);
+        return 0;
+    }
+
+    // The renderer belongs to the render thread until it is stopped. The simulation ticks on
+    // its own copy of the scene and publishes it whenever a tick changes it.
+    Render_Thread render_thread;
+    render_thread.init();
+    Scene_Snapshot simulation_scene;
+    copy_scene(vulkan, &simulation_scene);
+    render_thread.begin_scene() = simulation_scene;
+    render_thread.publish_scene();
+    render_thread.start(&vulkan, render_fps);
+
+    // Simulation rate, independent of the render rate
+    constexpr double simulation_fps = 60.0;
+    Frame_Pacer simulation_pacer;
+    simulation_pacer.init(simulation_fps);
+
+    while (g_running && render_thread.running.load(std::memory_order_acquire)) {
         process_window_messages(window);
-        STATUS_CHECK(vulkan.render());
 
-        const double time_end_ms = get_perf_counter_ms();
-        const double elapsed_frame_delta_ms = time_end_ms - time_start_ms;
-        const double remaining_frame_time_ms = ms_per_frame - elapsed_frame_delta_ms;
-        if (remaining_frame_time_ms > 0) {
-            sleep(remaining_frame_time_ms);
+        bool scene_changed = false;
+        if (g_resize_pending) {
+            // Retried next tick if the queue is full
+            const Render_Event resize = { Render_Event_Type::Resize, g_resize_width, g_resize_height };
+            g_resize_pending = !render_thread.push_event(resize);
+
+            // A minimized window keeps the last aspect ratio
+            if (g_resize_width > 0 && g_resize_height > 0) {
+                simulation_scene.projection = scene_projection(g_resize_width, g_resize_height);
+                scene_changed = true;
+            }
+        }
+        poll_cpu_trace_dump(trace_path);
+
+        // Republishing an unchanged scene would only re-record the pre-recorded command buffers
+        if (scene_changed) {
+            render_thread.begin_scene() = simulation_scene;
+            render_thread.publish_scene();
         }
+
+        simulation_pacer.end_frame();
     }
+    simulation_pacer.log_stats("Simulation");
 
+    STATUS_CHECK(render_thread.stop());
     vulkan.cleanup();
+    jobs.destroy();
+    write_cpu_trace(trace_path);
     return 0;
 }
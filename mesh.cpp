@@ -0,0 +1,306 @@
+#include "mesh.h"
+
+#include "hash.h"
+#include "platform.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    // Vertex scoring from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    namespace Forsyth {
+        constexpr uint32_t cache_size = 32;
+        constexpr float cache_decay_power = 1.5f;
+        constexpr float last_tri_score = 0.75f;
+        constexpr float valence_boost_scale = 2.0f;
+        constexpr float valence_boost_power = 0.5f;
+
+        /**
+         * \param cache_pos Position in the simulated LRU cache, -1 if not cached.
+         * \param live_tris Triangles using the vertex that have not been emitted yet.
+         */
+        float vertex_score(int32_t cache_pos, uint32_t live_tris) {
+            if (live_tris == 0) {
+                // No triangle needs the vertex anymore
+                return -1.0f;
+            }
+
+            float score = 0.0f;
+            if (cache_pos >= 0) {
+                if (cache_pos < 3) {
+                    // Used by the last triangle, fixed score so the next triangle does not
+                    // favour a particular edge of it.
+                    score = last_tri_score;
+                }
+                else {
+                    assert(cache_pos < static_cast<int32_t>(cache_size));
+                    const float scaler = 1.0f / (cache_size - 3);
+                    score = std::pow(1.0f - (cache_pos - 3) * scaler, cache_decay_power);
+                }
+            }
+
+            // Boost vertices with few triangles left so they are finished off and do not
+            // leave lone triangles behind.
+            score += valence_boost_scale * std::pow(static_cast<float>(live_tris), -valence_boost_power);
+            return score;
+        }
+    }
+}
+
+/**
+ * Remove duplicate vertices from a triangle list and index the unique ones.
+ *
+ * Vertices are compared bytewise, so padding in the vertex type must be zeroed.
+ */
+void build_indexed_mesh(void const* vertices, uint32_t vertex_count, size_t vertex_size, Mesh* mesh) {
+    assert(vertices && mesh);
+    assert(vertex_size > 0 && vertex_count % 3 == 0);
+
+    uint8_t const* src = static_cast<uint8_t const*>(vertices);
+    mesh->vertex_size = vertex_size;
+    mesh->vertex_count = 0;
+    mesh->vertices.clear();
+    mesh->vertices.reserve(vertex_count * vertex_size);
+    mesh->indices.resize(vertex_count);
+
+    // Open addressing table of unique vertex indices, kept at most half full
+    size_t table_size = 1;
+    while (table_size < vertex_count * 2) {
+        table_size *= 2;
+    }
+    constexpr uint32_t empty_slot = ~0u;
+    std::vector<uint32_t> table(table_size, empty_slot);
+
+    for (uint32_t i = 0; i < vertex_count; ++i) {
+        uint8_t const* vertex = src + i * vertex_size;
+        size_t slot = hash_bytes(vertex, vertex_size) & (table_size - 1);
+
+        for (;;) {
+            const uint32_t unique = table[slot];
+            if (unique == empty_slot) {
+                table[slot] = mesh->vertex_count;
+                mesh->vertices.insert(mesh->vertices.end(), vertex, vertex + vertex_size);
+                mesh->indices[i] = mesh->vertex_count++;
+                break;
+            }
+            if (memcmp(mesh->vertices.data() + unique * vertex_size, vertex, vertex_size) == 0) {
+                mesh->indices[i] = unique;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+    }
+}
+
+/**
+ * Reorder triangles so vertices are reused while still in the post-transform cache.
+ *
+ * Greedy: repeatedly emits the triangle whose vertices score highest, scores favour vertices
+ * recently used and vertices with few remaining triangles. Independent of the hardware cache size.
+ */
+void optimize_vertex_cache(std::vector<uint32_t>* indices, uint32_t vertex_count) {
+    assert(indices && indices->size() % 3 == 0);
+    using namespace Forsyth;
+
+    std::vector<uint32_t>& ib = *indices;
+    const uint32_t tri_count = static_cast<uint32_t>(ib.size() / 3);
+    if (tri_count == 0) {
+        return;
+    }
+
+    // Triangles using each vertex
+    std::vector<uint32_t> live_tris(vertex_count, 0);
+    for (uint32_t index : ib) {
+        assert(index < vertex_count);
+        ++live_tris[index];
+    }
+
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+    for (uint32_t v = 0; v < vertex_count; ++v) {
+        adjacency_offsets[v + 1] = adjacency_offsets[v] + live_tris[v];
+    }
+    std::vector<uint32_t> adjacency(ib.size());
+    {
+        std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (uint32_t t = 0; t < tri_count; ++t) {
+            for (uint32_t k = 0; k < 3; ++k) {
+                adjacency[fill[ib[t * 3 + k]]++] = t;
+            }
+        }
+    }
+
+    std::vector<int32_t> cache_pos(vertex_count, -1);
+    std::vector<float> vert_score(vertex_count);
+    for (uint32_t v = 0; v < vertex_count; ++v) {
+        vert_score[v] = vertex_score(-1, live_tris[v]);
+    }
+
+    std::vector<float> tri_score(tri_count);
+    std::vector<bool> tri_emitted(tri_count, false);
+    for (uint32_t t = 0; t < tri_count; ++t) {
+        tri_score[t] = vert_score[ib[t * 3]] + vert_score[ib[t * 3 + 1]] + vert_score[ib[t * 3 + 2]];
+    }
+
+    // Simulated LRU cache, room for a new triangle's vertices before the oldest are evicted
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> new_cache;
+    cache.reserve(cache_size + 3);
+    new_cache.reserve(cache_size + 3);
+
+    std::vector<uint32_t> output;
+    output.reserve(ib.size());
+
+    constexpr uint32_t no_tri = ~0u;
+    uint32_t best_tri = no_tri;
+    uint32_t scan_cursor = 0;
+
+    for (uint32_t emitted = 0; emitted < tri_count; ++emitted) {
+        if (best_tri == no_tri) {
+            // Nothing adjacent to the cache, fall back to the best remaining triangle
+            float best_score = -1.0f;
+            while (scan_cursor < tri_count && tri_emitted[scan_cursor]) {
+                ++scan_cursor;
+            }
+            for (uint32_t t = scan_cursor; t < tri_count; ++t) {
+                if (!tri_emitted[t] && tri_score[t] > best_score) {
+                    best_score = tri_score[t];
+                    best_tri = t;
+                }
+            }
+        }
+        assert(best_tri != no_tri);
+
+        const uint32_t tri_verts[3] = { ib[best_tri * 3], ib[best_tri * 3 + 1], ib[best_tri * 3 + 2] };
+        output.insert(output.end(), tri_verts, tri_verts + 3);
+        tri_emitted[best_tri] = true;
+
+        // Drop the triangle from its vertices' live lists
+        for (uint32_t v : tri_verts) {
+            uint32_t* begin = adjacency.data() + adjacency_offsets[v];
+            uint32_t* end = begin + live_tris[v];
+            uint32_t* it = std::find(begin, end, best_tri);
+            assert(it != end);
+            *it = *(end - 1);
+            --live_tris[v];
+        }
+
+        // Move the triangle's vertices to the front of the cache
+        new_cache.assign(tri_verts, tri_verts + 3);
+        for (uint32_t v : cache) {
+            if (v != tri_verts[0] && v != tri_verts[1] && v != tri_verts[2]) {
+                new_cache.push_back(v);
+            }
+        }
+        cache.swap(new_cache);
+
+        // Rescore vertices whose cache position changed, including the evicted ones
+        for (uint32_t i = 0; i < cache.size(); ++i) {
+            const uint32_t v = cache[i];
+            cache_pos[v] = i < cache_size ? static_cast<int32_t>(i) : -1;
+            vert_score[v] = vertex_score(cache_pos[v], live_tris[v]);
+        }
+
+        // Rescore the triangles touching the cache and pick the next one among them
+        best_tri = no_tri;
+        float best_score = -1.0f;
+        for (uint32_t v : cache) {
+            uint32_t const* tris = adjacency.data() + adjacency_offsets[v];
+            for (uint32_t k = 0; k < live_tris[v]; ++k) {
+                const uint32_t t = tris[k];
+                tri_score[t] = vert_score[ib[t * 3]] + vert_score[ib[t * 3 + 1]] + vert_score[ib[t * 3 + 2]];
+                if (tri_score[t] > best_score) {
+                    best_score = tri_score[t];
+                    best_tri = t;
+                }
+            }
+        }
+        if (cache.size() > cache_size) {
+            cache.resize(cache_size);
+        }
+    }
+
+    ib.swap(output);
+}
+
+/**
+ * Reorder vertices in the order the index buffer first references them, so vertex fetches walk
+ * memory linearly. Unreferenced vertices are dropped.
+ *
+ * NOTE: Run after optimize_vertex_cache(), it depends on the final triangle order.
+ */
+void optimize_vertex_fetch(Mesh* mesh) {
+    assert(mesh);
+
+    constexpr uint32_t unassigned = ~0u;
+    std::vector<uint32_t> remap(mesh->vertex_count, unassigned);
+    std::vector<uint8_t> vertices(mesh->vertices.size());
+    uint32_t next_vertex = 0;
+
+    for (uint32_t& index : mesh->indices) {
+        assert(index < mesh->vertex_count);
+        if (remap[index] == unassigned) {
+            memcpy(vertices.data() + next_vertex * mesh->vertex_size,
+                mesh->vertices.data() + index * mesh->vertex_size, mesh->vertex_size);
+            remap[index] = next_vertex++;
+        }
+        index = remap[index];
+    }
+
+    vertices.resize(next_vertex * mesh->vertex_size);
+    mesh->vertices.swap(vertices);
+    mesh->vertex_count = next_vertex;
+}
+
+/**
+ * Simulate a FIFO post-transform cache of cache_size entries.
+ */
+Vertex_Cache_Stats analyze_vertex_cache(std::vector<uint32_t> const& indices, uint32_t vertex_count,
+    uint32_t cache_size)
+{
+    assert(indices.size() % 3 == 0);
+    Vertex_Cache_Stats stats = {};
+    if (indices.empty() || vertex_count == 0) {
+        return stats;
+    }
+
+    // A vertex is cached while fewer than cache_size misses happened since its own miss
+    std::vector<uint32_t> miss_time(vertex_count, 0);
+    uint32_t time = cache_size + 1;
+    uint32_t transformed = 0;
+
+    for (uint32_t index : indices) {
+        assert(index < vertex_count);
+        if (time - miss_time[index] > cache_size) {
+            miss_time[index] = time++;
+            ++transformed;
+        }
+    }
+
+    stats.acmr = static_cast<float>(transformed) / (indices.size() / 3);
+    stats.atvr = static_cast<float>(transformed) / vertex_count;
+    return stats;
+}
+
+/**
+ * Index, cache optimize and fetch optimize a non-indexed triangle list.
+ */
+void optimize_mesh(void const* vertices, uint32_t vertex_count, size_t vertex_size, Mesh* mesh) {
+    // Typical size of a post-transform FIFO
+    constexpr uint32_t analyze_cache_size = 16;
+
+    // As submitted: every triangle corner is transformed
+    std::vector<uint32_t> unindexed(vertex_count);
+    for (uint32_t i = 0; i < vertex_count; ++i) {
+        unindexed[i] = i;
+    }
+    const Vertex_Cache_Stats before = analyze_vertex_cache(unindexed, vertex_count, analyze_cache_size);
+
+    build_indexed_mesh(vertices, vertex_count, vertex_size, mesh);
+    optimize_vertex_cache(&mesh->indices, mesh->vertex_count);
+    optimize_vertex_fetch(mesh);
+
+    const Vertex_Cache_Stats after = analyze_vertex_cache(mesh->indices, mesh->vertex_count, analyze_cache_size);
+    log_info("Mesh: %u -> %u vertices, %zu indices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+        vertex_count, mesh->vertex_count, mesh->indices.size(), before.acmr, after.acmr, before.atvr, after.atvr);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Indexed triangle list with vertices stored as raw bytes so any vertex layout can be processed.
+ */
+struct Mesh {
+    std::vector<uint8_t> vertices;
+    size_t vertex_size;
+    uint32_t vertex_count;
+    std::vector<uint32_t> indices;
+};
+
+/**
+ * Post-transform vertex cache efficiency of an index buffer.
+ *
+ * ACMR: average cache miss ratio, vertices transformed per triangle. 3 when nothing is reused,
+ *  approaches 0.5 for large regular grids.
+ * ATVR: average transform to vertex ratio, vertices transformed per unique vertex. 1 is optimal.
+ */
+struct Vertex_Cache_Stats {
+    float acmr;
+    float atvr;
+};
+
+void build_indexed_mesh(void const* vertices, uint32_t vertex_count, size_t vertex_size, Mesh* mesh);
+void optimize_vertex_cache(std::vector<uint32_t>* indices, uint32_t vertex_count);
+void optimize_vertex_fetch(Mesh* mesh);
+Vertex_Cache_Stats analyze_vertex_cache(std::vector<uint32_t> const& indices, uint32_t vertex_count,
+    uint32_t cache_size);
+
+void optimize_mesh(void const* vertices, uint32_t vertex_count, size_t vertex_size, Mesh* mesh);
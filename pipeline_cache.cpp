@@ -0,0 +1,177 @@
+#include "pipeline_cache.h"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+    // Header written by the driver at the start of vkGetPipelineCacheData(),
+    // VK_PIPELINE_CACHE_HEADER_VERSION_ONE layout
+    struct Cache_Header {
+        uint32_t header_size;
+        uint32_t header_version;
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint8_t cache_uuid[VK_UUID_SIZE];
+    };
+    static_assert(sizeof(Cache_Header) == 16 + VK_UUID_SIZE, "Unexpected pipeline cache header padding");
+
+    bool read_file(char const* path, std::vector<uint8_t>* data) {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        if (!f.is_open()) {
+            return false;
+        }
+        const std::streamoff size = f.tellg();
+        if (size <= 0) {
+            return false;
+        }
+        data->resize(static_cast<size_t>(size));
+        f.seekg(0, std::ios::beg);
+        f.read(reinterpret_cast<char*>(data->data()), size);
+        return static_cast<bool>(f);
+    }
+}
+
+/**
+ * \param props Properties of the device the cache is used with.
+ * \param path Cache file, missing or stale files give an empty cache.
+ * \param save_interval_ms Minimum time between saves from save_if_due().
+ */
+Status Pipeline_Cache::init(VkDevice device, VkPhysicalDeviceProperties const& props, char const* path,
+    double save_interval_ms)
+{
+    assert(path);
+    const double start_ms = get_perf_counter_ms();
+
+    this->device = device;
+    this->path = path;
+    this->save_interval_ms = save_interval_ms;
+    vendor_id = props.vendorID;
+    device_id = props.deviceID;
+    memcpy(cache_uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+    stats = {};
+
+    std::vector<uint8_t> blob;
+    if (read_file(path, &blob)) {
+        if (validate_header(blob.data(), blob.size())) {
+            stats.warm = true;
+            stats.loaded_bytes = blob.size();
+        }
+        else {
+            log_info("Pipeline cache %s was built for a different device or driver, starting empty\n", path);
+            ++stats.num_rejected;
+            blob.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo cache_ci = {};
+    cache_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_ci.pNext = nullptr;
+    cache_ci.flags = 0;
+    cache_ci.initialDataSize = blob.size();
+    cache_ci.pInitialData = blob.empty() ? nullptr : blob.data();
+    VK_CHECK(vkCreatePipelineCache(device, &cache_ci, nullptr, &cache));
+
+    last_data_size = blob.size();
+    last_save_ms = get_perf_counter_ms();
+    stats.load_ms = last_save_ms - start_ms;
+
+    return STATUS_OK;
+}
+
+void Pipeline_Cache::destroy() {
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+}
+
+/**
+ * Check a blob was produced by this device and driver. The driver is allowed to reject data
+ * silently, checking first lets a stale file be reported and replaced.
+ */
+bool Pipeline_Cache::validate_header(void const* data, size_t size) const {
+    if (size < sizeof(Cache_Header)) {
+        return false;
+    }
+
+    Cache_Header header;
+    memcpy(&header, data, sizeof(header));
+    return header.header_size >= sizeof(Cache_Header)
+        && header.header_size <= size
+        && header.header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendor_id == vendor_id
+        && header.device_id == device_id
+        && memcmp(header.cache_uuid, cache_uuid, VK_UUID_SIZE) == 0;
+}
+
+/**
+ * Write the cache to disk, replacing the previous file only once the new one is complete.
+ */
+Status Pipeline_Cache::save() {
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &size, nullptr));
+    std::vector<uint8_t> blob(size);
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &size, blob.data()));
+    blob.resize(size);
+
+    if (!validate_header(blob.data(), blob.size())) {
+        // Would be rejected on the next start anyway
+        log_error("Pipeline cache data has an unexpected header, not saving\n");
+        return !STATUS_OK;
+    }
+
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!f.is_open()) {
+            log_error("Unable to open %s for writing\n", tmp_path.c_str());
+            return !STATUS_OK;
+        }
+        f.write(reinterpret_cast<char const*>(blob.data()), blob.size());
+        f.flush();
+        if (!f) {
+            log_error("Unable to write %s\n", tmp_path.c_str());
+            return !STATUS_OK;
+        }
+    }
+    if (!replace_file(tmp_path.c_str(), path.c_str())) {
+        return !STATUS_OK;
+    }
+
+    last_data_size = blob.size();
+    last_save_ms = get_perf_counter_ms();
+    stats.saved_bytes = blob.size();
+    ++stats.num_saves;
+    return STATUS_OK;
+}
+
+/**
+ * Save if save_interval_ms has passed since the last save and the cache grew since.
+ * Cheap enough to call every frame.
+ */
+Status Pipeline_Cache::save_if_due(double now_ms) {
+    if (now_ms - last_save_ms < save_interval_ms) {
+        return STATUS_OK;
+    }
+    last_save_ms = now_ms;
+
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &size, nullptr));
+    if (size == last_data_size) {
+        return STATUS_OK;
+    }
+    return save();
+}
+
+/**
+ * Record time spent creating pipelines with the cache, reported by log_stats().
+ */
+void Pipeline_Cache::add_pipeline_time(double elapsed_ms, uint32_t num_pipelines) {
+    stats.pipeline_ms += elapsed_ms;
+    stats.num_pipelines += num_pipelines;
+}
+
+void Pipeline_Cache::log_stats() const {
+    log_info("Pipeline cache: %s start, %zu bytes loaded in %.2f ms, %u pipelines created in %.2f ms\n",
+        stats.warm ? "warm" : "cold", stats.loaded_bytes, stats.load_ms, stats.num_pipelines, stats.pipeline_ms);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "status.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+#include <string>
+
+struct Pipeline_Cache_Stats {
+    bool warm;               //!< Started from a valid blob on disk
+    size_t loaded_bytes;     //!< Size of the blob the cache was created with, 0 on a cold start
+    size_t saved_bytes;      //!< Size of the last blob written
+    uint32_t num_saves;
+    uint32_t num_rejected;   //!< Blobs on disk discarded for not matching the device
+    double load_ms;          //!< Reading, validating and creating the cache
+    double pipeline_ms;      //!< Total time spent in pipeline creation reported with add_pipeline_time()
+    uint32_t num_pipelines;
+};
+
+/**
+ * VkPipelineCache persisted to disk between runs.
+ *
+ * The blob is only handed to the driver if its header matches the device's vendorID,
+ * deviceID and pipelineCacheUUID, otherwise the cache starts empty (a driver update changes
+ * the UUID). Every pipeline should be created with the same cache. Saves write a temporary
+ * file and move it over the old one, so a crash mid-save never leaves a truncated blob.
+ */
+struct Pipeline_Cache {
+    VkDevice device;
+    VkPipelineCache cache;
+    std::string path;
+
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint8_t cache_uuid[VK_UUID_SIZE];
+
+    double save_interval_ms; //!< Minimum time between periodic saves
+    double last_save_ms;
+    size_t last_data_size;   //!< Cache data size at the last save, saves are skipped while unchanged
+
+    Pipeline_Cache_Stats stats;
+
+    Status init(VkDevice device, VkPhysicalDeviceProperties const& props, char const* path, double save_interval_ms);
+    void destroy();
+
+    Status save();
+    Status save_if_due(double now_ms);
+
+    void add_pipeline_time(double elapsed_ms, uint32_t num_pipelines);
+    void log_stats() const;
+
+    bool validate_header(void const* data, size_t size) const;
+};
@@ -0,0 +1,123 @@
+#include "pipeline_key.h"
+
+#include "hash.h"
+#include <cassert>
+#include <cstring>
+
+bool operator==(Pipeline_Key const& a, Pipeline_Key const& b) {
+    return memcmp(&a, &b, sizeof(Pipeline_Key)) == 0;
+}
+
+size_t Pipeline_Key_Hash::operator()(Pipeline_Key const& key) const {
+    return static_cast<size_t>(hash_bytes(&key, sizeof(key)));
+}
+
+/**
+ * NOTE: Hashed state is read member by member, never as whole structs that may contain padding.
+ * Arrays hashed in one go (attributes, blend attachments, ...) consist of 32-bit fields only.
+ */
+Pipeline_Key make_pipeline_key(VkGraphicsPipelineCreateInfo const& ci) {
+    assert(ci.stageCount <= Pipeline_Key::max_stages);
+    assert(ci.pVertexInputState && ci.pInputAssemblyState && ci.pRasterizationState);
+
+    Pipeline_Key key;
+    memset(&key, 0, sizeof(key));
+    key.layout = ci.layout;
+    key.render_pass = ci.renderPass;
+    key.subpass = ci.subpass;
+
+    uint64_t detail = hash_bytes(&ci.flags, sizeof(ci.flags));
+
+    // Shaders
+    for (uint32_t i = 0; i < ci.stageCount; ++i) {
+        VkPipelineShaderStageCreateInfo const& stage = ci.pStages[i];
+        key.stage_modules[i] = stage.module;
+        key.stage_flags |= stage.stage;
+
+        detail = hash_bytes(stage.pName, strlen(stage.pName), detail);
+        if (stage.pSpecializationInfo) {
+            VkSpecializationInfo const& spec = *stage.pSpecializationInfo;
+            for (uint32_t e = 0; e < spec.mapEntryCount; ++e) {
+                VkSpecializationMapEntry const& entry = spec.pMapEntries[e];
+                detail = hash_bytes(&entry.constantID, sizeof(entry.constantID), detail);
+                detail = hash_bytes(&entry.offset, sizeof(entry.offset), detail);
+                detail = hash_bytes(&entry.size, sizeof(entry.size), detail);
+            }
+            detail = hash_bytes(spec.pData, spec.dataSize, detail);
+        }
+    }
+
+    // Vertex layout
+    VkPipelineVertexInputStateCreateInfo const& vertex_input = *ci.pVertexInputState;
+    detail = hash_bytes(vertex_input.pVertexBindingDescriptions,
+        vertex_input.vertexBindingDescriptionCount * sizeof(VkVertexInputBindingDescription), detail);
+    detail = hash_bytes(vertex_input.pVertexAttributeDescriptions,
+        vertex_input.vertexAttributeDescriptionCount * sizeof(VkVertexInputAttributeDescription), detail);
+
+    // Topology
+    key.topology = static_cast<uint8_t>(ci.pInputAssemblyState->topology);
+    key.primitive_restart = static_cast<uint8_t>(ci.pInputAssemblyState->primitiveRestartEnable);
+
+    // Raster
+    VkPipelineRasterizationStateCreateInfo const& raster = *ci.pRasterizationState;
+    key.polygon_mode = static_cast<uint8_t>(raster.polygonMode);
+    key.cull_mode = static_cast<uint8_t>(raster.cullMode);
+    key.front_face = static_cast<uint8_t>(raster.frontFace);
+    key.depth_bias = static_cast<uint8_t>(raster.depthBiasEnable);
+    key.rasterizer_discard = static_cast<uint8_t>(raster.rasterizerDiscardEnable);
+    detail = hash_bytes(&raster.depthClampEnable, sizeof(raster.depthClampEnable), detail);
+    detail = hash_bytes(&raster.depthBiasConstantFactor, sizeof(raster.depthBiasConstantFactor), detail);
+    detail = hash_bytes(&raster.depthBiasClamp, sizeof(raster.depthBiasClamp), detail);
+    detail = hash_bytes(&raster.depthBiasSlopeFactor, sizeof(raster.depthBiasSlopeFactor), detail);
+    detail = hash_bytes(&raster.lineWidth, sizeof(raster.lineWidth), detail);
+
+    if (ci.pMultisampleState) {
+        VkPipelineMultisampleStateCreateInfo const& multisample = *ci.pMultisampleState;
+        key.samples = static_cast<uint8_t>(multisample.rasterizationSamples);
+        detail = hash_bytes(&multisample.sampleShadingEnable, sizeof(multisample.sampleShadingEnable), detail);
+        detail = hash_bytes(&multisample.minSampleShading, sizeof(multisample.minSampleShading), detail);
+        detail = hash_bytes(&multisample.alphaToCoverageEnable, sizeof(multisample.alphaToCoverageEnable), detail);
+        detail = hash_bytes(&multisample.alphaToOneEnable, sizeof(multisample.alphaToOneEnable), detail);
+        assert(multisample.pSampleMask == nullptr);
+    }
+
+    // Depth
+    if (ci.pDepthStencilState) {
+        VkPipelineDepthStencilStateCreateInfo const& depth = *ci.pDepthStencilState;
+        key.depth_test = static_cast<uint8_t>(depth.depthTestEnable);
+        key.depth_write = static_cast<uint8_t>(depth.depthWriteEnable);
+        key.depth_compare = static_cast<uint8_t>(depth.depthCompareOp);
+        key.stencil_test = static_cast<uint8_t>(depth.stencilTestEnable);
+        detail = hash_bytes(&depth.depthBoundsTestEnable, sizeof(depth.depthBoundsTestEnable), detail);
+        detail = hash_bytes(&depth.minDepthBounds, sizeof(depth.minDepthBounds), detail);
+        detail = hash_bytes(&depth.maxDepthBounds, sizeof(depth.maxDepthBounds), detail);
+        detail = hash_bytes(&depth.front, sizeof(depth.front), detail);
+        detail = hash_bytes(&depth.back, sizeof(depth.back), detail);
+    }
+
+    // Blend
+    if (ci.pColorBlendState) {
+        VkPipelineColorBlendStateCreateInfo const& blend = *ci.pColorBlendState;
+        key.num_blend_attachments = static_cast<uint8_t>(blend.attachmentCount);
+        for (uint32_t i = 0; i < blend.attachmentCount; ++i) {
+            key.blend_enable |= static_cast<uint8_t>(blend.pAttachments[i].blendEnable);
+        }
+        detail = hash_bytes(blend.pAttachments, blend.attachmentCount * sizeof(VkPipelineColorBlendAttachmentState),
+            detail);
+        detail = hash_bytes(&blend.logicOpEnable, sizeof(blend.logicOpEnable), detail);
+        detail = hash_bytes(&blend.logicOp, sizeof(blend.logicOp), detail);
+        detail = hash_bytes(blend.blendConstants, sizeof(blend.blendConstants), detail);
+    }
+
+    if (ci.pViewportState) {
+        detail = hash_bytes(&ci.pViewportState->viewportCount, sizeof(ci.pViewportState->viewportCount), detail);
+        detail = hash_bytes(&ci.pViewportState->scissorCount, sizeof(ci.pViewportState->scissorCount), detail);
+    }
+    if (ci.pDynamicState) {
+        detail = hash_bytes(ci.pDynamicState->pDynamicStates,
+            ci.pDynamicState->dynamicStateCount * sizeof(VkDynamicState), detail);
+    }
+
+    key.detail_hash = detail;
+    return key;
+}
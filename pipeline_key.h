@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Summary of a graphics pipeline's state, create infos with different keys never give the same
+ * pipeline.
+ *
+ * The state pipelines usually differ in is stored directly. Variable sized state (vertex
+ * input, blend attachments, dynamic states, stencil ops, specialization data and entry points)
+ * is folded into detail_hash, so the key stays a fixed 64 bytes that hash and compare with a
+ * memcmp. Different state can still hash to equal keys, see Graphics_Pipeline_State::equals().
+ */
+struct Pipeline_Key {
+    static constexpr uint32_t max_stages = 2;
+
+    VkShaderModule stage_modules[max_stages]; //!< In pStages order, VK_NULL_HANDLE if unused
+    VkPipelineLayout layout;
+    VkRenderPass render_pass;
+    uint64_t detail_hash;
+    uint32_t stage_flags;
+    uint32_t subpass;
+
+    uint8_t topology;
+    uint8_t primitive_restart;
+    uint8_t polygon_mode;
+    uint8_t cull_mode;
+    uint8_t front_face;
+    uint8_t depth_bias;
+    uint8_t rasterizer_discard;
+    uint8_t samples;
+
+    uint8_t depth_test;
+    uint8_t depth_write;
+    uint8_t depth_compare;
+    uint8_t stencil_test;
+    uint8_t blend_enable;  //!< Any attachment blends
+    uint8_t num_blend_attachments;
+    uint8_t pad[2];        //!< Zeroed, keeps the struct free of implicit padding
+};
+static_assert(sizeof(Pipeline_Key) == 64, "Pipeline_Key has implicit padding");
+
+bool operator==(Pipeline_Key const& a, Pipeline_Key const& b);
+
+struct Pipeline_Key_Hash {
+    size_t operator()(Pipeline_Key const& key) const;
+};
+
+Pipeline_Key make_pipeline_key(VkGraphicsPipelineCreateInfo const& ci);
@@ -0,0 +1,440 @@
+#include "pipeline_manager.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace {
+    bool same_stage(Graphics_Pipeline_State::Stage const& a, Graphics_Pipeline_State::Stage const& b) {
+        if (a.info.flags != b.info.flags || a.info.stage != b.info.stage || a.info.module != b.info.module
+            || a.entry_point != b.entry_point || a.has_specialization != b.has_specialization)
+        {
+            return false;
+        }
+        if (!a.has_specialization) {
+            return true;
+        }
+        if (a.spec_map.size() != b.spec_map.size() || a.spec_data != b.spec_data) {
+            return false;
+        }
+        for (size_t i = 0; i < a.spec_map.size(); ++i) {
+            VkSpecializationMapEntry const& x = a.spec_map[i];
+            VkSpecializationMapEntry const& y = b.spec_map[i];
+            if (x.constantID != y.constantID || x.offset != y.offset || x.size != y.size) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool same_stencil_op(VkStencilOpState const& a, VkStencilOpState const& b) {
+        return a.failOp == b.failOp && a.passOp == b.passOp && a.depthFailOp == b.depthFailOp
+            && a.compareOp == b.compareOp && a.compareMask == b.compareMask && a.writeMask == b.writeMask
+            && a.reference == b.reference;
+    }
+}
+
+void Graphics_Pipeline_State::copy_from(VkGraphicsPipelineCreateInfo const& ci) {
+    assert(ci.pNext == nullptr);
+    assert(ci.pVertexInputState && ci.pInputAssemblyState && ci.pRasterizationState);
+    assert(ci.pTessellationState == nullptr);
+
+    info = ci;
+    has_multisample = ci.pMultisampleState != nullptr;
+    has_depth_stencil = ci.pDepthStencilState != nullptr;
+    has_viewport = ci.pViewportState != nullptr;
+    has_color_blend = ci.pColorBlendState != nullptr;
+    has_dynamic = ci.pDynamicState != nullptr;
+
+    stages.resize(ci.stageCount);
+    for (uint32_t i = 0; i < ci.stageCount; ++i) {
+        VkPipelineShaderStageCreateInfo const& src = ci.pStages[i];
+        assert(src.pNext == nullptr);
+        Stage& stage = stages[i];
+        stage.info = src;
+        stage.entry_point = src.pName;
+        stage.has_specialization = src.pSpecializationInfo != nullptr;
+        if (stage.has_specialization) {
+            VkSpecializationInfo const& spec = *src.pSpecializationInfo;
+            stage.specialization = spec;
+            stage.spec_map.assign(spec.pMapEntries, spec.pMapEntries + spec.mapEntryCount);
+            uint8_t const* spec_data = static_cast<uint8_t const*>(spec.pData);
+            stage.spec_data.assign(spec_data, spec_data + spec.dataSize);
+        }
+    }
+
+    vertex_input = *ci.pVertexInputState;
+    bindings.assign(vertex_input.pVertexBindingDescriptions,
+        vertex_input.pVertexBindingDescriptions + vertex_input.vertexBindingDescriptionCount);
+    attribs.assign(vertex_input.pVertexAttributeDescriptions,
+        vertex_input.pVertexAttributeDescriptions + vertex_input.vertexAttributeDescriptionCount);
+
+    input_assembly = *ci.pInputAssemblyState;
+    rasterization = *ci.pRasterizationState;
+
+    // Optional with rasterizer discard
+    multisample = ci.pMultisampleState ? *ci.pMultisampleState : VkPipelineMultisampleStateCreateInfo{};
+    depth_stencil = ci.pDepthStencilState ? *ci.pDepthStencilState : VkPipelineDepthStencilStateCreateInfo{};
+
+    // Only dynamic viewports and scissors are supported, the arrays are not copied
+    viewport = ci.pViewportState ? *ci.pViewportState : VkPipelineViewportStateCreateInfo{};
+    assert(viewport.pViewports == nullptr && viewport.pScissors == nullptr);
+    assert(viewport.pNext == nullptr);
+
+    color_blend = ci.pColorBlendState ? *ci.pColorBlendState : VkPipelineColorBlendStateCreateInfo{};
+    blend_attachments.assign(color_blend.pAttachments, color_blend.pAttachments + color_blend.attachmentCount);
+
+    dynamic = ci.pDynamicState ? *ci.pDynamicState : VkPipelineDynamicStateCreateInfo{};
+    dynamic_states.assign(dynamic.pDynamicStates, dynamic.pDynamicStates + dynamic.dynamicStateCount);
+}
+
+/**
+ * Point the create info at the copied state. Valid until the state is modified or moved.
+ */
+VkGraphicsPipelineCreateInfo const& Graphics_Pipeline_State::create_info() {
+    stage_infos.resize(stages.size());
+    for (size_t i = 0; i < stages.size(); ++i) {
+        Stage& stage = stages[i];
+        stage_infos[i] = stage.info;
+        stage_infos[i].pName = stage.entry_point.c_str();
+        stage_infos[i].pSpecializationInfo = nullptr;
+        if (stage.has_specialization) {
+            stage.specialization.mapEntryCount = static_cast<uint32_t>(stage.spec_map.size());
+            stage.specialization.pMapEntries = stage.spec_map.data();
+            stage.specialization.dataSize = stage.spec_data.size();
+            stage.specialization.pData = stage.spec_data.data();
+            stage_infos[i].pSpecializationInfo = &stage.specialization;
+        }
+    }
+
+    vertex_input.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+    vertex_input.pVertexBindingDescriptions = bindings.data();
+    vertex_input.vertexAttributeDescriptionCount = static_cast<uint32_t>(attribs.size());
+    vertex_input.pVertexAttributeDescriptions = attribs.data();
+
+    color_blend.attachmentCount = static_cast<uint32_t>(blend_attachments.size());
+    color_blend.pAttachments = blend_attachments.data();
+
+    dynamic.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
+    dynamic.pDynamicStates = dynamic_states.data();
+
+    info.stageCount = static_cast<uint32_t>(stage_infos.size());
+    info.pStages = stage_infos.data();
+    info.pVertexInputState = &vertex_input;
+    info.pInputAssemblyState = &input_assembly;
+    info.pRasterizationState = &rasterization;
+    info.pMultisampleState = has_multisample ? &multisample : nullptr;
+    info.pDepthStencilState = has_depth_stencil ? &depth_stencil : nullptr;
+    info.pViewportState = has_viewport ? &viewport : nullptr;
+    info.pColorBlendState = has_color_blend ? &color_blend : nullptr;
+    info.pDynamicState = has_dynamic ? &dynamic : nullptr;
+    return info;
+}
+
+/**
+ * Whether both create the same pipeline, comparing every copied value.
+ *
+ * NOTE: Reads nothing create_info() writes, so an entry's state may be compared while a worker
+ * creates its pipeline.
+ */
+bool Graphics_Pipeline_State::equals(Graphics_Pipeline_State const& other) const {
+    if (info.flags != other.info.flags || info.layout != other.info.layout || info.renderPass != other.info.renderPass
+        || info.subpass != other.info.subpass || stages.size() != other.stages.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (!same_stage(stages[i], other.stages[i])) {
+            return false;
+        }
+    }
+
+    // Vertex layout
+    if (vertex_input.flags != other.vertex_input.flags || bindings.size() != other.bindings.size()
+        || attribs.size() != other.attribs.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < bindings.size(); ++i) {
+        VkVertexInputBindingDescription const& a = bindings[i];
+        VkVertexInputBindingDescription const& b = other.bindings[i];
+        if (a.binding != b.binding || a.stride != b.stride || a.inputRate != b.inputRate) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < attribs.size(); ++i) {
+        VkVertexInputAttributeDescription const& a = attribs[i];
+        VkVertexInputAttributeDescription const& b = other.attribs[i];
+        if (a.location != b.location || a.binding != b.binding || a.format != b.format || a.offset != b.offset) {
+            return false;
+        }
+    }
+
+    // Topology and raster
+    VkPipelineInputAssemblyStateCreateInfo const& ia = other.input_assembly;
+    if (input_assembly.flags != ia.flags || input_assembly.topology != ia.topology
+        || input_assembly.primitiveRestartEnable != ia.primitiveRestartEnable)
+    {
+        return false;
+    }
+    VkPipelineRasterizationStateCreateInfo const& raster = other.rasterization;
+    if (rasterization.flags != raster.flags || rasterization.depthClampEnable != raster.depthClampEnable
+        || rasterization.rasterizerDiscardEnable != raster.rasterizerDiscardEnable
+        || rasterization.polygonMode != raster.polygonMode || rasterization.cullMode != raster.cullMode
+        || rasterization.frontFace != raster.frontFace || rasterization.depthBiasEnable != raster.depthBiasEnable
+        || rasterization.depthBiasConstantFactor != raster.depthBiasConstantFactor
+        || rasterization.depthBiasClamp != raster.depthBiasClamp
+        || rasterization.depthBiasSlopeFactor != raster.depthBiasSlopeFactor
+        || rasterization.lineWidth != raster.lineWidth)
+    {
+        return false;
+    }
+
+    // Optional state, only compared when given
+    if (has_multisample != other.has_multisample || has_depth_stencil != other.has_depth_stencil
+        || has_viewport != other.has_viewport || has_color_blend != other.has_color_blend
+        || has_dynamic != other.has_dynamic)
+    {
+        return false;
+    }
+    if (has_multisample) {
+        VkPipelineMultisampleStateCreateInfo const& ms = other.multisample;
+        if (multisample.flags != ms.flags || multisample.rasterizationSamples != ms.rasterizationSamples
+            || multisample.sampleShadingEnable != ms.sampleShadingEnable
+            || multisample.minSampleShading != ms.minSampleShading
+            || multisample.alphaToCoverageEnable != ms.alphaToCoverageEnable
+            || multisample.alphaToOneEnable != ms.alphaToOneEnable)
+        {
+            return false;
+        }
+    }
+    if (has_depth_stencil) {
+        VkPipelineDepthStencilStateCreateInfo const& ds = other.depth_stencil;
+        if (depth_stencil.flags != ds.flags || depth_stencil.depthTestEnable != ds.depthTestEnable
+            || depth_stencil.depthWriteEnable != ds.depthWriteEnable || depth_stencil.depthCompareOp != ds.depthCompareOp
+            || depth_stencil.depthBoundsTestEnable != ds.depthBoundsTestEnable
+            || depth_stencil.stencilTestEnable != ds.stencilTestEnable
+            || !same_stencil_op(depth_stencil.front, ds.front) || !same_stencil_op(depth_stencil.back, ds.back)
+            || depth_stencil.minDepthBounds != ds.minDepthBounds || depth_stencil.maxDepthBounds != ds.maxDepthBounds)
+        {
+            return false;
+        }
+    }
+    if (has_viewport) {
+        if (viewport.flags != other.viewport.flags || viewport.viewportCount != other.viewport.viewportCount
+            || viewport.scissorCount != other.viewport.scissorCount)
+        {
+            return false;
+        }
+    }
+    if (has_color_blend) {
+        VkPipelineColorBlendStateCreateInfo const& cb = other.color_blend;
+        if (color_blend.flags != cb.flags || color_blend.logicOpEnable != cb.logicOpEnable
+            || color_blend.logicOp != cb.logicOp
+            || memcmp(color_blend.blendConstants, cb.blendConstants, sizeof(cb.blendConstants)) != 0
+            || blend_attachments.size() != other.blend_attachments.size())
+        {
+            return false;
+        }
+        // 32-bit fields only, no padding
+        if (!blend_attachments.empty() && memcmp(blend_attachments.data(), other.blend_attachments.data(),
+            blend_attachments.size() * sizeof(VkPipelineColorBlendAttachmentState)) != 0)
+        {
+            return false;
+        }
+    }
+    if (has_dynamic) {
+        if (dynamic.flags != other.dynamic.flags || dynamic_states != other.dynamic_states) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Pipeline_Manager::init(VkDevice device, Pipeline_Cache* cache, Thread_Pool* thread_pool) {
+    assert(cache && thread_pool);
+    this->device = device;
+    this->cache = cache;
+    this->thread_pool = thread_pool;
+    num_completed = 0;
+    stats = {};
+}
+
+/**
+ * Wait for pending compiles and destroy every pipeline.
+ */
+void Pipeline_Manager::destroy() {
+    wait_all();
+    for (Entry& entry : entries) {
+        if (entry.status == Pipeline_Status::Ready) {
+            vkDestroyPipeline(device, entry.pipeline, nullptr);
+        }
+    }
+    entries.clear();
+    registry.clear();
+}
+
+/**
+ * Create a pipeline on the calling thread, eg. the fallback used while others compile. Waits
+ * instead if a pipeline with the same state was already requested.
+ */
+Status Pipeline_Manager::create(VkGraphicsPipelineCreateInfo const& ci, char const* name, Pipeline_Handle* handle) {
+    assert(handle);
+    const Pipeline_Key key = make_pipeline_key(ci);
+    Graphics_Pipeline_State state;
+    state.copy_from(ci);
+    if (lookup(key, state, handle)) {
+        return wait(*handle);
+    }
+
+    Entry& entry = add_entry(key, name, handle);
+    entry.state = std::move(state);
+    compile(&entry);
+    return entry.status == Pipeline_Status::Ready ? STATUS_OK : !STATUS_OK;
+}
+
+/**
+ * Find the pipeline for the given state, queueing its creation on the thread pool if there is
+ * none yet.
+ *
+ * \return Handle to poll with get() or status().
+ */
+Pipeline_Handle Pipeline_Manager::request(VkGraphicsPipelineCreateInfo const& ci, char const* name) {
+    const Pipeline_Key key = make_pipeline_key(ci);
+    Graphics_Pipeline_State state;
+    state.copy_from(ci);
+    Pipeline_Handle handle;
+    if (lookup(key, state, &handle)) {
+        return handle;
+    }
+
+    Entry& entry = add_entry(key, name, &handle);
+    entry.state = std::move(state);
+    thread_pool->submit([this, entry = &entry] { compile(entry); });
+    return handle;
+}
+
+/**
+ * Same as above for state kept by the caller, with its key computed once up front. The state
+ * is only compared on a key match and copied on a miss, so this is cheap to call every time
+ * the pipeline is bound.
+ */
+Pipeline_Handle Pipeline_Manager::request(Pipeline_Key const& key, Graphics_Pipeline_State const& state,
+    char const* name)
+{
+    Pipeline_Handle handle;
+    if (lookup(key, state, &handle)) {
+        return handle;
+    }
+
+    Entry& entry = add_entry(key, name, &handle);
+    entry.state = state;
+    thread_pool->submit([this, entry = &entry] { compile(entry); });
+    return handle;
+}
+
+/**
+ * \return The pipeline, VK_NULL_HANDLE while it is compiling or if creation failed.
+ */
+VkPipeline Pipeline_Manager::get(Pipeline_Handle handle) const {
+    assert(handle < entries.size());
+    Entry const& entry = entries[handle];
+    return entry.status.load(std::memory_order_acquire) == Pipeline_Status::Ready ? entry.pipeline : VK_NULL_HANDLE;
+}
+
+Pipeline_Status Pipeline_Manager::status(Pipeline_Handle handle) const {
+    assert(handle < entries.size());
+    return entries[handle].status.load(std::memory_order_acquire);
+}
+
+/**
+ * Block until a pipeline has finished compiling.
+ */
+Status Pipeline_Manager::wait(Pipeline_Handle handle) {
+    assert(handle < entries.size());
+    Entry const& entry = entries[handle];
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&entry] { return entry.status.load() != Pipeline_Status::Pending; });
+    return entry.status == Pipeline_Status::Ready ? STATUS_OK : !STATUS_OK;
+}
+
+Status Pipeline_Manager::wait_all() {
+    Status status = STATUS_OK;
+    for (Pipeline_Handle handle = 0; handle < entries.size(); ++handle) {
+        if (wait(handle) != STATUS_OK) {
+            status = !STATUS_OK;
+        }
+    }
+    return status;
+}
+
+void Pipeline_Manager::log_stats() const {
+    log_info("Pipelines: %u unique, %llu lookup hits, %u key collisions, %u failed, %.2f ms compiling\n",
+        stats.num_misses, static_cast<unsigned long long>(stats.num_hits), stats.num_key_collisions, stats.num_failed,
+        stats.compile_ms);
+    for (Entry const& entry : entries) {
+        log_info("  %s: %.2f ms\n", entry.name.c_str(), entry.compile_ms);
+    }
+}
+
+/**
+ * Find the entry created from state. Its key is only a prefilter, the state decides.
+ */
+bool Pipeline_Manager::lookup(Pipeline_Key const& key, Graphics_Pipeline_State const& state, Pipeline_Handle* handle) {
+    auto range = registry.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (entries[it->second].state.equals(state)) {
+            *handle = it->second;
+            ++stats.num_hits;
+            return true;
+        }
+    }
+    if (range.first != range.second) {
+        ++stats.num_key_collisions;
+    }
+    return false;
+}
+
+/**
+ * NOTE: Entries are only added from the thread owning the manager, workers only touch the
+ * entry they compile.
+ */
+Pipeline_Manager::Entry& Pipeline_Manager::add_entry(Pipeline_Key const& key, char const* name,
+    Pipeline_Handle* handle)
+{
+    *handle = static_cast<Pipeline_Handle>(entries.size());
+    entries.emplace_back();
+    Entry& entry = entries.back();
+    entry.key = key;
+    entry.name = name;
+    entry.pipeline = VK_NULL_HANDLE;
+    entry.status = Pipeline_Status::Pending;
+    entry.compile_ms = 0.0;
+    registry.emplace(key, *handle);
+    ++stats.num_misses;
+    return entry;
+}
+
+void Pipeline_Manager::compile(Entry* entry) {
+    const double start_ms = get_perf_counter_ms();
+    const VkResult res = vkCreateGraphicsPipelines(device, cache->cache, 1, &entry->state.create_info(), nullptr,
+        &entry->pipeline);
+    entry->compile_ms = get_perf_counter_ms() - start_ms;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.compile_ms += entry->compile_ms;
+        cache->add_pipeline_time(entry->compile_ms, 1);
+        if (res == VK_SUCCESS) {
+            ++stats.num_ready;
+            entry->status.store(Pipeline_Status::Ready, std::memory_order_release);
+        }
+        else {
+            log_error("Pipeline %s creation failed: %s\n", entry->name.c_str(), get_vk_error_msg(res));
+            ++stats.num_failed;
+            entry->pipeline = VK_NULL_HANDLE;
+            entry->status.store(Pipeline_Status::Failed, std::memory_order_release);
+        }
+        ++num_completed;
+    }
+    done_cv.notify_all();
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "pipeline_cache.h"
+#include "pipeline_key.h"
+#include "status.h"
+#include "thread_pool.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Owning copy of a VkGraphicsPipelineCreateInfo and everything it points to, so creation can
+ * happen after the caller's state has gone out of scope.
+ *
+ * NOTE: pNext chains are not copied and must be null.
+ */
+struct Graphics_Pipeline_State {
+    struct Stage {
+        VkPipelineShaderStageCreateInfo info;
+        std::string entry_point;
+        bool has_specialization;
+        VkSpecializationInfo specialization;
+        std::vector<VkSpecializationMapEntry> spec_map;
+        std::vector<uint8_t> spec_data;
+    };
+
+    std::vector<Stage> stages;
+    std::vector<VkPipelineShaderStageCreateInfo> stage_infos;
+
+    // Optional parts of the create info that were given
+    bool has_multisample;
+    bool has_depth_stencil;
+    bool has_viewport;
+    bool has_color_blend;
+    bool has_dynamic;
+
+    VkPipelineVertexInputStateCreateInfo vertex_input;
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attribs;
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly;
+    VkPipelineRasterizationStateCreateInfo rasterization;
+    VkPipelineMultisampleStateCreateInfo multisample;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil;
+    VkPipelineViewportStateCreateInfo viewport;
+
+    VkPipelineColorBlendStateCreateInfo color_blend;
+    std::vector<VkPipelineColorBlendAttachmentState> blend_attachments;
+
+    VkPipelineDynamicStateCreateInfo dynamic;
+    std::vector<VkDynamicState> dynamic_states;
+
+    VkGraphicsPipelineCreateInfo info;
+
+    void copy_from(VkGraphicsPipelineCreateInfo const& ci);
+    VkGraphicsPipelineCreateInfo const& create_info();
+    bool equals(Graphics_Pipeline_State const& other) const;
+};
+
+using Pipeline_Handle = uint32_t;
+static constexpr Pipeline_Handle invalid_pipeline_handle = ~0u;
+
+enum class Pipeline_Status : uint8_t {
+    Pending,
+    Ready,
+    Failed,
+};
+
+struct Pipeline_Manager_Stats {
+    uint64_t num_hits;   //!< Lookups that found an existing pipeline
+    uint32_t num_misses; //!< Lookups that created a pipeline, the number of unique pipelines
+    uint32_t num_key_collisions; //!< Entries with an equal key but different state, told apart by equals()
+
+    // Written by workers
+    uint32_t num_ready;
+    uint32_t num_failed;
+    double compile_ms; //!< Summed over workers, exceeds wall time when compiles overlap
+};
+
+/**
+ * Registry of graphics pipelines keyed by Pipeline_Key, created on a thread pool against a
+ * shared pipeline cache.
+ *
+ * Looking up state that has no pipeline yet creates one, later lookups of equal state return
+ * the same handle, so a pipeline is never created twice. Entries with an equal key have their
+ * full state compared, a key collision gets its own pipeline. request() returns a handle straight
+ * away, get() gives VK_NULL_HANDLE until the worker is done, so the renderer can keep drawing
+ * with a pipeline created up front through create() and switch once the real one is ready.
+ * Pipelines are owned by the manager.
+ */
+struct Pipeline_Manager {
+    struct Entry {
+        Pipeline_Key key;
+        std::string name;
+        Graphics_Pipeline_State state;
+        VkPipeline pipeline;                 //!< Written by the worker before status is set
+        std::atomic<Pipeline_Status> status;
+        double compile_ms;
+    };
+
+    VkDevice device;
+    Pipeline_Cache* cache;
+    Thread_Pool* thread_pool;
+
+    std::mutex mutex;            //!< Guards the stats written by workers and entry completion
+    std::condition_variable done_cv;
+    std::deque<Entry> entries;   //!< Deque so workers can hold on to an entry while it grows
+    std::unordered_multimap<Pipeline_Key, Pipeline_Handle, Pipeline_Key_Hash> registry;
+    std::atomic<uint32_t> num_completed;
+
+    Pipeline_Manager_Stats stats;
+
+    void init(VkDevice device, Pipeline_Cache* cache, Thread_Pool* thread_pool);
+    void destroy();
+
+    Status create(VkGraphicsPipelineCreateInfo const& ci, char const* name, Pipeline_Handle* handle);
+    Pipeline_Handle request(VkGraphicsPipelineCreateInfo const& ci, char const* name);
+    Pipeline_Handle request(Pipeline_Key const& key, Graphics_Pipeline_State const& state, char const* name);
+
+    VkPipeline get(Pipeline_Handle handle) const;
+    Pipeline_Status status(Pipeline_Handle handle) const;
+    Status wait(Pipeline_Handle handle);
+    Status wait_all();
+    void log_stats() const;
+
+    bool lookup(Pipeline_Key const& key, Graphics_Pipeline_State const& state, Pipeline_Handle* handle);
+    Entry& add_entry(Pipeline_Key const& key, char const* name, Pipeline_Handle* handle);
+    void compile(Entry* entry);
+};
@@ -1,11 +1,14 @@
 #include "platform.h"
 
-#include "synchapi.h"
 #include <cassert>
 
 #ifdef _WIN32
+#include "synchapi.h"
+#include <timeapi.h>
 
 static Destroy_Callback g_window_destroy_callback;
+static Resize_Callback g_window_resize_callback;
+static Key_Callback g_window_key_callback;
 
 constexpr LPCTSTR window_class_name = TEXT("VulkanPractice");
 constexpr LPCTSTR window_name = TEXT("Vulkan Practice");
@@ -21,6 +24,18 @@ LRESULT CALLBACK window_proc_callback(HWND hwnd, UINT msg, WPARAM w_param, LPARA
         PostQuitMessage(0);
         break;
 
+    case WM_SIZE:
+        if (g_window_resize_callback) {
+            g_window_resize_callback(LOWORD(l_param), HIWORD(l_param));
+        }
+        break;
+
+    case WM_KEYDOWN:
+        if (g_window_key_callback) {
+            g_window_key_callback(static_cast<uint32_t>(w_param));
+        }
+        break;
+
     default:
         return DefWindowProcW(hwnd, msg, w_param, l_param);
     }
@@ -28,9 +43,12 @@ LRESULT CALLBACK window_proc_callback(HWND hwnd, UINT msg, WPARAM w_param, LPARA
     return 0;
 }
 
-Window create_window(const Rect& window_rect, Destroy_Callback destroy_callback)
+Window create_window(const Rect& window_rect, Destroy_Callback destroy_callback, Resize_Callback resize_callback,
+    Key_Callback key_callback)
 {
     g_window_destroy_callback = destroy_callback;
+    g_window_resize_callback = resize_callback;
+    g_window_key_callback = key_callback;
 
     Window window = {};
     window.h_instance = GetModuleHandle(nullptr);
@@ -84,6 +102,35 @@ int process_window_messages(Window const& window)
 
 static double g_platform_init = false;
 static double g_sys_perf_freq_ms = 0.0;
+static uint64_t g_sys_perf_freq = 0;
+static double g_sleep_granularity_ms = 1.0;
+
+namespace {
+    /**
+     * High resolution waitable timer of the calling thread. A timer can only have one due time,
+     * so threads don't share one.
+     */
+    struct Sleep_Timer {
+        HANDLE handle = nullptr;
+        bool created = false;
+
+        ~Sleep_Timer() {
+            if (handle) {
+                CloseHandle(handle);
+            }
+        }
+
+        HANDLE get() {
+            if (!created) {
+                created = true;
+                handle = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+            }
+            return handle;
+        }
+    };
+
+    thread_local Sleep_Timer t_sleep_timer;
+}
 
 void init_platform() {
     LARGE_INTEGER sys_perf_freq;
@@ -93,8 +140,19 @@ void init_platform() {
         assert(!"QueryPerformanceCounter failed");
     }
 
+    g_sys_perf_freq = static_cast<uint64_t>(sys_perf_freq.QuadPart);
     g_sys_perf_freq_ms = static_cast<double>(sys_perf_freq.QuadPart) / 1000.0;
 
+    // High resolution timers need Windows 10 1803. Older versions get Sleep() at a 1 ms
+    // scheduler period instead of the default 15.6 ms.
+    if (t_sleep_timer.get()) {
+        g_sleep_granularity_ms = 0.5;
+    }
+    else {
+        timeBeginPeriod(1);
+        g_sleep_granularity_ms = 2.0;
+    }
+
     g_platform_init = true;
 }
 
@@ -105,8 +163,287 @@ double get_perf_counter_ms() {
     return static_cast<double>(sys_perf_counter.QuadPart) / g_sys_perf_freq_ms;
 }
 
+/**
+ * Same clock as get_perf_counter_ms(), without the rounding of a double.
+ */
+uint64_t get_perf_counter_ns() {
+    assert(g_platform_init);
+    LARGE_INTEGER sys_perf_counter;
+    QueryPerformanceCounter(&sys_perf_counter);
+    // Whole seconds and the remainder apart, ticks * 10^9 would overflow after a few hours
+    const uint64_t ticks = static_cast<uint64_t>(sys_perf_counter.QuadPart);
+    return ticks / g_sys_perf_freq * 1000000000 + ticks % g_sys_perf_freq * 1000000000 / g_sys_perf_freq;
+}
+
+/**
+ * Sleep for about the given time, give or take get_sleep_granularity_ms(). Use spin_pause()
+ * for the last stretch when a deadline must be hit closer than that.
+ */
 void sleep(double milliseconds) {
+    if (milliseconds <= 0.0) {
+        return;
+    }
+
+    HANDLE timer = t_sleep_timer.get();
+    if (timer) {
+        // Negative due times are relative, in 100 ns units
+        LARGE_INTEGER due_time;
+        due_time.QuadPart = -static_cast<LONGLONG>(milliseconds * 10000.0);
+        if (SetWaitableTimer(timer, &due_time, 0, nullptr, nullptr, FALSE)) {
+            WaitForSingleObject(timer, INFINITE);
+            return;
+        }
+    }
+
     Sleep(static_cast<DWORD>(milliseconds));
 }
 
-#endif // _WIN32
\ No newline at end of file
+/**
+ * How late sleep() may wake up.
+ */
+double get_sleep_granularity_ms() {
+    assert(g_platform_init);
+    return g_sleep_granularity_ms;
+}
+
+/**
+ * Body of a busy wait loop, tells the core it is spinning.
+ */
+void spin_pause() {
+    YieldProcessor();
+}
+
+/**
+ * Move src_path over dst_path, replacing it. Readers see either the old or the new file.
+ */
+bool replace_file(char const* src_path, char const* dst_path) {
+    if (!MoveFileExA(src_path, dst_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        log_error("Unable to replace %s (error %lu)\n", dst_path, GetLastError());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Map a file for reading. Empty files can't be mapped and fail.
+ */
+bool map_file(char const* path, Mapped_File* file) {
+    assert(path && file);
+    *file = {};
+
+    file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file->file == INVALID_HANDLE_VALUE) {
+        file->file = nullptr;
+        log_error("Unable to open %s (error %lu)\n", path, GetLastError());
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->file, &size) || size.QuadPart == 0) {
+        log_error("Unable to map %s, empty or unreadable\n", path);
+        unmap_file(file);
+        return false;
+    }
+    file->size = static_cast<size_t>(size.QuadPart);
+
+    file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file->mapping) {
+        log_error("Unable to map %s (error %lu)\n", path, GetLastError());
+        unmap_file(file);
+        return false;
+    }
+
+    file->data = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!file->data) {
+        log_error("Unable to map %s (error %lu)\n", path, GetLastError());
+        unmap_file(file);
+        return false;
+    }
+
+    return true;
+}
+
+void unmap_file(Mapped_File* file) {
+    if (file->data) {
+        UnmapViewOfFile(file->data);
+    }
+    if (file->mapping) {
+        CloseHandle(file->mapping);
+    }
+    if (file->file) {
+        CloseHandle(file->file);
+    }
+    *file = {};
+}
+
+#elif defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool g_platform_init = false;
+static double g_sleep_granularity_ms = 1.0;
+static volatile std::sig_atomic_t g_user_signal = 0;
+
+int process_window_messages(Window const& window) {
+    (void)window;
+    return 0;
+}
+
+/**
+ * Make SIGUSR1 a request polled with take_user_signal() instead of ending the process. Stands
+ * in for keyboard input, there is no window to receive it.
+ */
+void watch_user_signal() {
+    std::signal(SIGUSR1, [](int) { g_user_signal = 1; });
+}
+
+/**
+ * \return Whether SIGUSR1 was received since the last call.
+ */
+bool take_user_signal() {
+    if (!g_user_signal) {
+        return false;
+    }
+    g_user_signal = 0;
+    return true;
+}
+
+void init_platform() {
+    // Timers may otherwise fire up to the default 50 us slack late. Threads started after
+    // this inherit it.
+    if (prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) == 0) {
+        g_sleep_granularity_ms = 0.1;
+    }
+    else {
+        g_sleep_granularity_ms = 0.5;
+    }
+
+    g_platform_init = true;
+}
+
+double get_perf_counter_ms() {
+    assert(g_platform_init);
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<double>(now.tv_sec) * 1000.0 + static_cast<double>(now.tv_nsec) / 1000000.0;
+}
+
+/**
+ * Same clock as get_perf_counter_ms(), without the rounding of a double.
+ */
+uint64_t get_perf_counter_ns() {
+    assert(g_platform_init);
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + static_cast<uint64_t>(now.tv_nsec);
+}
+
+/**
+ * Sleep for about the given time, give or take get_sleep_granularity_ms(). Use spin_pause()
+ * for the last stretch when a deadline must be hit closer than that.
+ */
+void sleep(double milliseconds) {
+    if (milliseconds <= 0.0) {
+        return;
+    }
+
+    // Absolute, so signals interrupting the wait don't stretch it
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    const long long nanoseconds = static_cast<long long>(milliseconds * 1000000.0);
+    deadline.tv_sec += static_cast<time_t>(nanoseconds / 1000000000);
+    deadline.tv_nsec += static_cast<long>(nanoseconds % 1000000000);
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_nsec -= 1000000000;
+        ++deadline.tv_sec;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+    }
+}
+
+/**
+ * How late sleep() may wake up.
+ */
+double get_sleep_granularity_ms() {
+    assert(g_platform_init);
+    return g_sleep_granularity_ms;
+}
+
+/**
+ * Body of a busy wait loop, tells the core it is spinning.
+ */
+void spin_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * Move src_path over dst_path, replacing it. Readers see either the old or the new file.
+ */
+bool replace_file(char const* src_path, char const* dst_path) {
+    // Flush first, as MOVEFILE_WRITE_THROUGH does, or a crash can leave an empty file behind
+    const int fd = open(src_path, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    if (rename(src_path, dst_path) != 0) {
+        log_error("Unable to replace %s (errno %d)\n", dst_path, errno);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Map a file for reading. Empty files can't be mapped and fail.
+ */
+bool map_file(char const* path, Mapped_File* file) {
+    assert(path && file);
+    *file = {};
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_error("Unable to open %s (errno %d)\n", path, errno);
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        log_error("Unable to map %s, empty or unreadable\n", path);
+        close(fd);
+        return false;
+    }
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+
+    // The mapping keeps the file open
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_error("Unable to map %s (errno %d)\n", path, errno);
+        return false;
+    }
+
+    file->data = data;
+    file->size = size;
+    return true;
+}
+
+void unmap_file(Mapped_File* file) {
+    if (file->data) {
+        munmap(const_cast<void*>(file->data), file->size);
+    }
+    *file = {};
+}
+
+#endif // __linux__
\ No newline at end of file
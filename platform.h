@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 
 struct Rect
@@ -31,17 +32,92 @@ void log_error(char const* format, Args... args)
     OutputDebugStringA(buf);
 }
 
+template<typename... Args>
+void log_info(char const* format, Args... args)
+{
+    constexpr size_t buf_size = 1024;
+    char buf[buf_size];
+    snprintf(buf, buf_size, format, args...);
+    OutputDebugStringA(buf);
+}
+
 LRESULT CALLBACK window_proc_callback(HWND hwnd, UINT msg, WPARAM w_param, LPARAM l_param);
 
 using Destroy_Callback = void (*)();
-Window create_window(const Rect& window_rect, Destroy_Callback destroy_callback);
+using Resize_Callback = void (*)(int width, int height); //!< Client area size, 0 when minimized
+using Key_Callback = void (*)(uint32_t virtual_key);     //!< Key pressed, VK_* code
+Window create_window(const Rect& window_rect, Destroy_Callback destroy_callback,
+    Resize_Callback resize_callback = nullptr, Key_Callback key_callback = nullptr);
 
 int process_window_messages(Window const& window);
 
+/**
+ * Read-only view of a whole file.
+ */
+struct Mapped_File
+{
+    void const* data;
+    size_t size;
+    HANDLE file;
+    HANDLE mapping;
+};
+
+#elif defined(__linux__)
+
+/**
+ * There is no window system support, only headless rendering. Exists so code pumping
+ * messages doesn't need to know.
+ */
+struct Window
+{
+};
+
+template<typename... Args>
+void log_error(char const* format, Args... args)
+{
+    constexpr size_t buf_size = 1024;
+    char buf[buf_size];
+    snprintf(buf, buf_size, format, args...);
+    fputs(buf, stderr);
+}
+
+template<typename... Args>
+void log_info(char const* format, Args... args)
+{
+    constexpr size_t buf_size = 1024;
+    char buf[buf_size];
+    snprintf(buf, buf_size, format, args...);
+    fputs(buf, stdout);
+}
+
+int process_window_messages(Window const& window);
+
+void watch_user_signal();
+bool take_user_signal();
+
+/**
+ * Read-only view of a whole file.
+ */
+struct Mapped_File
+{
+    void const* data;
+    size_t size;
+};
+
+#else
+#   error Unsupported platform
+#endif
+
 void init_platform();
 
 double get_perf_counter_ms();
+uint64_t get_perf_counter_ns();
 
 void sleep(double milliseconds);
+double get_sleep_granularity_ms();
+void spin_pause();
+
+bool replace_file(char const* src_path, char const* dst_path);
 
-#endif // _WIN32
\ No newline at end of file
+bool map_file(char const* path, Mapped_File* file);
+void unmap_file(Mapped_File* file);
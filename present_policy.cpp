@@ -0,0 +1,112 @@
+#include "present_policy.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+    static constexpr uint32_t max_preferences = 4;
+
+    /**
+     * Present modes of each profile, most preferred first. Each list ends in FIFO, which every
+     * surface supports.
+     */
+    struct Present_Preferences {
+        Present_Profile profile;
+        char const* name;
+        VkPresentModeKHR modes[max_preferences];
+        uint32_t num_modes;
+    };
+
+    Present_Preferences const present_preferences[] = {
+        { Present_Profile::Vsync, "vsync",
+            { VK_PRESENT_MODE_FIFO_KHR }, 1 },
+        { Present_Profile::Adaptive, "adaptive",
+            { VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR }, 2 },
+        // Immediate has lower latency than FIFO still, at the cost of tearing
+        { Present_Profile::Low_Latency, "low-latency",
+            { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+              VK_PRESENT_MODE_FIFO_KHR }, 4 },
+        { Present_Profile::Uncapped, "uncapped",
+            { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+              VK_PRESENT_MODE_FIFO_KHR }, 4 },
+    };
+
+    Present_Preferences const& find_preferences(Present_Profile profile) {
+        for (Present_Preferences const& preferences : present_preferences) {
+            if (preferences.profile == profile) {
+                return preferences;
+            }
+        }
+        assert(!"Unknown present profile");
+        return present_preferences[0];
+    }
+}
+
+char const* present_profile_name(Present_Profile profile) {
+    return find_preferences(profile).name;
+}
+
+/**
+ * \param name As returned by present_profile_name().
+ */
+bool parse_present_profile(char const* name, Present_Profile* profile) {
+    assert(name && profile);
+    for (Present_Preferences const& preferences : present_preferences) {
+        if (strcmp(preferences.name, name) == 0) {
+            *profile = preferences.profile;
+            return true;
+        }
+    }
+    return false;
+}
+
+char const* present_mode_name(VkPresentModeKHR mode) {
+    switch (mode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:    return "IMMEDIATE";
+    case VK_PRESENT_MODE_MAILBOX_KHR:      return "MAILBOX";
+    case VK_PRESENT_MODE_FIFO_KHR:         return "FIFO";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+    default:                               return "unknown";
+    }
+}
+
+/**
+ * First mode of the profile's preferences the surface supports.
+ */
+VkPresentModeKHR choose_present_mode(Present_Profile profile, VkPresentModeKHR const* supported_modes,
+    uint32_t num_supported_modes)
+{
+    Present_Preferences const& preferences = find_preferences(profile);
+    for (uint32_t i = 0; i < preferences.num_modes; ++i) {
+        VkPresentModeKHR const* end = supported_modes + num_supported_modes;
+        if (std::find(supported_modes, end, preferences.modes[i]) != end) {
+            return preferences.modes[i];
+        }
+    }
+
+    // FIFO is required by the spec
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+/**
+ * Enough images for the CPU to never wait on presentation while it has a frame slot free: one
+ * being shown plus one per frame in flight. Mailbox holds one more, the queued frame it
+ * replaces. More images than that only add queued frames, and with them latency.
+ */
+uint32_t choose_swapchain_image_count(VkPresentModeKHR mode, uint32_t frames_in_flight,
+    VkSurfaceCapabilitiesKHR const& capabilities)
+{
+    assert(frames_in_flight > 0);
+    uint32_t num_images = frames_in_flight + 1;
+    if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+        ++num_images;
+    }
+
+    num_images = std::max(num_images, capabilities.minImageCount);
+    // 0 means no limit
+    if (capabilities.maxImageCount > 0) {
+        num_images = std::min(num_images, capabilities.maxImageCount);
+    }
+    return num_images;
+}
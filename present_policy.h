@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+/**
+ * What presentation should favour, mapped to a present mode supported by the surface.
+ */
+enum class Present_Profile : uint8_t {
+    Vsync,       //!< FIFO, every frame shown, never tears. Lowest power
+    Adaptive,    //!< FIFO_RELAXED, vsync but late frames tear instead of waiting a refresh
+    Low_Latency, //!< MAILBOX, newest frame shown at the next refresh, never tears
+    Uncapped,    //!< IMMEDIATE, frames shown as soon as they are done, tears
+};
+
+char const* present_profile_name(Present_Profile profile);
+bool parse_present_profile(char const* name, Present_Profile* profile);
+char const* present_mode_name(VkPresentModeKHR mode);
+
+VkPresentModeKHR choose_present_mode(Present_Profile profile, VkPresentModeKHR const* supported_modes,
+    uint32_t num_supported_modes);
+uint32_t choose_swapchain_image_count(VkPresentModeKHR mode, uint32_t frames_in_flight,
+    VkSurfaceCapabilitiesKHR const& capabilities);
@@ -0,0 +1,184 @@
+#include "render_thread.h"
+
+#include "cpu_profiler.h"
+#include <cassert>
+#include <cstring>
+
+namespace {
+    // Bitwise, matrices built by the same code from the same inputs are equal
+    bool same_matrices(glm::mat4 const* a, glm::mat4 const* b, size_t count) {
+        return count == 0 || memcmp(a, b, count * sizeof(glm::mat4)) == 0;
+    }
+
+    bool same_scene(Vulkan_Instance_Info const& vulkan, Scene_Snapshot const& snapshot) {
+        if (!same_matrices(&vulkan.view, &snapshot.view, 1) || !same_matrices(&vulkan.projection, &snapshot.projection, 1)
+            || vulkan.draw_path != snapshot.draw_path || vulkan.draw_models.size() != snapshot.draw_models.size()
+            || !same_matrices(vulkan.draw_models.data(), snapshot.draw_models.data(), snapshot.draw_models.size()))
+        {
+            return false;
+        }
+        if (snapshot.draw_path != Draw_Path::Instanced) {
+            return true;
+        }
+
+        uint32_t num_instances;
+        Instance_Data const* instances = vulkan.latest_instances(&num_instances);
+        return num_instances == snapshot.instances.size()
+            && (num_instances == 0 || memcmp(instances, snapshot.instances.data(), num_instances * sizeof(Instance_Data)) == 0);
+    }
+}
+
+void Render_Thread::init() {
+    events.init();
+    scene.init();
+}
+
+/**
+ * Start rendering. Publish the first scene before, the renderer's own scene is drawn until
+ * then.
+ *
+ * \param target_fps Frame rate cap, 0 for none.
+ */
+void Render_Thread::start(Vulkan_Instance_Info* vulkan, double target_fps) {
+    assert(vulkan);
+    this->vulkan = vulkan;
+    this->target_fps = target_fps;
+    status = STATUS_OK;
+    window_extent = vulkan->swapchain_extent;
+    num_frames = 0;
+
+    stopping.store(false);
+    running.store(true);
+    thread = std::thread(&Render_Thread::thread_loop, this);
+}
+
+/**
+ * Finish the frame being rendered and join the thread. The renderer belongs to the calling
+ * thread again afterwards.
+ *
+ * \return Error the render thread stopped on, if any.
+ */
+Status Render_Thread::stop() {
+    stopping.store(true, std::memory_order_release);
+    if (thread.joinable()) {
+        thread.join();
+    }
+    pacer.log_stats("Render thread");
+    return status;
+}
+
+/**
+ * Simulation thread only.
+ *
+ * \return false if the queue is full, the event should be pushed again later.
+ */
+bool Render_Thread::push_event(Render_Event const& event) {
+    return events.push(event);
+}
+
+/**
+ * Simulation thread only. Snapshot to fill for publish_scene(), it holds an older scene.
+ */
+Scene_Snapshot& Render_Thread::begin_scene() {
+    return scene.write_buffer();
+}
+
+/**
+ * Simulation thread only. Hand the snapshot from begin_scene() to the render thread, which
+ * draws it from its next frame on.
+ */
+void Render_Thread::publish_scene() {
+    scene.publish();
+}
+
+void Render_Thread::thread_loop() {
+    PROFILE_THREAD_NAME("render");
+    status = render_loop();
+    running.store(false, std::memory_order_release);
+}
+
+Status Render_Thread::render_loop() {
+    pacer.init(target_fps);
+    while (!stopping.load(std::memory_order_acquire)) {
+        Render_Event event;
+        while (events.pop(&event)) {
+            handle_event(event);
+        }
+
+        // Nothing to present to while minimized
+        if (window_extent.width == 0 || window_extent.height == 0) {
+            sleep(1.0);
+            continue;
+        }
+
+        if (scene.acquire()) {
+            STATUS_CHECK(apply_scene(scene.read_buffer()));
+        }
+        else if (!vulkan->prerecord_cmd_bufs && vulkan->draw_path == Draw_Path::Instanced) {
+            // Every frame slot has its own instance region
+            Scene_Snapshot const& snapshot = scene.read_buffer();
+            STATUS_CHECK(vulkan->write_instances(snapshot.instances.data(),
+                static_cast<uint32_t>(snapshot.instances.size())));
+        }
+
+        STATUS_CHECK(vulkan->render());
+        ++num_frames;
+        pacer.end_frame();
+    }
+    return STATUS_OK;
+}
+
+void Render_Thread::handle_event(Render_Event const& event) {
+    switch (event.type) {
+    case Render_Event_Type::Resize:
+        window_extent.width = event.width;
+        window_extent.height = event.height;
+        if (window_extent.width > 0 && window_extent.height > 0) {
+            vulkan->request_swapchain_resize(window_extent.width, window_extent.height);
+        }
+        break;
+    }
+}
+
+/**
+ * Make a new snapshot the renderer's scene.
+ */
+Status Render_Thread::apply_scene(Scene_Snapshot const& snapshot) {
+    // A resize publishes the projection recreate_swapchain() has already set, re-recording the
+    // pre-recorded buffers for an unchanged scene would wait for the GPU
+    if (vulkan->prerecord_cmd_bufs && same_scene(*vulkan, snapshot)) {
+        return STATUS_OK;
+    }
+
+    vulkan->view = snapshot.view;
+    vulkan->projection = snapshot.projection;
+    vulkan->draw_path = snapshot.draw_path;
+    // Keeps the capacity, so steady state snapshots don't allocate
+    vulkan->draw_models.assign(snapshot.draw_models.begin(), snapshot.draw_models.end());
+
+    if (snapshot.draw_path == Draw_Path::Instanced) {
+        STATUS_CHECK(vulkan->write_instances(snapshot.instances.data(),
+            static_cast<uint32_t>(snapshot.instances.size())));
+    }
+
+    // Transforms are baked into pre-recorded command buffers
+    vulkan->mark_cmd_bufs_dirty();
+    return STATUS_OK;
+}
+
+/**
+ * Fill a snapshot with the renderer's current scene.
+ *
+ * NOTE: Only while the renderer is not owned by a running render thread.
+ */
+void copy_scene(Vulkan_Instance_Info const& vulkan, Scene_Snapshot* snapshot) {
+    snapshot->view = vulkan.view;
+    snapshot->projection = vulkan.projection;
+    snapshot->draw_path = vulkan.draw_path;
+    snapshot->draw_models.assign(vulkan.draw_models.begin(), vulkan.draw_models.end());
+
+    // The renderer keeps no copy of its instances, read back the latest ones written
+    uint32_t num_instances;
+    Instance_Data const* instances = vulkan.latest_instances(&num_instances);
+    snapshot->instances.assign(instances, instances + num_instances);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "frame_pacer.h"
+#include "renderer.h"
+#include "spsc_queue.h"
+#include "status.h"
+#include "triple_buffer.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+enum class Render_Event_Type : uint8_t {
+    Resize, //!< The window's client area changed size
+};
+
+/**
+ * Event the render thread must see, unlike scene state no event is skipped.
+ */
+struct Render_Event {
+    Render_Event_Type type;
+    uint32_t width;
+    uint32_t height;
+};
+
+/**
+ * Scene state for one frame, written by the simulation thread.
+ */
+struct Scene_Snapshot {
+    glm::mat4 view;
+    glm::mat4 projection;
+    Draw_Path draw_path;
+    std::vector<glm::mat4> draw_models;     //!< Drawn by the uniform and push constant paths
+    std::vector<Instance_Data> instances;   //!< Drawn by the instanced path
+};
+
+/**
+ * Runs Vulkan_Instance_Info::render() on its own thread, so window message processing and
+ * GPU waits never delay each other.
+ *
+ * The simulation thread hands over the latest scene through a triple buffer and events through
+ * an SPSC queue, neither side ever waits on the other. Between start() and stop() only the
+ * render thread touches the renderer.
+ */
+struct Render_Thread {
+    static constexpr uint32_t event_queue_size = 64;
+
+    Vulkan_Instance_Info* vulkan;
+    std::thread thread;
+
+    Spsc_Queue<Render_Event, event_queue_size> events;
+    Triple_Buffer<Scene_Snapshot> scene;
+
+    double target_fps;         //!< 0 renders as fast as presentation allows
+    std::atomic<bool> stopping;
+    std::atomic<bool> running; //!< Cleared when the thread exits, on error as well
+    Status status;             //!< Result of the thread, valid once running is cleared
+
+    // Render thread only
+    VkExtent2D window_extent;  //!< Size of the latest resize event
+    uint64_t num_frames;
+    Frame_Pacer pacer;
+
+    void init();
+    void start(Vulkan_Instance_Info* vulkan, double target_fps);
+    Status stop();
+
+    bool push_event(Render_Event const& event);
+    Scene_Snapshot& begin_scene();
+    void publish_scene();
+
+    void thread_loop();
+    Status render_loop();
+    void handle_event(Render_Event const& event);
+    Status apply_scene(Scene_Snapshot const& snapshot);
+};
+
+void copy_scene(Vulkan_Instance_Info const& vulkan, Scene_Snapshot* snapshot);
@@ -1,13 +1,81 @@
 #include "renderer.h"
 
+#include "cpu_profiler.h"
 #include "glm/ext/matrix_clip_space.hpp" // glm::perspective
 #include "glm/ext/matrix_transform.hpp" // glm::lookAt
+#include "mesh.h"
 #include "vulkan_cube_data.h"
 #include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <cstring>
+
+namespace {
+    VkResult wait_for_fence(VkDevice device, VkFence fence) {
+        static constexpr uint64_t fence_timeout = 100000000;
+
+        VkResult res;
+        do {
+            res = vkWaitForFences(device, 1, &fence, VK_TRUE, fence_timeout);
+        } while (res == VK_TIMEOUT);
+        return res;
+    }
+
+    /**
+     * Draws recorded by one job of Vulkan_Instance_Info::record_scene_commands_parallel().
+     */
+    struct Record_Range {
+        Vulkan_Instance_Info* vulkan;
+        VkCommandBuffer cmd_buf;
+        VkCommandBufferInheritanceInfo const* inheritance;
+        Scene_Draws const* draws;
+        uint32_t first_draw;
+        uint32_t num_draws;
+        VkResult result;
+    };
+
+    Status move_buffer_fn(void* user_data, void* owner, Device_Allocation const& old_alloc,
+        Device_Allocation const& new_alloc)
+    {
+        (void)old_alloc;
+        return static_cast<Vulkan_Instance_Info*>(user_data)->move_buffer(static_cast<Movable_Buffer*>(owner),
+            new_alloc);
+    }
+
+    void record_range_job(void* data) {
+        PROFILE_ZONE("record range");
+        Record_Range* range = static_cast<Record_Range*>(data);
+        range->result = range->vulkan->record_scene_secondary(range->cmd_buf, *range->inheritance, *range->draws,
+            range->first_draw, range->num_draws);
+    }
+}
+
+char const* draw_path_name(Draw_Path path) {
+    switch (path) {
+    case Draw_Path::Uniform_Dynamic: return "uniform dynamic";
+    case Draw_Path::Push_Constant: return "push constant";
+    case Draw_Path::Instanced: return "instanced";
+    }
+    return "unknown";
+}
+
+/**
+ * Perspective projection of the scene for a framebuffer size, 0 in either uses a square.
+ */
+glm::mat4 scene_projection(uint32_t width, uint32_t height) {
+    const float aspect = width > 0 && height > 0 ? static_cast<float>(width) / height : 1.0f;
+    return glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+}
+
+char const* vertex_format_name(Vertex_Format format) {
+    switch (format) {
+    case Vertex_Format::Packed: return "packed";
+    case Vertex_Format::Float: return "float";
+    }
+    return "unknown";
+}
 
 Status Vulkan_Instance_Info::create_instance() {
+    PROFILE_FUNCTION();
     VkInstanceCreateInfo inst_info = {};
     inst_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     inst_info.pNext = nullptr;
@@ -23,6 +91,7 @@ Status Vulkan_Instance_Info::create_instance() {
 }
 
 Status Vulkan_Instance_Info::setup_primary_physical_device() {
+    PROFILE_FUNCTION();
     uint32_t dev_count = 0;
     VK_CHECK(vkEnumeratePhysicalDevices(instance, &dev_count, nullptr));
     if (dev_count == 0) {
@@ -36,7 +105,7 @@ Status Vulkan_Instance_Info::setup_primary_physical_device() {
     // TODO: be lazy about it and pick the first available device.
     system.primary.device = system.physical_devices[0];
 
-    VkPhysicalDeviceProperties dev_props = {};
+    VkPhysicalDeviceProperties& dev_props = system.primary.properties;
     vkGetPhysicalDeviceProperties(system.primary.device, &dev_props);
     if (dev_props.apiVersion < app_info.apiVersion) {
         log_error("Vulkan version %u.%u not supported by device (max version %u.%u)\n",
@@ -65,8 +134,11 @@ Status Vulkan_Instance_Info::find_graphics_and_present_queue() {
     auto queue_family_props = system.primary.queue_family_properties;
 
     // Query queues that support presenting surfaces
-    std::vector<VkBool32> queue_family_supports_present(queue_family_props.size(), false);
-    for (uint32_t i = 0; i < queue_family_props.size(); ++i) {
+    //
+    // NOTE: Headless nothing is presented, counting every queue as able to makes the
+    // graphics queue double as the present queue.
+    std::vector<VkBool32> queue_family_supports_present(queue_family_props.size(), headless);
+    for (uint32_t i = 0; i < queue_family_props.size() && !headless; ++i) {
         vkGetPhysicalDeviceSurfaceSupportKHR(system.primary.device, i, surface, &queue_family_supports_present[i]);
     }
 
@@ -106,6 +178,7 @@ Status Vulkan_Instance_Info::find_graphics_and_present_queue() {
 }
 
 Status Vulkan_Instance_Info::create_logical_device() {
+    PROFILE_FUNCTION();
     // TODO: setup the present queue (may be the same as the graphics queue)
     float queue_priorities[1] = { 0.0 };
     VkDeviceQueueCreateInfo gr_queue_ci = {};
@@ -128,10 +201,14 @@ Status Vulkan_Instance_Info::create_logical_device() {
     device_info.pEnabledFeatures = nullptr;
 
     VK_CHECK(vkCreateDevice(system.primary.device, &device_info, nullptr, &logical.device));
+    sync_pool.init(logical.device);
+    mem_allocator.init(logical.device, system.primary.memory_properties,
+        system.primary.properties.limits.bufferImageGranularity);
     return STATUS_OK;
 }
 
 Status Vulkan_Instance_Info::setup_device_queue() {
+    PROFILE_FUNCTION();
     vkGetDeviceQueue(logical.device, system.primary.queue.gr_family_index, 0, &gr_queue);
     if (system.primary.queue.gr_family_index == system.primary.queue.present_family_index) {
         present_queue = gr_queue;
@@ -144,6 +221,7 @@ Status Vulkan_Instance_Info::setup_device_queue() {
 }
 
 Status Vulkan_Instance_Info::create_command_pool() {
+    PROFILE_FUNCTION();
     // NOTE: Need one pool for each type of queue being used.
     VkCommandPoolCreateInfo cmd_pool_ci = {};
     cmd_pool_ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -154,19 +232,146 @@ Status Vulkan_Instance_Info::create_command_pool() {
     return STATUS_OK;
 }
 
-Status Vulkan_Instance_Info::create_command_buffer() {
+/**
+ * \param num_frames_in_flight The number of frames the CPU may record ahead of the GPU.
+ */
+Status Vulkan_Instance_Info::setup_frames_in_flight(uint32_t num_frames_in_flight) {
+    PROFILE_FUNCTION();
+    assert(num_frames_in_flight > 0);
+    frames.resize(num_frames_in_flight);
+    current_frame = 0;
+
+    std::vector<VkCommandBuffer> cmd_bufs(num_frames_in_flight);
     VkCommandBufferAllocateInfo gr_cmd_buf_alloc_info = {};
     gr_cmd_buf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     gr_cmd_buf_alloc_info.pNext = nullptr;
     gr_cmd_buf_alloc_info.commandPool = logical.gr_cmd_pool;
     gr_cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    gr_cmd_buf_alloc_info.commandBufferCount = 1;
-    VK_CHECK(vkAllocateCommandBuffers(logical.device, &gr_cmd_buf_alloc_info, &logical.gr_cmd_buf));
+    gr_cmd_buf_alloc_info.commandBufferCount = num_frames_in_flight;
+    VK_CHECK(vkAllocateCommandBuffers(logical.device, &gr_cmd_buf_alloc_info, cmd_bufs.data()));
+
+    for (uint32_t i = 0; i < num_frames_in_flight; ++i) {
+        frames[i].cmd_buf = cmd_bufs[i];
+        frames[i].timestamp_cmd_buf = VK_NULL_HANDLE;
+        frames[i].submitted = false;
+        frames[i].frame_number = 0;
+        STATUS_CHECK(sync_pool.acquire_fence(&frames[i].in_flight_fence));
+    }
+
+    return STATUS_OK;
+}
+
+/**
+ * \param staging_size Size of the host visible ring uploads are staged through.
+ */
+Status Vulkan_Instance_Info::setup_upload_service(VkDeviceSize staging_size) {
+    PROFILE_FUNCTION();
+    STATUS_CHECK(uploader.init(logical.device, gr_queue, system.primary.queue.gr_family_index,
+        system.primary.properties.limits, &mem_allocator, &sync_pool, staging_size));
     return STATUS_OK;
 }
 
+/**
+ * \param path Cache file kept between runs.
+ */
+Status Vulkan_Instance_Info::setup_pipeline_cache(char const* path) {
+	PROFILE_FUNCTION();
+	// Periodic saves keep pipelines created after startup if the process is killed
+	constexpr double save_interval_ms = 30000.0;
+	STATUS_CHECK(pipeline_cache.init(logical.device, system.primary.properties, path, save_interval_ms));
+	return STATUS_OK;
+}
+
+/**
+ * \param num_compile_threads Workers creating pipelines in the background.
+ *
+ * NOTE: Needs setup_pipeline_cache().
+ */
+Status Vulkan_Instance_Info::setup_pipeline_manager(uint32_t num_compile_threads) {
+	PROFILE_FUNCTION();
+	thread_pool.init(num_compile_threads);
+	pipelines.init(logical.device, &pipeline_cache, &thread_pool);
+	pipelines_completed = 0;
+	return STATUS_OK;
+}
+
+/**
+ * Record per-frame draws as jobs, see record_scene_commands_parallel().
+ *
+ * \param job_system Runs the recording jobs, one secondary command buffer per thread it has.
+ *
+ * NOTE: Needs the frames in flight, see setup_frames_in_flight().
+ */
+Status Vulkan_Instance_Info::setup_parallel_recording(Job_System* job_system) {
+	PROFILE_FUNCTION();
+	assert(job_system && !frames.empty());
+	jobs = job_system;
+	const uint32_t num_record_threads = jobs->num_threads();
+
+	// Pools are reset as a whole once the frame slot retires, never per buffer
+	VkCommandPoolCreateInfo cmd_pool_ci = {};
+	cmd_pool_ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmd_pool_ci.pNext = nullptr;
+	cmd_pool_ci.queueFamilyIndex = system.primary.queue.gr_family_index;
+	cmd_pool_ci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (Frame_Data& frame : frames) {
+		frame.record_pools.resize(num_record_threads);
+		frame.record_cmd_bufs.resize(num_record_threads);
+		for (uint32_t i = 0; i < num_record_threads; ++i) {
+			VK_CHECK(vkCreateCommandPool(logical.device, &cmd_pool_ci, nullptr, &frame.record_pools[i]));
+
+			VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+			cmd_buf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cmd_buf_alloc_info.pNext = nullptr;
+			cmd_buf_alloc_info.commandPool = frame.record_pools[i];
+			cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			cmd_buf_alloc_info.commandBufferCount = 1;
+			VK_CHECK(vkAllocateCommandBuffers(logical.device, &cmd_buf_alloc_info, &frame.record_cmd_bufs[i]));
+		}
+	}
+
+	parallel_recording = true;
+	max_record_ranges = 0;
+	return STATUS_OK;
+}
+
+/**
+ * Time the GPU work of each frame, see Gpu_Profiler.
+ *
+ * NOTE: Needs the frames in flight, see setup_frames_in_flight().
+ */
+Status Vulkan_Instance_Info::setup_gpu_profiler() {
+	PROFILE_FUNCTION();
+	assert(!frames.empty());
+	const uint32_t num_frames = static_cast<uint32_t>(frames.size());
+
+	// Pre-recorded command buffers can't reset queries of the frame slot they run in, the frame
+	// slot's own buffer resets them before and a second one ends the frame scope after
+	std::vector<VkCommandBuffer> cmd_bufs(num_frames);
+	VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+	cmd_buf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmd_buf_alloc_info.pNext = nullptr;
+	cmd_buf_alloc_info.commandPool = logical.gr_cmd_pool;
+	cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmd_buf_alloc_info.commandBufferCount = num_frames;
+	VK_CHECK(vkAllocateCommandBuffers(logical.device, &cmd_buf_alloc_info, cmd_bufs.data()));
+	for (uint32_t i = 0; i < num_frames; ++i) {
+		frames[i].timestamp_cmd_buf = cmd_bufs[i];
+	}
+
+	// Timestamps only mean something on the queue that wrote them
+	VkQueueFamilyProperties const& gr_family
+		= system.primary.queue_family_properties[system.primary.queue.gr_family_index];
+	constexpr double log_interval_ms = 10000.0;
+	STATUS_CHECK(gpu_profiler.init(logical.device, system.primary.properties.limits.timestampPeriod,
+		gr_family.timestampValidBits, num_frames, log_interval_ms));
+	return STATUS_OK;
+}
+
 #ifdef _WIN32
 Status Vulkan_Instance_Info::create_surface(Window const& window) {
+    PROFILE_FUNCTION();
     VkWin32SurfaceCreateInfoKHR surface_ci = {};
     surface_ci.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
     surface_ci.pNext = nullptr;
@@ -175,15 +380,37 @@ Status Vulkan_Instance_Info::create_surface(Window const& window) {
     VK_CHECK(vkCreateWin32SurfaceKHR(instance, &surface_ci, nullptr, &surface));
     return STATUS_OK;
 }
-#else
-#   error Unsupported platform
 #endif
 
 /**
- * \param num_buf_frames The number of frames in the buffering strategy.
- *  Clipped to the lowest supported number of frames.
+ * \param profile Chooses the present mode, falling back to others when the surface lacks it.
+ * \param image_width Used if the surface leaves the size to the swapchain, as does
+ *  image_height.
+ *
+ * NOTE: Needs the frames in flight, see setup_frames_in_flight().
+ */
+Status Vulkan_Instance_Info::setup_swapchain(Present_Profile profile, uint32_t image_width, uint32_t image_height) {
+    PROFILE_FUNCTION();
+    present_profile = profile;
+    requested_extent.width = image_width;
+    requested_extent.height = image_height;
+    swapchain = VK_NULL_HANDLE;
+    swapchain_dirty = false;
+    num_submitted_frames = 0;
+    num_completed_frames = 0;
+
+    present_stats.acquire_wait.reset();
+    present_stats.acquire_to_present.reset();
+
+    return create_swapchain();
+}
+
+/**
+ * Create a swapchain for the surface's current size. An existing swapchain is passed as the
+ * old swapchain so the driver can reuse its resources, the caller must have retired it.
  */
-Status Vulkan_Instance_Info::setup_swapchain(uint32_t num_buf_frames, uint32_t image_width, uint32_t image_height) {
+Status Vulkan_Instance_Info::create_swapchain() {
+    PROFILE_FUNCTION();
     // Get surface format support
     //
     uint32_t format_count = 0;
@@ -192,14 +419,23 @@ Status Vulkan_Instance_Info::setup_swapchain(uint32_t num_buf_frames, uint32_t i
     VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(system.primary.device, surface, &format_count, surface_formats.data()));
 
     // If format list contains a single entry of VK_FORMAT_UNDEFINED, the surface has no perferred format.
+    VkFormat surface_format;
     if (format_count == 1 && surface_formats[0].format == VK_FORMAT_UNDEFINED) {
-        swapchain_format = VK_FORMAT_B8G8R8A8_UNORM;
+        surface_format = VK_FORMAT_B8G8R8A8_UNORM;
     }
     else {
         assert(format_count >= 1);
-        swapchain_format = surface_formats[0].format;
+        surface_format = surface_formats[0].format;
     }
 
+    // The render pass and pipelines are built for the first swapchain's format
+    if (swapchain != VK_NULL_HANDLE && surface_format != swapchain_format) {
+        log_error("Surface format changed from %d to %d, the swapchain can't be recreated\n",
+            swapchain_format, surface_format);
+        return !STATUS_OK;
+    }
+    swapchain_format = surface_format;
+
     // Get surface capabilities
     //
     VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(system.primary.device, surface, &surface_capabilities));
@@ -219,8 +455,7 @@ Status Vulkan_Instance_Info::setup_swapchain(uint32_t num_buf_frames, uint32_t i
         assert(surface_capabilities.currentExtent.height == undefined_extent);
 
         // If undefined, set to the requested image size
-        swapchain_extent.width = image_width;
-        swapchain_extent.height = image_height;
+        swapchain_extent = requested_extent;
 
         // Clip to supported width
         if (swapchain_extent.width < surface_capabilities.minImageExtent.width) {
@@ -243,13 +478,15 @@ Status Vulkan_Instance_Info::setup_swapchain(uint32_t num_buf_frames, uint32_t i
         swapchain_extent = surface_capabilities.currentExtent;
     }
 
-    // FIFO present mode is guaranteed by the spec to be supported
+    // Choose the present mode
     //
-    VkPresentModeKHR swapchain_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    present_mode = choose_present_mode(present_profile, surface_present_modes.data(), surface_present_mode_count);
 
     // Determine the number of vkImages to use in the swap chain
     //
-    uint32_t desired_num_swapchain_images = std::max(num_buf_frames, surface_capabilities.minImageCount);
+    assert(!frames.empty());
+    const uint32_t desired_num_swapchain_images = choose_swapchain_image_count(present_mode,
+        static_cast<uint32_t>(frames.size()), surface_capabilities);
 
     // DOC(sdryds):
     //
@@ -293,8 +530,8 @@ Status Vulkan_Instance_Info::setup_swapchain(uint32_t num_buf_frames, uint32_t i
     swapchain_ci.preTransform = surface_pre_transform;
     swapchain_ci.compositeAlpha = composite_alpha;
     swapchain_ci.imageArrayLayers = 1;
-    swapchain_ci.presentMode = swapchain_present_mode;
-    swapchain_ci.oldSwapchain = VK_NULL_HANDLE;
+    swapchain_ci.presentMode = present_mode;
+    swapchain_ci.oldSwapchain = swapchain;
     swapchain_ci.clipped = VK_TRUE;
     swapchain_ci.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
     swapchain_ci.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
@@ -331,6 +568,18 @@ Status Vulkan_Instance_Info::setup_swapchain(uint32_t num_buf_frames, uint32_t i
         swapchain_buffers[i].image = swapchain_images[i];
     }
 
+    // No frame slot owns any of the images yet
+    images_in_flight.assign(swapchain_image_count, VK_NULL_HANDLE);
+
+    log_info("Swapchain: %ux%u, %s profile, %s, %u images\n", swapchain_extent.width, swapchain_extent.height,
+        present_profile_name(present_profile), present_mode_name(present_mode), swapchain_image_count);
+
+    // NOTE: Render finished semaphores are per image rather than per frame slot. Presentation
+    // has no fence, but once an image is acquired again its previous present has completed.
+    for (uint32_t i = 0; i < swapchain_image_count; ++i) {
+        STATUS_CHECK(sync_pool.acquire_semaphore(&swapchain_buffers[i].render_finished_sema));
+    }
+
     // Create image views for each swapchain image
     //
     for (uint32_t i = 0; i < swapchain_image_count; ++i) {
@@ -357,27 +606,404 @@ Status Vulkan_Instance_Info::setup_swapchain(uint32_t num_buf_frames, uint32_t i
     return STATUS_OK;
 }
 
-bool Vulkan_Instance_Info::memory_type_from_properties(uint32_t type_bits, VkFlags requirements_mask, uint32_t * type_index) {
-    // Seach memory types and find the first index with desired properties
-    for (uint32_t i = 0; i < system.primary.memory_properties.memoryTypeCount; ++i) {
-        if ((type_bits & 1) == 1) {
-            // Type is available
-
-            if ((system.primary.memory_properties.memoryTypes[i].propertyFlags & requirements_mask) == requirements_mask) {
-                *type_index = i;
-                return true;
-            }
+/**
+ * Render to images of our own instead of a swapchain, for hosts without a display. One image
+ * per frame in flight, used in turn, so rendering never waits for an image. Images end up in
+ * VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ready to be read back.
+ *
+ * NOTE: Needs the frames in flight, see setup_frames_in_flight().
+ */
+Status Vulkan_Instance_Info::setup_offscreen_target(uint32_t image_width, uint32_t image_height) {
+    PROFILE_FUNCTION();
+    assert(headless && !frames.empty());
+    assert(image_width > 0 && image_height > 0);
+
+    swapchain = VK_NULL_HANDLE;
+    swapchain_dirty = false;
+    num_submitted_frames = 0;
+    num_completed_frames = 0;
+    present_stats.acquire_wait.reset();
+    present_stats.acquire_to_present.reset();
+
+    // Required to support color attachment use on every implementation
+    swapchain_format = VK_FORMAT_R8G8B8A8_UNORM;
+    swapchain_extent.width = image_width;
+    swapchain_extent.height = image_height;
+
+    const uint32_t image_count = static_cast<uint32_t>(frames.size());
+    swapchain_buffers.resize(image_count);
+    for (uint32_t i = 0; i < image_count; ++i) {
+        Swapchain_Buffer& buf = swapchain_buffers[i];
+        buf.render_finished_sema = VK_NULL_HANDLE;
+
+        VkImageCreateInfo image_ci = {};
+        image_ci.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_ci.pNext = nullptr;
+        image_ci.imageType = VK_IMAGE_TYPE_2D;
+        image_ci.format = swapchain_format;
+        image_ci.extent.width = image_width;
+        image_ci.extent.height = image_height;
+        image_ci.extent.depth = 1;
+        image_ci.mipLevels = 1;
+        image_ci.arrayLayers = 1;
+        image_ci.samples = num_samples;
+        image_ci.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_ci.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_ci.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        image_ci.queueFamilyIndexCount = 0;
+        image_ci.pQueueFamilyIndices = nullptr;
+        image_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_ci.flags = 0;
+        VK_CHECK(vkCreateImage(logical.device, &image_ci, nullptr, &buf.image));
+        STATUS_CHECK(allocate_image_memory(buf.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buf.alloc));
+
+        VkImageViewCreateInfo view_ci = {};
+        view_ci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_ci.pNext = nullptr;
+        view_ci.image = buf.image;
+        view_ci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_ci.format = swapchain_format;
+        view_ci.components.r = VK_COMPONENT_SWIZZLE_R;
+        view_ci.components.g = VK_COMPONENT_SWIZZLE_G;
+        view_ci.components.b = VK_COMPONENT_SWIZZLE_B;
+        view_ci.components.a = VK_COMPONENT_SWIZZLE_A;
+        view_ci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        view_ci.subresourceRange.baseMipLevel = 0;
+        view_ci.subresourceRange.levelCount = 1;
+        view_ci.subresourceRange.baseArrayLayer = 0;
+        view_ci.subresourceRange.layerCount = 1;
+        view_ci.flags = 0;
+        VK_CHECK(vkCreateImageView(logical.device, &view_ci, nullptr, &buf.view));
+    }
+    images_in_flight.assign(image_count, VK_NULL_HANDLE);
+
+    log_info("Offscreen target: %ux%u, %u images\n", image_width, image_height, image_count);
+    return STATUS_OK;
+}
+
+/**
+ * Have the swapchain recreated at the start of the next frame.
+ *
+ * \param width New client area size, only used if the surface leaves the size to the
+ *  swapchain. As is height.
+ */
+void Vulkan_Instance_Info::request_swapchain_resize(uint32_t width, uint32_t height) {
+    requested_extent.width = width;
+    requested_extent.height = height;
+    swapchain_dirty = true;
+}
+
+/**
+ * Replace the swapchain and the resources sized to it (image views, depth buffer,
+ * framebuffers, pre-recorded command buffers) without waiting for the GPU. The old ones are
+ * retired, in-flight frames keep using them until release_retired_swapchains() finds those
+ * frames complete.
+ *
+ * \param recreated Set to false if the surface has no area (minimized), the swapchain is
+ *  left as is and stays dirty.
+ */
+Status Vulkan_Instance_Info::recreate_swapchain(bool* recreated) {
+    PROFILE_FUNCTION();
+    assert(recreated && !headless);
+    *recreated = false;
+
+    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(system.primary.device, surface, &surface_capabilities));
+    if (surface_capabilities.currentExtent.width == 0 || surface_capabilities.currentExtent.height == 0) {
+        return STATUS_OK;
+    }
+
+    Retired_Swapchain retired;
+    retired.swapchain = swapchain;
+    retired.buffers = std::move(swapchain_buffers);
+    retired.framebuffers = std::move(framebuffers);
+    retired.depth_buf = depth_buf;
+    retired.image_cmd_bufs = std::move(image_cmd_bufs);
+    retired.last_frame = num_submitted_frames;
+    retired_swapchains.push_back(std::move(retired));
+    swapchain_buffers.clear();
+    framebuffers.clear();
+    image_cmd_bufs.clear();
+
+    STATUS_CHECK(create_swapchain());
+    STATUS_CHECK(setup_depth_buffer());
+    STATUS_CHECK(setup_framebuffer());
+
+    // The old swapchain only ever gets presented what was already acquired from it. Pre-recorded
+    // command buffers are recorded afresh for the new framebuffers, with the new aspect ratio.
+    //
+    // NOTE: The render pass, pipelines (dynamic viewport and scissor) and everything else
+    // don't depend on the size and are kept.
+    projection = scene_projection(swapchain_extent.width, swapchain_extent.height);
+    swapchain_dirty = false;
+    *recreated = true;
+    return STATUS_OK;
+}
+
+/**
+ * Wait until every frame up to frame_number has completed, frame slots submitted later are
+ * not waited on.
+ */
+Status Vulkan_Instance_Info::wait_for_frame(uint64_t frame_number) {
+    if (frame_number <= num_completed_frames) {
+        return STATUS_OK;
+    }
+
+    // A slot's earlier frames completed before it was reused
+    for (Frame_Data& frame : frames) {
+        if (frame.submitted && frame.frame_number > num_completed_frames && frame.frame_number <= frame_number) {
+            VK_CHECK(wait_for_fence(logical.device, frame.in_flight_fence));
         }
+    }
+    return STATUS_OK;
+}
 
-        type_bits >>= 1;
+/**
+ * Destroy retired swapchains whose frames have all completed.
+ */
+void Vulkan_Instance_Info::release_retired_swapchains() {
+    size_t num_kept = 0;
+    for (size_t i = 0; i < retired_swapchains.size(); ++i) {
+        if (retired_swapchains[i].last_frame <= num_completed_frames) {
+            destroy_swapchain_resources(retired_swapchains[i]);
+        }
+        else {
+            retired_swapchains[num_kept++] = std::move(retired_swapchains[i]);
+        }
     }
+    retired_swapchains.resize(num_kept);
+}
 
-    // No matches
-    return false;
+void Vulkan_Instance_Info::destroy_swapchain_resources(Retired_Swapchain& retired) {
+    if (!retired.image_cmd_bufs.empty()) {
+        vkFreeCommandBuffers(logical.device, logical.gr_cmd_pool,
+            static_cast<uint32_t>(retired.image_cmd_bufs.size()), retired.image_cmd_bufs.data());
+    }
+    for (VkFramebuffer framebuffer : retired.framebuffers) {
+        vkDestroyFramebuffer(logical.device, framebuffer, nullptr);
+    }
+
+    vkDestroyImageView(logical.device, retired.depth_buf.view, nullptr);
+    vkDestroyImage(logical.device, retired.depth_buf.image, nullptr);
+    mem_allocator.free(&retired.depth_buf.alloc);
+
+    for (Swapchain_Buffer& buf : retired.buffers) {
+        vkDestroyImageView(logical.device, buf.view, nullptr);
+        if (retired.swapchain == VK_NULL_HANDLE) {
+            // Offscreen target, the images are ours
+            vkDestroyImage(logical.device, buf.image, nullptr);
+            mem_allocator.free(&buf.alloc);
+        }
+        else {
+            sync_pool.release_semaphore(buf.render_finished_sema);
+        }
+    }
+    if (retired.swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(logical.device, retired.swapchain, nullptr);
+    }
+
+    retired.framebuffers.clear();
+    retired.buffers.clear();
+}
+
+bool Vulkan_Instance_Info::memory_type_from_properties(uint32_t type_bits, VkFlags requirements_mask, uint32_t * type_index) {
+    return mem_allocator.find_memory_type(type_bits, requirements_mask, type_index);
+}
+
+/**
+ * Sub-allocate memory for a buffer and bind it.
+ *
+ * \param requirements_mask Required memory property flags.
+ * \param movable Lets defragment_device_memory() move the buffer, null pins it.
+ */
+Status Vulkan_Instance_Info::allocate_buffer_memory(VkBuffer buf, VkFlags requirements_mask, Device_Allocation* alloc,
+    Movable_Buffer* movable)
+{
+    VkMemoryRequirements mem_reqs = {};
+    vkGetBufferMemoryRequirements(logical.device, buf, &mem_reqs);
+
+    uint32_t memory_type = 0;
+    if (!memory_type_from_properties(mem_reqs.memoryTypeBits, requirements_mask, &memory_type)) {
+        log_error("Unable to find suitable memory for buffer\n");
+        return !STATUS_OK;
+    }
+
+    STATUS_CHECK(mem_allocator.allocate(memory_type, mem_reqs, Resource_Kind::Linear, Alloc_Strategy::Free_List,
+        movable, alloc));
+    VK_CHECK(vkBindBufferMemory(logical.device, buf, alloc->mem, alloc->offset));
+    return STATUS_OK;
+}
+
+/**
+ * Sub-allocate memory for an optimal tiled image and bind it.
+ *
+ * \param requirements_mask Required memory property flags.
+ */
+Status Vulkan_Instance_Info::allocate_image_memory(VkImage image, VkFlags requirements_mask, Device_Allocation* alloc) {
+    VkMemoryRequirements mem_reqs = {};
+    vkGetImageMemoryRequirements(logical.device, image, &mem_reqs);
+
+    uint32_t memory_type = 0;
+    if (!memory_type_from_properties(mem_reqs.memoryTypeBits, requirements_mask, &memory_type)) {
+        log_error("Unable to find suitable memory for image\n");
+        return !STATUS_OK;
+    }
+
+    STATUS_CHECK(mem_allocator.allocate(memory_type, mem_reqs, Resource_Kind::Optimal, Alloc_Strategy::Free_List,
+        nullptr, alloc));
+    VK_CHECK(vkBindImageMemory(logical.device, image, alloc->mem, alloc->offset));
+    return STATUS_OK;
+}
+
+/**
+ * Create a DEVICE_LOCAL buffer and queue an upload of its initial contents.
+ *
+ * The data is copied into staging memory before returning. The upload is submitted with the
+ * next frame, ahead of the frame's own commands.
+ *
+ * \param usage Usage of the buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT is added.
+ * \param movable Filled in to let defragment_device_memory() move the buffer, null pins it.
+ */
+Status Vulkan_Instance_Info::create_static_buffer(VkBufferUsageFlags usage, void const* data, VkDeviceSize size,
+    VkBuffer* buf, Device_Allocation* alloc, Movable_Buffer* movable)
+{
+    PROFILE_FUNCTION();
+    assert(buf && alloc);
+
+    VkBufferCreateInfo buf_ci = {};
+    buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buf_ci.pNext = nullptr;
+    buf_ci.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if (movable) {
+        // A move copies the contents on the GPU
+        buf_ci.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    }
+    buf_ci.size = size;
+    buf_ci.queueFamilyIndexCount = 0;
+    buf_ci.pQueueFamilyIndices = nullptr;
+    buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buf_ci.flags = 0;
+    VK_CHECK(vkCreateBuffer(logical.device, &buf_ci, nullptr, buf));
+
+    if (movable) {
+        *movable = { buf, alloc, buf_ci.usage, size };
+    }
+    STATUS_CHECK(allocate_buffer_memory(*buf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, alloc, movable));
+
+    // Consumers of the data, derived from the usage
+    VkPipelineStageFlags dst_stages = 0;
+    VkAccessFlags dst_access = 0;
+    if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) {
+        dst_stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        dst_access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    }
+    if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) {
+        dst_stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        dst_access |= VK_ACCESS_INDEX_READ_BIT;
+    }
+    if (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT) {
+        dst_stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+        dst_access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    }
+    if (usage & (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) {
+        dst_stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dst_access |= VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    }
+    if (dst_stages == 0) {
+        dst_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        dst_access = VK_ACCESS_MEMORY_READ_BIT;
+    }
+
+    STATUS_CHECK(uploader.upload_buffer(*buf, 0, data, size, dst_stages, dst_access));
+    return STATUS_OK;
+}
+
+/**
+ * Compact device memory by moving the movable buffers (vertex, index and instance) out of the
+ * emptiest blocks, then return the blocks left empty to the driver. Other resources are pinned.
+ *
+ * Waits for the device to go idle, for use when resources have been freed rather than per frame.
+ */
+Status Vulkan_Instance_Info::defragment_device_memory() {
+    PROFILE_FUNCTION();
+    // Pending uploads target the buffers as they are now, and frames in flight read them
+    STATUS_CHECK(uploader.flush());
+    VK_CHECK(vkDeviceWaitIdle(logical.device));
+    mem_allocator.log_stats("before defragment");
+    STATUS_CHECK(mem_allocator.defragment(move_buffer_fn, this));
+    mem_allocator.log_stats("after defragment");
+    return STATUS_OK;
+}
+
+/**
+ * Recreate a buffer in new_alloc and copy its contents over. The old buffer is destroyed, the
+ * allocator frees its memory.
+ *
+ * NOTE: The device must be idle, see defragment_device_memory().
+ */
+Status Vulkan_Instance_Info::move_buffer(Movable_Buffer* movable, Device_Allocation const& new_alloc) {
+    assert(movable);
+    Device_Allocation const& old_alloc = *movable->alloc;
+
+    VkBufferCreateInfo buf_ci = {};
+    buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buf_ci.pNext = nullptr;
+    buf_ci.usage = movable->usage;
+    buf_ci.size = movable->size;
+    buf_ci.queueFamilyIndexCount = 0;
+    buf_ci.pQueueFamilyIndices = nullptr;
+    buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buf_ci.flags = 0;
+    VkBuffer new_buf = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateBuffer(logical.device, &buf_ci, nullptr, &new_buf));
+    VK_CHECK(vkBindBufferMemory(logical.device, new_buf, new_alloc.mem, new_alloc.offset));
+
+    if (old_alloc.mapped && new_alloc.mapped) {
+        memcpy(new_alloc.mapped, old_alloc.mapped, static_cast<size_t>(movable->size));
+    }
+    else {
+        // Device local, copy on the GPU and wait, moves are rare
+        VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+        cmd_buf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmd_buf_alloc_info.pNext = nullptr;
+        cmd_buf_alloc_info.commandPool = logical.gr_cmd_pool;
+        cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmd_buf_alloc_info.commandBufferCount = 1;
+        VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+        VK_CHECK(vkAllocateCommandBuffers(logical.device, &cmd_buf_alloc_info, &cmd_buf));
+
+        VK_CHECK(exec_begin_gr_command_buffer(cmd_buf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
+        VkBufferCopy region = {};
+        region.srcOffset = 0;
+        region.dstOffset = 0;
+        region.size = movable->size;
+        vkCmdCopyBuffer(cmd_buf, *movable->buf, new_buf, 1, &region);
+        VK_CHECK(exec_end_gr_command_buffer(cmd_buf));
+
+        VkFence fence = VK_NULL_HANDLE;
+        STATUS_CHECK(sync_pool.acquire_fence(&fence));
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.pNext = nullptr;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &cmd_buf;
+        VK_CHECK(vkQueueSubmit(gr_queue, 1, &submit_info, fence));
+        VK_CHECK(wait_for_fence(logical.device, fence));
+        STATUS_CHECK(sync_pool.release_fence(fence));
+        vkFreeCommandBuffers(logical.device, logical.gr_cmd_pool, 1, &cmd_buf);
+    }
+
+    vkDestroyBuffer(logical.device, *movable->buf, nullptr);
+    *movable->buf = new_buf;
+    *movable->alloc = new_alloc;
+
+    // Recordings bind the old handle
+    mark_cmd_bufs_dirty();
+    return STATUS_OK;
 }
 
 
 Status Vulkan_Instance_Info::setup_depth_buffer() {
+    PROFILE_FUNCTION();
     /*
      * NOTE: Not required to initialize memory. It is handled by the device.
      */
@@ -403,21 +1029,7 @@ Status Vulkan_Instance_Info::setup_depth_buffer() {
     image_ci.flags = 0;
 
     VK_CHECK(vkCreateImage(logical.device, &image_ci, nullptr, &depth_buf.image));
-    VkMemoryRequirements mem_reqs;
-    vkGetImageMemoryRequirements(logical.device, depth_buf.image, &mem_reqs);
-
-    VkMemoryAllocateInfo mem_alloc = {};
-    mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    mem_alloc.pNext = nullptr;
-    mem_alloc.allocationSize = mem_reqs.size;
-    if (!memory_type_from_properties(mem_reqs.memoryTypeBits, 0, &mem_alloc.memoryTypeIndex)) {
-        log_error("Unable to find suitable memory for depth buffer.\n");
-        return !STATUS_OK;
-    }
-
-    VK_CHECK(vkAllocateMemory(logical.device, &mem_alloc, nullptr, &depth_buf.mem));
-
-    VK_CHECK(vkBindImageMemory(logical.device, depth_buf.image, depth_buf.mem, 0));
+    STATUS_CHECK(allocate_image_memory(depth_buf.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depth_buf.alloc));
 
     VkImageViewCreateInfo view_ci = {};
     view_ci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -441,8 +1053,12 @@ Status Vulkan_Instance_Info::setup_depth_buffer() {
     return STATUS_OK;
 }
 
+/**
+ * NOTE: Needs the swapchain or offscreen target, its extent sets the aspect ratio.
+ */
 Status Vulkan_Instance_Info::setup_model_view_projection() {
-    projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    PROFILE_FUNCTION();
+    projection = scene_projection(swapchain_extent.width, swapchain_extent.height);
     view = glm::lookAt(glm::vec3(-5, 3, -10), // camera pos in world space
         glm::vec3(0, 0, 0),    // look at origin
         glm::vec3(0, -1, 0));  // head is up
@@ -456,62 +1072,49 @@ Status Vulkan_Instance_Info::setup_model_view_projection() {
 
     mvp = clip * projection * view * model;
 
+    draw_models.assign(1, model);
+
     return STATUS_OK;
 }
 
-Status Vulkan_Instance_Info::setup_uniform_buffer() {
-    VkBufferCreateInfo buf_ci = {};
-    buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buf_ci.pNext = nullptr;
-    buf_ci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-    buf_ci.size = sizeof(mvp);
-    buf_ci.queueFamilyIndexCount = 0;
-    buf_ci.pQueueFamilyIndices = nullptr;
-    buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    buf_ci.flags = 0;
-    VK_CHECK(vkCreateBuffer(logical.device, &buf_ci, nullptr, &uniform_data.buf));
-
-    VkMemoryRequirements mem_reqs = {};
-    vkGetBufferMemoryRequirements(logical.device, uniform_data.buf, &mem_reqs);
-    VkMemoryAllocateInfo mem_alloc = {};
-    mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    mem_alloc.pNext = nullptr;
-    mem_alloc.memoryTypeIndex = 0;
-    mem_alloc.allocationSize = mem_reqs.size;
-    if (!memory_type_from_properties(mem_reqs.memoryTypeBits,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &mem_alloc.memoryTypeIndex))
-    {
-        log_error("Unable to find suitable memory for uniform buffer\n");
-    }
-
-    VK_CHECK(vkAllocateMemory(logical.device, &mem_alloc, nullptr, &uniform_data.mem));
-
-    // Initialize the uniform buffer
-    //
-    void* data = nullptr;
-    VK_CHECK(vkMapMemory(logical.device, uniform_data.mem, 0, mem_reqs.size, 0, (void**)&data));
-    memcpy(data, &mvp, sizeof(mvp));
-    vkUnmapMemory(logical.device, uniform_data.mem);
+/**
+ * NOTE: Needs the frames in flight, see setup_frames_in_flight().
+ *
+ * \param max_draws_per_frame Number of draws that can each get their own uniform data in a frame.
+ */
+Status Vulkan_Instance_Info::setup_uniform_buffer(uint32_t max_draws_per_frame) {
+    PROFILE_FUNCTION();
+    assert(!frames.empty());
+    assert(max_draws_per_frame > 0);
 
-    VK_CHECK(vkBindBufferMemory(logical.device, uniform_data.buf, uniform_data.mem, 0));
+    const VkDeviceSize draw_stride = std::max<VkDeviceSize>(sizeof(mvp),
+        system.primary.properties.limits.minUniformBufferOffsetAlignment);
+    STATUS_CHECK(uniform_data.ring.init(logical.device, &mem_allocator, system.primary.properties.limits,
+        max_draws_per_frame * draw_stride, static_cast<uint32_t>(frames.size())));
 
     // Record the uniform buffer information
     //
-    uniform_data.buf_info.buffer = uniform_data.buf;
+    // NOTE: The offset is supplied when binding the descriptor set.
+    uniform_data.buf_info.buffer = uniform_data.ring.buf;
     uniform_data.buf_info.offset = 0;
     uniform_data.buf_info.range = sizeof(mvp);
 
+    static_region = 0;
+    for (uint64_t& last_frame : static_region_last_frame) {
+        last_frame = 0;
+    }
+
     return STATUS_OK;
 }
 
 Status Vulkan_Instance_Info::setup_pipeline() {
+    PROFILE_FUNCTION();
     // Descriptor set layouts
     //
     // Layout binding
     VkDescriptorSetLayoutBinding layout_binding = {};
     layout_binding.binding = 0;
-    layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     layout_binding.descriptorCount = 1;
     layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     layout_binding.pImmutableSamplers = nullptr;
@@ -529,8 +1132,16 @@ Status Vulkan_Instance_Info::setup_pipeline() {
     VkPipelineLayoutCreateInfo pipeline_layout_ci = {};
     pipeline_layout_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipeline_layout_ci.pNext = nullptr;
-    pipeline_layout_ci.pushConstantRangeCount = 0;
-    pipeline_layout_ci.pPushConstantRanges = nullptr;
+    // Per-draw transform for the push constant draw path
+    //
+    // NOTE: 64 bytes, well within the guaranteed 128 byte maxPushConstantsSize.
+    VkPushConstantRange push_range = {};
+    push_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_range.offset = 0;
+    push_range.size = sizeof(glm::mat4);
+
+    pipeline_layout_ci.pushConstantRangeCount = 1;
+    pipeline_layout_ci.pPushConstantRanges = &push_range;
     pipeline_layout_ci.setLayoutCount = num_descriptor_sets;
     pipeline_layout_ci.pSetLayouts = desc_set_layouts.data();
 
@@ -539,7 +1150,7 @@ Status Vulkan_Instance_Info::setup_pipeline() {
     // Create descriptor pool
     //
     VkDescriptorPoolSize type_count[1];
-    type_count[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    type_count[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     type_count[0].descriptorCount = 1;
 
     VkDescriptorPoolCreateInfo desc_pool_ci = {};
@@ -571,7 +1182,7 @@ Status Vulkan_Instance_Info::setup_pipeline() {
     writes[0].pNext = nullptr;
     writes[0].dstSet = desc_sets[0];
     writes[0].descriptorCount = 1;
-    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     writes[0].pBufferInfo = &uniform_data.buf_info;
     writes[0].dstArrayElement = 0;
     writes[0].dstBinding = 0;
@@ -581,12 +1192,11 @@ Status Vulkan_Instance_Info::setup_pipeline() {
 }
 
 Status Vulkan_Instance_Info::setup_render_pass() {
+    PROFILE_FUNCTION();
     /*
      * Render pass consists of a collection of attachements, subpasses, and dependencies.
      */
 
-	// TODO: semaphore missing???????
-
     // Attachments
     //
     // One for color and one for depth.
@@ -604,6 +1214,10 @@ Status Vulkan_Instance_Info::setup_render_pass() {
     attachment_descs[color_attachment_index].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachment_descs[color_attachment_index].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;      // Don't care what the start format is
     attachment_descs[color_attachment_index].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;  // Final format should be optimal for presenting
+    if (headless) {
+        // Nothing presents, leave it ready to be copied out
+        attachment_descs[color_attachment_index].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
     attachment_descs[color_attachment_index].flags = 0;
 
 	attachment_descs[depth_attachment_index].format = VK_FORMAT_D16_UNORM;// TODO: should it be swapchain_format?;
@@ -638,6 +1252,22 @@ Status Vulkan_Instance_Info::setup_render_pass() {
     subpass.preserveAttachmentCount = 0;
     subpass.pPreserveAttachments = nullptr;
 
+    // Dependencies
+    //
+    // The image acquired semaphore is waited on at the color attachment output stage, so the
+    // layout transition at the start of the render pass must wait for that stage as well.
+    // The depth buffer is shared between frame slots, so the previous frame's depth writes
+    // must also complete before this frame clears it.
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dependencyFlags = 0;
+
     // Render pass
     //
     VkRenderPassCreateInfo render_pass_ci = {};
@@ -647,42 +1277,19 @@ Status Vulkan_Instance_Info::setup_render_pass() {
     render_pass_ci.pAttachments = attachment_descs;
     render_pass_ci.subpassCount = 1;
     render_pass_ci.pSubpasses = &subpass;
-    render_pass_ci.dependencyCount = 0;
-    render_pass_ci.pDependencies = nullptr;
+    render_pass_ci.dependencyCount = 1;
+    render_pass_ci.pDependencies = &dependency;
     VK_CHECK(vkCreateRenderPass(logical.device, &render_pass_ci, nullptr, &render_pass));
 
     return STATUS_OK;
 }
 
-namespace {
-	Status load_spirv(char const* path, std::vector<uint32_t>* buf) {
-		assert(path);
-		assert(buf);
-
-		std::ifstream f(path, std::ios_base::in | std::ios_base::binary);
-		assert(f.is_open() && !f.fail());
-		
-		f.seekg(0, f.end);
-		const std::streampos byte_length = f.tellg();
-		f.seekg(0, f.beg);
-		
-		buf->clear();
-		buf->resize(static_cast<size_t>(std::ceilf(byte_length / static_cast<float>(sizeof(uint32_t)))), 0U);
-		f.read(reinterpret_cast<char*>(buf->data()), byte_length);
-
-		f.close();
-
-		return STATUS_OK;
-	}
-}
-
+/**
+ * Load the shader modules through the shader cache.
+ */
 Status Vulkan_Instance_Info::setup_shaders() {
-	Status status;
-	VkShaderModuleCreateInfo module_ci = {};
-
-	std::vector<uint32_t> shader_vert_spv;
-	status = load_spirv("simple.vert.spv", &shader_vert_spv);
-	if (status != STATUS_OK) { return status; }
+	PROFILE_FUNCTION();
+	shader_cache.init(logical.device);
 
 	shader_stages_ci[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shader_stages_ci[0].pNext = nullptr;
@@ -690,17 +1297,7 @@ Status Vulkan_Instance_Info::setup_shaders() {
 	shader_stages_ci[0].flags = 0;
 	shader_stages_ci[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
 	shader_stages_ci[0].pName = "main";
-
-	module_ci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	module_ci.pNext = nullptr;
-	module_ci.flags = 0;
-	module_ci.codeSize = shader_vert_spv.size() * sizeof(decltype(shader_vert_spv)::value_type);
-	module_ci.pCode = shader_vert_spv.data();
-	VK_CHECK(vkCreateShaderModule(logical.device, &module_ci, nullptr, &shader_stages_ci[0].module));
-
-	std::vector<uint32_t> shader_frag_spv;
-	status = load_spirv("simple.frag.spv", &shader_frag_spv);
-	if (status != STATUS_OK) { return status; }
+	STATUS_CHECK(shader_cache.load("simple.vert.spv", &shader_stages_ci[0].module));
 
 	shader_stages_ci[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shader_stages_ci[1].pNext = nullptr;
@@ -708,18 +1305,16 @@ Status Vulkan_Instance_Info::setup_shaders() {
 	shader_stages_ci[1].flags = 0;
 	shader_stages_ci[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 	shader_stages_ci[1].pName = "main";
+	STATUS_CHECK(shader_cache.load("simple.frag.spv", &shader_stages_ci[1].module));
 
-	module_ci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	module_ci.pNext = nullptr;
-	module_ci.flags = 0;
-	module_ci.codeSize = shader_frag_spv.size() * sizeof(decltype(shader_frag_spv)::value_type);
-	module_ci.pCode = shader_frag_spv.data();
-	VK_CHECK(vkCreateShaderModule(logical.device, &module_ci, nullptr, &shader_stages_ci[1].module));
+	// Vertex stage variant taking the model transform from the instance stream
+	STATUS_CHECK(shader_cache.load("simple_instanced.vert.spv", &instanced_vert_module));
 
 	return STATUS_OK;
 }
 
 Status Vulkan_Instance_Info::setup_framebuffer() {
+	PROFILE_FUNCTION();
 	/*
 	 * Attachement 0 is the swapchain buffer.
 	 * Attachement 1 is the depth buffer (shared amung the framebuffers).
@@ -749,64 +1344,187 @@ Status Vulkan_Instance_Info::setup_framebuffer() {
 	return STATUS_OK;
 }
 
-Status Vulkan_Instance_Info::setup_vertex_buffer() {
-	VkBufferCreateInfo vert_buf_ci = {};
-	vert_buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vert_buf_ci.pNext = nullptr;
-	vert_buf_ci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-	vert_buf_ci.size = sizeof(Cube_Model::vertex_buffer_solid_face_colors_data);
-	vert_buf_ci.queueFamilyIndexCount = 0;
-	vert_buf_ci.pQueueFamilyIndices = nullptr;
-	vert_buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	vert_buf_ci.flags = 0;
-	VK_CHECK(vkCreateBuffer(logical.device, &vert_buf_ci, nullptr, &vertex_buffer.buf));
-
-	VkMemoryRequirements mem_reqs = {};
-	vkGetBufferMemoryRequirements(logical.device, vertex_buffer.buf, &mem_reqs);
-
-	VkMemoryAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.pNext = nullptr;
-	alloc_info.memoryTypeIndex = 0;
-	alloc_info.allocationSize = mem_reqs.size;
-	if (!memory_type_from_properties(mem_reqs.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&alloc_info.memoryTypeIndex))
-	{
-		log_error("No mappable coherent memory");
-		return !STATUS_OK;
+Status Vulkan_Instance_Info::setup_vertex_buffer(Vertex_Format format) {
+	PROFILE_FUNCTION();
+	vertex_format = format;
+
+	// Pack the float vertices, the cube already spans [-1, 1] so positions need no rescaling
+	Packed_Vertex packed_vertices[Cube_Model::vertex_count];
+	Float_Vertex float_vertices[Cube_Model::vertex_count];
+	for (uint32_t i = 0; i < Cube_Model::vertex_count; ++i) {
+		Vertex const& vertex = Cube_Model::vertex_buffer_solid_face_colors_data[i];
+		const glm::vec4 pos(vertex.pos.x, vertex.pos.y, vertex.pos.z, vertex.pos.w);
+		const glm::vec4 col(vertex.col.r, vertex.col.g, vertex.col.b, vertex.col.a);
+		packed_vertices[i].pos = pack_snorm16x4(pos);
+		packed_vertices[i].col = pack_unorm8x4(col);
+		float_vertices[i].pos = pos;
+		float_vertices[i].col = col;
 	}
 
-	VK_CHECK(vkAllocateMemory(logical.device, &alloc_info, nullptr, &vertex_buffer.mem));
+	// Index the triangle list and order it for the post-transform cache and vertex fetch
+	Mesh mesh;
+	if (format == Vertex_Format::Packed) {
+		optimize_mesh(packed_vertices, Cube_Model::vertex_count, sizeof(Packed_Vertex), &mesh);
+	}
+	else {
+		optimize_mesh(float_vertices, Cube_Model::vertex_count, sizeof(Float_Vertex), &mesh);
+	}
 
-	uint8_t* pData = nullptr;
-	VK_CHECK(vkMapMemory(logical.device, vertex_buffer.mem, 0, mem_reqs.size, 0, reinterpret_cast<void**>(&pData)));
+	// Static geometry lives in DEVICE_LOCAL memory, uploaded through the staging ring
+	STATUS_CHECK(create_static_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, mesh.vertices.data(),
+		mesh.vertices.size(), &vertex_buffer.buf, &vertex_buffer.alloc, &vertex_buffer.movable));
+
+	// 16 bit indices when they fit, half the index fetch bandwidth
+	index_buffer.index_count = static_cast<uint32_t>(mesh.indices.size());
+	if (mesh.vertex_count <= UINT16_MAX + 1u) {
+		std::vector<uint16_t> indices16(mesh.indices.begin(), mesh.indices.end());
+		index_buffer.index_type = VK_INDEX_TYPE_UINT16;
+		STATUS_CHECK(create_static_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indices16.data(),
+			indices16.size() * sizeof(uint16_t), &index_buffer.buf, &index_buffer.alloc, &index_buffer.movable));
+	}
+	else {
+		index_buffer.index_type = VK_INDEX_TYPE_UINT32;
+		STATUS_CHECK(create_static_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, mesh.indices.data(),
+			mesh.indices.size() * sizeof(uint32_t), &index_buffer.buf, &index_buffer.alloc, &index_buffer.movable));
+	}
 
-	memcpy(pData, Cube_Model::vertex_buffer_solid_face_colors_data, 
-		sizeof(Cube_Model::vertex_buffer_solid_face_colors_data));
+	if (format == Vertex_Format::Packed) {
+		vertex_input_binding = vertex_binding<Packed_Vertex>(0, VK_VERTEX_INPUT_RATE_VERTEX);
+		vertex_attribs<Packed_Vertex>(0, vertex_input_attribs);
+	}
+	else {
+		vertex_input_binding = vertex_binding<Float_Vertex>(0, VK_VERTEX_INPUT_RATE_VERTEX);
+		vertex_attribs<Float_Vertex>(0, vertex_input_attribs);
+	}
 
-	vkUnmapMemory(logical.device, vertex_buffer.mem);
+	return STATUS_OK;
+}
 
-	VK_CHECK(vkBindBufferMemory(logical.device, vertex_buffer.buf, vertex_buffer.mem, 0));
+/**
+ * Rebuild the vertex and index buffers in another format, and the draw path pipelines to
+ * read it. Waits for the device to go idle, for benchmarks rather than use between frames.
+ *
+ * The memory of the old buffers is compacted before the new ones are allocated.
+ *
+ * NOTE: Needs setup_graphics_pipeline().
+ */
+Status Vulkan_Instance_Info::set_vertex_format(Vertex_Format format) {
+	if (format == vertex_format) {
+		return STATUS_OK;
+	}
+
+	VK_CHECK(vkDeviceWaitIdle(logical.device));
+	vkDestroyBuffer(logical.device, vertex_buffer.buf, nullptr);
+	mem_allocator.free(&vertex_buffer.alloc);
+	vkDestroyBuffer(logical.device, index_buffer.buf, nullptr);
+	mem_allocator.free(&index_buffer.alloc);
+	STATUS_CHECK(defragment_device_memory());
+
+	// Pipelines of the old format stay in the manager until it is destroyed
+	STATUS_CHECK(setup_vertex_buffer(format));
+	STATUS_CHECK(setup_graphics_pipeline());
+	mark_cmd_bufs_dirty();
+	return STATUS_OK;
+}
+
+/**
+ * NOTE: Needs the frames in flight, see setup_frames_in_flight().
+ *
+ * \param max_instances Most instances drawn in a frame.
+ */
+Status Vulkan_Instance_Info::setup_instance_buffer(uint32_t max_instances) {
+	PROFILE_FUNCTION();
+	assert(!frames.empty());
+	assert(max_instances > 0);
+
+	// One region per frame slot, then the static region
+	const uint32_t num_regions = static_cast<uint32_t>(frames.size()) + 1;
+	instance_buffer.capacity = max_instances;
+	instance_buffer.counts.assign(num_regions, 0);
+	instance_buffer.latest_region = num_regions - 1;
+
+	VkBufferCreateInfo inst_buf_ci = {};
+	inst_buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	inst_buf_ci.pNext = nullptr;
+	inst_buf_ci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	inst_buf_ci.size = static_cast<VkDeviceSize>(max_instances) * sizeof(Instance_Data) * num_regions;
+	inst_buf_ci.queueFamilyIndexCount = 0;
+	inst_buf_ci.pQueueFamilyIndices = nullptr;
+	inst_buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	inst_buf_ci.flags = 0;
+	VK_CHECK(vkCreateBuffer(logical.device, &inst_buf_ci, nullptr, &instance_buffer.buf));
+
+	// Rewritten every frame, the GPU reads each instance once so it stays in host memory. Moves
+	// copy it through the mapping.
+	instance_buffer.movable = { &instance_buffer.buf, &instance_buffer.alloc, inst_buf_ci.usage, inst_buf_ci.size };
+	STATUS_CHECK(allocate_buffer_memory(instance_buffer.buf,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&instance_buffer.alloc, &instance_buffer.movable));
+
+	instance_input_binding = vertex_binding<Instance_Data>(1, VK_VERTEX_INPUT_RATE_INSTANCE);
+	vertex_attribs<Instance_Data>(1, instance_input_attribs);
+
+	return STATUS_OK;
+}
 
-	vertex_input_binding.binding = 0;
-	vertex_input_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-	vertex_input_binding.stride = sizeof(Cube_Model::vertex_buffer_solid_face_colors_data[0]);
+/**
+ * Set the instances drawn by the next frame on the instanced draw path.
+ *
+ * Instances are written straight into the region of the frame slot render() uses next, waiting
+ * for the slot's previous submission if needed. Call once per frame. With pre-recorded command
+ * buffers the static region is written instead and the buffers are re-recorded.
+ */
+Status Vulkan_Instance_Info::write_instances(Instance_Data const* instances, uint32_t count) {
+	assert(instances || count == 0);
+	if (count > instance_buffer.capacity) {
+		log_error("%u instances exceed the instance buffer capacity of %u\n", count, instance_buffer.capacity);
+		return !STATUS_OK;
+	}
 
-	vertex_input_attribs[0].binding = 0;
-	vertex_input_attribs[0].location = 0;
-	vertex_input_attribs[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	vertex_input_attribs[0].offset = 0;
+	uint32_t region;
+	if (prerecord_cmd_bufs) {
+		for (Frame_Data& frame : frames) {
+			if (frame.submitted) {
+				VK_CHECK(wait_for_fence(logical.device, frame.in_flight_fence));
+			}
+		}
+		region = static_cast<uint32_t>(frames.size());
+		mark_cmd_bufs_dirty();
+	}
+	else {
+		Frame_Data& frame = frames[current_frame];
+		if (frame.submitted) {
+			VK_CHECK(wait_for_fence(logical.device, frame.in_flight_fence));
+		}
+		region = current_frame;
+	}
 
-	vertex_input_attribs[1].binding = 0;
-	vertex_input_attribs[1].location = 1;
-	vertex_input_attribs[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	vertex_input_attribs[1].offset = 16;
+	const size_t region_offset = static_cast<size_t>(region) * instance_buffer.capacity * sizeof(Instance_Data);
+	memcpy(static_cast<uint8_t*>(instance_buffer.alloc.mapped) + region_offset, instances, count * sizeof(Instance_Data));
+	instance_buffer.counts[region] = count;
+	instance_buffer.latest_region = region;
 
 	return STATUS_OK;
 }
 
+/**
+ * Instances written by the latest write_instances(), read back from the mapped buffer.
+ */
+Instance_Data const* Vulkan_Instance_Info::latest_instances(uint32_t* count) const {
+	assert(count);
+	if (instance_buffer.counts.empty()) {
+		*count = 0;
+		return nullptr;
+	}
+
+	const uint32_t region = instance_buffer.latest_region;
+	*count = instance_buffer.counts[region];
+	const size_t region_offset = static_cast<size_t>(region) * instance_buffer.capacity * sizeof(Instance_Data);
+	return reinterpret_cast<Instance_Data const*>(static_cast<uint8_t const*>(instance_buffer.alloc.mapped) + region_offset);
+}
+
 Status Vulkan_Instance_Info::setup_graphics_pipeline() {
+	PROFILE_FUNCTION();
 	// Dynamic state
 	//
     // State that can be cahnged by a command buffer during command buffer execution.
@@ -827,7 +1545,7 @@ Status Vulkan_Instance_Info::setup_graphics_pipeline() {
     vert_input_state_ci.flags = 0;
     vert_input_state_ci.vertexBindingDescriptionCount = 1;
     vert_input_state_ci.pVertexBindingDescriptions = &vertex_input_binding;
-    vert_input_state_ci.vertexAttributeDescriptionCount = 2;
+    vert_input_state_ci.vertexAttributeDescriptionCount = static_cast<uint32_t>(std::size(vertex_input_attribs));
     vert_input_state_ci.pVertexAttributeDescriptions = vertex_input_attribs;
 
 	// Pipeline vertex input assembly state
@@ -956,16 +1674,114 @@ Status Vulkan_Instance_Info::setup_graphics_pipeline() {
     pipeline_ci.stageCount = 2;
     pipeline_ci.renderPass = render_pass;
     pipeline_ci.subpass = 0;
-    VK_CHECK(vkCreateGraphicsPipelines(logical.device, VK_NULL_HANDLE, 1, &pipeline_ci, nullptr, &pipeline));
+
+    // Keep the state of every draw path, pipelines are created on first use by
+    // draw_path_pipeline(). The uniform path pipeline is needed for the first frame and is the
+    // fallback while others compile, create it now.
+    auto set_draw_path_state = [this](Draw_Path path, VkGraphicsPipelineCreateInfo const& ci) {
+        Draw_Path_Pipeline& draw_path_pipeline = draw_path_pipelines[static_cast<uint32_t>(path)];
+        draw_path_pipeline.state.copy_from(ci);
+        draw_path_pipeline.key = make_pipeline_key(ci);
+    };
+    set_draw_path_state(Draw_Path::Uniform_Dynamic, pipeline_ci);
+    STATUS_CHECK(pipelines.create(pipeline_ci, draw_path_name(Draw_Path::Uniform_Dynamic), &pipeline));
+
+    // Same state and shaders, the vertex stage specialized to read the transform from push constants
+    Specialization push_vert_spec;
+    push_vert_spec.set(Simple_Vert_Spec::push_transform, true);
+    VkPipelineShaderStageCreateInfo push_stages_ci[2] = { shader_stages_ci[0], shader_stages_ci[1] };
+    push_stages_ci[0].pSpecializationInfo = push_vert_spec.get_info();
+    pipeline_ci.pStages = push_stages_ci;
+    set_draw_path_state(Draw_Path::Push_Constant, pipeline_ci);
+
+    // Instanced variant, per-vertex data on binding 0 and per-instance data on binding 1
+    //
+    // NOTE: Needs setup_instance_buffer().
+    VkVertexInputBindingDescription instanced_bindings[2] = { vertex_input_binding, instance_input_binding };
+    VkVertexInputAttributeDescription instanced_attribs[vertex_location_count<Packed_Vertex>() + vertex_location_count<Instance_Data>()];
+    std::copy(std::begin(vertex_input_attribs), std::end(vertex_input_attribs), instanced_attribs);
+    std::copy(std::begin(instance_input_attribs), std::end(instance_input_attribs),
+        instanced_attribs + std::size(vertex_input_attribs));
+    VkPipelineVertexInputStateCreateInfo instanced_input_state_ci = vert_input_state_ci;
+    instanced_input_state_ci.vertexBindingDescriptionCount = 2;
+    instanced_input_state_ci.pVertexBindingDescriptions = instanced_bindings;
+    instanced_input_state_ci.vertexAttributeDescriptionCount = static_cast<uint32_t>(std::size(instanced_attribs));
+    instanced_input_state_ci.pVertexAttributeDescriptions = instanced_attribs;
+
+    VkPipelineShaderStageCreateInfo instanced_stages_ci[2] = { shader_stages_ci[0], shader_stages_ci[1] };
+    instanced_stages_ci[0].module = instanced_vert_module;
+    pipeline_ci.pStages = instanced_stages_ci;
+    pipeline_ci.pVertexInputState = &instanced_input_state_ci;
+    set_draw_path_state(Draw_Path::Instanced, pipeline_ci);
 
     return STATUS_OK;
 }
 
-Status Vulkan_Instance_Info::render() {
-    // Get swapchain image to render into
+/**
+ * Pipeline of a draw path, queued for creation the first time it is asked for.
+ */
+Pipeline_Handle Vulkan_Instance_Info::draw_path_pipeline(Draw_Path path) {
+    Draw_Path_Pipeline const& draw_path_pipeline = draw_path_pipelines[static_cast<uint32_t>(path)];
+    return pipelines.request(draw_path_pipeline.key, draw_path_pipeline.state, draw_path_name(path));
+}
 
-    const VkDeviceSize offsets[1] = { 0 };
+/**
+ * Choose the pipeline of a scene recording and reserve its uniform data from the current
+ * uniform ring region.
+ */
+Status Vulkan_Instance_Info::prepare_scene_draws(Scene_Draws* draws) {
+    // A variant still compiling is replaced by the uniform path, which draws the same scene
+    // from draw_models.
+    draws->path = draw_path;
+    draws->pipeline = pipelines.get(draw_path_pipeline(draws->path));
+    if (draws->pipeline == VK_NULL_HANDLE) {
+        draws->path = Draw_Path::Uniform_Dynamic;
+        draws->pipeline = pipelines.get(pipeline);
+    }
+
+    draws->view_projection = clip * projection * view;
+    draws->mvp_data = nullptr;
+    draws->mvp_offset = 0;
+    draws->mvp_stride = 0;
+    draws->instance_region = 0;
+    draws->instance_count = 0;
+
+    switch (draws->path) {
+    case Draw_Path::Instanced:
+        // Pre-recorded buffers read the static region, see write_instances()
+        draws->instance_region = prerecord_cmd_bufs ? static_cast<uint32_t>(frames.size()) : current_frame;
+        draws->instance_count = instance_buffer.counts[draws->instance_region];
+        draws->num_draws = draws->instance_count > 0 ? 1 : 0;
+        if (draws->num_draws > 0) {
+            STATUS_CHECK(uniform_data.ring.push(draws->view_projection, &draws->mvp_offset));
+        }
+        break;
+
+    case Draw_Path::Push_Constant:
+        draws->num_draws = static_cast<uint32_t>(draw_models.size());
+        break;
+
+    case Draw_Path::Uniform_Dynamic:
+        draws->num_draws = static_cast<uint32_t>(draw_models.size());
+        if (draws->num_draws > 0) {
+            void* mvp_data;
+            STATUS_CHECK(uniform_data.ring.allocate_array(sizeof(glm::mat4), draws->num_draws, &mvp_data,
+                &draws->mvp_offset, &draws->mvp_stride));
+            draws->mvp_data = static_cast<uint8_t*>(mvp_data);
+        }
+        break;
+    }
+
+    return STATUS_OK;
+}
 
+/**
+ * \param contents VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS when the draws are recorded
+ *  into secondary command buffers.
+ */
+void Vulkan_Instance_Info::begin_scene_render_pass(VkCommandBuffer cmd_buf, uint32_t image_index,
+    VkSubpassContents contents)
+{
     static constexpr uint32_t num_clear_values = 2;
     VkClearValue clear_values[num_clear_values];
     clear_values[0].color.float32[0] = 0.2f;
@@ -975,80 +1791,454 @@ Status Vulkan_Instance_Info::render() {
     clear_values[1].depthStencil.depth = 1.0f; // farthest away
     clear_values[1].depthStencil.stencil = 0;
 
-    VkSemaphoreCreateInfo image_acquired_sema_ci = {};
-    image_acquired_sema_ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    image_acquired_sema_ci.pNext = nullptr;
-    image_acquired_sema_ci.flags = 0;
-    VK_CHECK(vkCreateSemaphore(logical.device, &image_acquired_sema_ci, nullptr,
-        &image_acquired_sema));
+    VkRenderPassBeginInfo render_pass_begin;
+    render_pass_begin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_begin.pNext = nullptr;
+    render_pass_begin.renderPass = render_pass;
+    assert(image_index < framebuffers.size());
+    render_pass_begin.framebuffer = framebuffers[image_index];
+    render_pass_begin.renderArea.offset.x = 0;
+    render_pass_begin.renderArea.offset.y = 0;
+    render_pass_begin.renderArea.extent.width = swapchain_extent.width;
+    render_pass_begin.renderArea.extent.height = swapchain_extent.height;
+    render_pass_begin.clearValueCount = num_clear_values;
+    render_pass_begin.pClearValues = clear_values;
+    vkCmdBeginRenderPass(cmd_buf, &render_pass_begin, contents);
+}
 
-    // Get next available swapchain image
-    VK_CHECK(vkAcquireNextImageKHR(logical.device, swapchain, UINT64_MAX, image_acquired_sema,
-        VK_NULL_HANDLE, &current_image));
+/**
+ * Bind the state every draw of the scene uses. Secondary command buffers inherit none of it,
+ * each one binds it again.
+ */
+void Vulkan_Instance_Info::bind_scene_state(VkCommandBuffer cmd_buf, Scene_Draws const& draws) {
+    // Bind pipeline
+    //
+    // Describes how to render primatives.
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, draws.pipeline);
+
+    // Bind vertex buffer
+    //
+    const VkDeviceSize offsets[1] = { 0 };
+    vkCmdBindVertexBuffers(
+        cmd_buf,
+        0, // Start binding
+        1, // Binding count
+        &vertex_buffer.buf, // pBuffers
+        offsets); // pOffsets
+    vkCmdBindIndexBuffer(cmd_buf, index_buffer.buf, 0, index_buffer.index_type);
+
+    // Set viewport and scissor rectangle
+    //
+    // NOTE: Able to set in command buffer due to viewport and scissor state being dynamic.
+    VkViewport viewport;
+    viewport.height = static_cast<float>(swapchain_extent.height);
+    viewport.width = static_cast<float>(swapchain_extent.width);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    viewport.x = 0;
+    viewport.y = 0;
+    vkCmdSetViewport(cmd_buf, 0, num_viewports, &viewport);
+
+    VkRect2D scissor;
+    scissor.extent.width = swapchain_extent.width;
+    scissor.extent.height = swapchain_extent.height;
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    vkCmdSetScissor(cmd_buf, 0, num_scissors, &scissor);
+
+    if (draws.path == Draw_Path::Push_Constant && draws.num_draws > 0) {
+        // The uniform block is still declared by the specialized shader, keep set 0 bound
+        // even though the folded branch never reads it.
+        const uint32_t unused_offset = 0;
+        vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, desc_sets.data(),
+            1, &unused_offset);
+    }
+}
+
+/**
+ * Record draws [first_draw, first_draw + num_draws) of the scene. Only writes the uniform
+ * slots of those draws, so disjoint ranges can be recorded concurrently.
+ */
+void Vulkan_Instance_Info::record_draws(VkCommandBuffer cmd_buf, Scene_Draws const& draws, uint32_t first_draw,
+    uint32_t num_draws)
+{
+    assert(first_draw + num_draws <= draws.num_draws);
+
+    // Instanced: a single draw, transforms come from the instance stream.
+    // Otherwise the shader input changes per draw. Push constants are written straight into the
+    // command buffer, the uniform path writes the draw's slot and rebinds the descriptor set at
+    // its offset.
+    if (draws.path == Draw_Path::Instanced) {
+        if (num_draws > 0) {
+            vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, desc_sets.data(),
+                1, &draws.mvp_offset);
+
+            const VkDeviceSize instance_offset
+                = static_cast<VkDeviceSize>(draws.instance_region) * instance_buffer.capacity * sizeof(Instance_Data);
+            vkCmdBindVertexBuffers(cmd_buf, 1, 1, &instance_buffer.buf, &instance_offset);
+            vkCmdDrawIndexed(cmd_buf, index_buffer.index_count, draws.instance_count, 0, 0, 0);
+        }
+        return;
+    }
+
+    const bool push_transforms = draws.path == Draw_Path::Push_Constant;
+    for (uint32_t i = first_draw; i < first_draw + num_draws; ++i) {
+        const glm::mat4 draw_mvp = draws.view_projection * draw_models[i];
+
+        if (push_transforms) {
+            vkCmdPushConstants(cmd_buf, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(draw_mvp), &draw_mvp);
+        }
+        else {
+            memcpy(draws.mvp_data + static_cast<size_t>(i) * draws.mvp_stride, &draw_mvp, sizeof(draw_mvp));
+            const uint32_t mvp_offset = draws.mvp_offset + i * draws.mvp_stride;
+            vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, desc_sets.data(),
+                1, &mvp_offset);
+        }
+
+        vkCmdDrawIndexed(cmd_buf, index_buffer.index_count, 1, 0, 0, 0);
+    }
+}
+
+/**
+ * Record a range of draws into a secondary command buffer executed inside the scene's render
+ * pass. Runs on a recording thread.
+ */
+VkResult Vulkan_Instance_Info::record_scene_secondary(VkCommandBuffer cmd_buf,
+    VkCommandBufferInheritanceInfo const& inheritance, Scene_Draws const& draws, uint32_t first_draw,
+    uint32_t num_draws)
+{
+    VkCommandBufferBeginInfo cmd_buf_begin_info = {};
+    cmd_buf_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmd_buf_begin_info.pNext = nullptr;
+    cmd_buf_begin_info.flags
+        = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    cmd_buf_begin_info.pInheritanceInfo = &inheritance;
+    const VkResult res = vkBeginCommandBuffer(cmd_buf, &cmd_buf_begin_info);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+
+    bind_scene_state(cmd_buf, draws);
+    record_draws(cmd_buf, draws, first_draw, num_draws);
+    return vkEndCommandBuffer(cmd_buf);
+}
+
+/**
+ * Record the scene into a command buffer targeting the given swapchain image.
+ *
+ * Uniform data is allocated from the current uniform ring region.
+ *
+ * \param profiler Times the render pass and the draws in it, null to record no timestamps.
+ */
+Status Vulkan_Instance_Info::record_scene_commands(VkCommandBuffer cmd_buf, uint32_t image_index,
+    Gpu_Profiler* profiler)
+{
+    Scene_Draws draws;
+    STATUS_CHECK(prepare_scene_draws(&draws));
+    record_scene_commands(cmd_buf, image_index, draws, profiler);
+    return STATUS_OK;
+}
 
-    VK_CHECK(exec_begin_gr_command_buffer());
+/**
+ * Record draws prepared by prepare_scene_draws(), which may be recorded into several command
+ * buffers. Their uniform slots are rewritten with the same data each time.
+ */
+void Vulkan_Instance_Info::record_scene_commands(VkCommandBuffer cmd_buf, uint32_t image_index,
+    Scene_Draws const& draws, Gpu_Profiler* profiler)
+{
+    Gpu_Scope pass_scope(profiler, cmd_buf, "render pass");
+    begin_scene_render_pass(cmd_buf, image_index, VK_SUBPASS_CONTENTS_INLINE);
+    bind_scene_state(cmd_buf, draws);
     {
-        // Begin render pass
-        VkRenderPassBeginInfo render_pass_begin;
-        render_pass_begin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        render_pass_begin.pNext = nullptr;
-        render_pass_begin.renderPass = render_pass;
-        assert(current_image < framebuffers.size());
-        render_pass_begin.framebuffer = framebuffers[current_image];
-        render_pass_begin.renderArea.offset.x = 0;
-        render_pass_begin.renderArea.offset.y = 0;
-        render_pass_begin.renderArea.extent.width = swapchain_extent.width;
-        render_pass_begin.renderArea.extent.height = swapchain_extent.height;
-        render_pass_begin.clearValueCount = num_clear_values;
-        render_pass_begin.pClearValues = clear_values;
-        vkCmdBeginRenderPass(logical.gr_cmd_buf, &render_pass_begin, VK_SUBPASS_CONTENTS_INLINE);
-
-        // Bind vertex buf
-        vkCmdBindVertexBuffers(
-            logical.gr_cmd_buf,
-            0, // Start binding
-            1, // Binding count
-            &vertex_buffer.buf, // pBuffers
-            offsets); // pOffsets
-
-        // Bind pipeline
-        //
-        // Describes how to render primatives.
-        vkCmdBindPipeline(logical.gr_cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-
-        // Bind descriptor sets
-        //
-        // Describes shader input
-        vkCmdBindDescriptorSets(logical.gr_cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, desc_sets.data(), 0, nullptr);
-
-        // Bind vertex buffer
-        //
-        const VkDeviceSize offsets[1] = { 0 };
-        vkCmdBindVertexBuffers(logical.gr_cmd_buf, 0, 1, &vertex_buffer.buf, offsets);
-
-        // Set viewport and scissor rectangle
-        //
-        // NOTE: Able to set in command buffer due to viewport and scissor state being dynamic.
-        viewport.height = static_cast<float>(swapchain_extent.height);
-        viewport.width = static_cast<float>(swapchain_extent.width);
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        viewport.x = 0;
-        viewport.y = 0;
-        vkCmdSetViewport(logical.gr_cmd_buf, 0, num_viewports, &viewport);
-
-        scissor.extent.width = swapchain_extent.width;
-        scissor.extent.height = swapchain_extent.height;
-        scissor.offset.x = 0;
-        scissor.offset.y = 0;
-        vkCmdSetScissor(logical.gr_cmd_buf, 0, num_scissors, &scissor);
-
-        // Draw
-        //
-        vkCmdDraw(logical.gr_cmd_buf, Cube_Model::vertex_count, 1, 0, 0);
-        vkCmdEndRenderPass(logical.gr_cmd_buf);
-    }
-    VK_CHECK(exec_end_gr_command_buffer());
+        Gpu_Scope draw_scope(profiler, cmd_buf, "draws");
+        record_draws(cmd_buf, draws, 0, draws.num_draws);
+    }
+    vkCmdEndRenderPass(cmd_buf);
+}
+
+/**
+ * Record the scene like record_scene_commands(), with the draws split into contiguous ranges
+ * recorded by jobs into the frame slot's secondary command buffers.
+ *
+ * The primary buffer executes the secondaries in range order, so the GPU sees the draws in the
+ * same order as a serial recording. The secondaries must be reset, see retire_frame().
+ *
+ * \param profiler Times the render pass, null to record no timestamps. The draws are not timed
+ *  on their own, their timestamps would have to be written from the secondaries.
+ */
+Status Vulkan_Instance_Info::record_scene_commands_parallel(VkCommandBuffer cmd_buf, uint32_t image_index,
+    Frame_Data& frame, Gpu_Profiler* profiler)
+{
+    Scene_Draws draws;
+    STATUS_CHECK(prepare_scene_draws(&draws));
+
+    // Ranges too small to pay for waking a thread are merged
+    static constexpr uint32_t min_draws_per_range = 64;
+    uint32_t max_ranges = static_cast<uint32_t>(frame.record_cmd_bufs.size());
+    if (max_record_ranges > 0) {
+        max_ranges = std::min(max_ranges, max_record_ranges);
+    }
+    assert(max_ranges > 0);
+    const uint32_t draws_per_range
+        = std::max((draws.num_draws + max_ranges - 1) / max_ranges, min_draws_per_range);
+    const uint32_t num_ranges = (draws.num_draws + draws_per_range - 1) / draws_per_range;
+
+    VkCommandBufferInheritanceInfo inheritance = {};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.pNext = nullptr;
+    inheritance.renderPass = render_pass;
+    inheritance.subpass = 0;
+    assert(image_index < framebuffers.size());
+    inheritance.framebuffer = framebuffers[image_index];
+
+    // Each range has its own pool, only the job recording the range touches it
+    std::vector<Record_Range> ranges(num_ranges);
+    std::vector<Job> range_jobs(num_ranges);
+    for (uint32_t i = 0; i < num_ranges; ++i) {
+        Record_Range& range = ranges[i];
+        range.vulkan = this;
+        range.cmd_buf = frame.record_cmd_bufs[i];
+        range.inheritance = &inheritance;
+        range.draws = &draws;
+        range.first_draw = i * draws_per_range;
+        range.num_draws = std::min(draws_per_range, draws.num_draws - range.first_draw);
+        range.result = VK_SUCCESS;
+
+        range_jobs[i].function = record_range_job;
+        range_jobs[i].data = &range;
+    }
+    Job_Counter recorded = {};
+    jobs->run(range_jobs.data(), num_ranges, &recorded);
+
+    // Overlaps with the recording jobs, then this thread helps record
+    //
+    // NOTE: The scope is ended by hand, a subpass of secondary command buffers allows no
+    // timestamp writes in the primary, not even on an error return.
+    const uint32_t pass_scope = profiler ? profiler->begin_scope(cmd_buf, "render pass") : Gpu_Profiler::no_scope;
+    begin_scene_render_pass(cmd_buf, image_index, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    jobs->wait(&recorded);
+    VkResult result = VK_SUCCESS;
+    for (Record_Range const& range : ranges) {
+        if (range.result != VK_SUCCESS) {
+            result = range.result;
+            break;
+        }
+    }
+
+    if (result == VK_SUCCESS && num_ranges > 0) {
+        vkCmdExecuteCommands(cmd_buf, num_ranges, frame.record_cmd_bufs.data());
+    }
+    vkCmdEndRenderPass(cmd_buf);
+    if (profiler) {
+        profiler->end_scope(cmd_buf, pass_scope);
+    }
+    VK_CHECK(result);
+
+    return STATUS_OK;
+}
+
+/**
+ * Return the secondary command buffers of a frame slot to the initial state.
+ *
+ * NOTE: None of them may be pending execution.
+ */
+Status Vulkan_Instance_Info::reset_record_pools(Frame_Data& frame) {
+    for (VkCommandPool pool : frame.record_pools) {
+        VK_CHECK(vkResetCommandPool(logical.device, pool, 0));
+    }
+    return STATUS_OK;
+}
+
+/**
+ * Flag the pre-recorded command buffers as stale. They are re-recorded before the next submit.
+ *
+ * NOTE: Must be called whenever state baked into the recording changes (pipeline swap, buffer
+ * reallocation, ...). A new swapchain gets new buffers instead, see recreate_swapchain().
+ */
+void Vulkan_Instance_Info::mark_cmd_bufs_dirty() {
+    image_cmd_bufs_dirty = true;
+}
+
+/**
+ * Record one command buffer per framebuffer. The buffers are resubmitted as-is every frame.
+ *
+ * The first recording for a swapchain allocates new buffers, the previous ones retire with
+ * the previous swapchain, so a resize doesn't wait for the GPU.
+ */
+Status Vulkan_Instance_Info::record_image_cmd_bufs() {
+    PROFILE_FUNCTION();
+    if (image_cmd_bufs.empty()) {
+        image_cmd_bufs.resize(framebuffers.size());
+        VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+        cmd_buf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmd_buf_alloc_info.pNext = nullptr;
+        cmd_buf_alloc_info.commandPool = logical.gr_cmd_pool;
+        cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmd_buf_alloc_info.commandBufferCount = static_cast<uint32_t>(image_cmd_bufs.size());
+        VK_CHECK(vkAllocateCommandBuffers(logical.device, &cmd_buf_alloc_info, image_cmd_bufs.data()));
+    }
+    else {
+        // The buffers may still be executing. Re-recording them in place is rare (pipeline
+        // swap, scene change), so wait on everything in flight rather than tracking each buffer.
+        assert(image_cmd_bufs.size() == framebuffers.size());
+        for (Frame_Data& frame : frames) {
+            if (frame.submitted) {
+                VK_CHECK(wait_for_fence(logical.device, frame.in_flight_fence));
+            }
+        }
+    }
+
+    // Uniform data baked into the recordings lives as long as they do. It goes to the static
+    // region the previous recording doesn't read, the last frames reading it are usually done.
+    const uint32_t region = (static_region + 1) % Uniform_Ring::num_static_regions;
+    STATUS_CHECK(wait_for_frame(static_region_last_frame[region]));
+    static_region = region;
+    uniform_data.ring.begin_static(region);
+
+    // Every image draws the same scene, so the buffers share one set of uniform data and the
+    // static region needs no more room than a frame's
+    Scene_Draws draws;
+    STATUS_CHECK(prepare_scene_draws(&draws));
+
+    for (uint32_t i = 0; i < image_cmd_bufs.size(); ++i) {
+        // NOTE: Not one time submit, the buffer is resubmitted every time image i is acquired.
+        VK_CHECK(exec_begin_gr_command_buffer(image_cmd_bufs[i], 0));
+        record_scene_commands(image_cmd_bufs[i], i, draws);
+        VK_CHECK(exec_end_gr_command_buffer(image_cmd_bufs[i]));
+    }
+
+    image_cmd_bufs_dirty = false;
+    return STATUS_OK;
+}
+
+Status Vulkan_Instance_Info::render() {
+    PROFILE_FUNCTION();
+    PROFILE_PHASE(phase_zone, "wait");
+    Frame_Data& frame = frames[current_frame];
+    phase_times = {};
+    double phase_start_ms = get_perf_counter_ms();
+
+    // Wait for the GPU to finish the last submission that used this frame slot
+    //
+    // NOTE: Only blocks when the CPU is more than frames.size() frames ahead of the GPU.
+    if (frame.submitted) {
+        VK_CHECK(wait_for_fence(logical.device, frame.in_flight_fence));
+        STATUS_CHECK(retire_frame(frame));
+        // The fence has signaled, the slot's timestamps are available without waiting
+        gpu_profiler.collect(current_frame);
+    }
+    STATUS_CHECK(uploader.retire());
+    release_retired_swapchains();
+
+    if (swapchain_dirty) {
+        bool recreated;
+        STATUS_CHECK(recreate_swapchain(&recreated));
+        if (!recreated) {
+            // Nothing to render to until the window has an area again
+            return STATUS_OK;
+        }
+    }
+    const double acquire_start_ms = get_perf_counter_ms();
+    phase_times.wait_ms = acquire_start_ms - phase_start_ms;
+    PROFILE_NEXT_PHASE(phase_zone, "acquire");
+
+    // Get next available swapchain image
+    VkSemaphore image_acquired_sema = VK_NULL_HANDLE;
+    if (headless) {
+        // Offscreen images are used in turn, the frame slot's fence covers its image
+        current_image = current_frame;
+    }
+    else {
+        STATUS_CHECK(sync_pool.acquire_semaphore(&image_acquired_sema));
+        const VkResult acquire_res = vkAcquireNextImageKHR(logical.device, swapchain, UINT64_MAX,
+            image_acquired_sema, VK_NULL_HANDLE, &current_image);
+        if (acquire_res != VK_SUCCESS && acquire_res != VK_SUBOPTIMAL_KHR) {
+            // Semaphore was not signaled, it can go straight back to the pool
+            sync_pool.release_semaphore(image_acquired_sema);
+            if (acquire_res == VK_ERROR_OUT_OF_DATE_KHR) {
+                // Drop this frame, the next one recreates the swapchain
+                swapchain_dirty = true;
+                return STATUS_OK;
+            }
+            VK_CHECK(acquire_res);
+        }
+        if (acquire_res == VK_SUBOPTIMAL_KHR) {
+            // The image is still presentable, finish the frame and recreate before the next one
+            swapchain_dirty = true;
+        }
+        frame.pending_semas.push_back(image_acquired_sema);
+        present_stats.acquire_wait.add(get_perf_counter_ms() - acquire_start_ms);
+    }
+
+    // The image can still be in use by a different frame slot if there are fewer swapchain
+    // images than frames in flight, or if they are returned out of order.
+    assert(current_image < images_in_flight.size());
+    if (images_in_flight[current_image] != VK_NULL_HANDLE && images_in_flight[current_image] != frame.in_flight_fence) {
+        VK_CHECK(wait_for_fence(logical.device, images_in_flight[current_image]));
+    }
+    images_in_flight[current_image] = frame.in_flight_fence;
+    phase_start_ms = get_perf_counter_ms();
+    phase_times.acquire_ms = phase_start_ms - acquire_start_ms;
+    PROFILE_NEXT_PHASE(phase_zone, "record");
+
+    // Recordings made while a variant was compiling use the fallback pipeline
+    const uint32_t num_completed = pipelines.num_completed.load();
+    if (num_completed != pipelines_completed) {
+        pipelines_completed = num_completed;
+        mark_cmd_bufs_dirty();
+    }
+
+    // Submitted in order, pre-recorded frames are timed by the buffers around them
+    VkCommandBuffer submit_cmd_bufs[3];
+    uint32_t num_submit_cmd_bufs = 0;
+    const bool profile_gpu = gpu_profiler.enabled;
+    if (prerecord_cmd_bufs) {
+        // Static scene: resubmit the image's recording, only re-record when state changed
+        if (image_cmd_bufs_dirty || image_cmd_bufs.empty()) {
+            STATUS_CHECK(record_image_cmd_bufs());
+        }
+        static_region_last_frame[static_region] = num_submitted_frames + 1;
+
+        uint32_t frame_scope = Gpu_Profiler::no_scope;
+        if (profile_gpu) {
+            VK_CHECK(exec_begin_gr_command_buffer(frame.cmd_buf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
+            gpu_profiler.begin_frame(frame.cmd_buf, current_frame, num_submitted_frames + 1);
+            frame_scope = gpu_profiler.begin_scope(frame.cmd_buf, "frame");
+            VK_CHECK(exec_end_gr_command_buffer(frame.cmd_buf));
+            submit_cmd_bufs[num_submit_cmd_bufs++] = frame.cmd_buf;
+        }
+        submit_cmd_bufs[num_submit_cmd_bufs++] = image_cmd_bufs[current_image];
+        if (profile_gpu) {
+            VK_CHECK(exec_begin_gr_command_buffer(frame.timestamp_cmd_buf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
+            gpu_profiler.end_scope(frame.timestamp_cmd_buf, frame_scope);
+            VK_CHECK(exec_end_gr_command_buffer(frame.timestamp_cmd_buf));
+            submit_cmd_bufs[num_submit_cmd_bufs++] = frame.timestamp_cmd_buf;
+        }
+    }
+    else {
+        VkCommandBuffer cmd_buf = frame.cmd_buf;
+        Gpu_Profiler* profiler = profile_gpu ? &gpu_profiler : nullptr;
+        uniform_data.ring.begin_frame(current_frame);
+        VK_CHECK(exec_begin_gr_command_buffer(cmd_buf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
+        if (profiler) {
+            profiler->begin_frame(cmd_buf, current_frame, num_submitted_frames + 1);
+        }
+        {
+            Gpu_Scope frame_scope(profiler, cmd_buf, "frame");
+            if (parallel_recording) {
+                STATUS_CHECK(record_scene_commands_parallel(cmd_buf, current_image, frame, profiler));
+            }
+            else {
+                STATUS_CHECK(record_scene_commands(cmd_buf, current_image, profiler));
+            }
+        }
+        VK_CHECK(exec_end_gr_command_buffer(cmd_buf));
+        submit_cmd_bufs[num_submit_cmd_bufs++] = cmd_buf;
+    }
+    phase_times.record_ms = get_perf_counter_ms() - phase_start_ms;
+    phase_start_ms = get_perf_counter_ms();
+    PROFILE_NEXT_PHASE(phase_zone, "submit");
 
     // Transition swapchain image for present
     //
@@ -1056,72 +2246,157 @@ Status Vulkan_Instance_Info::render() {
 
     // Submit the command buffer
     //
-    
-    // Fense to wait for GPU completion
-    VkFenceCreateInfo fence_ci = {};
-    VkFence draw_fence;
-    fence_ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_ci.pNext = nullptr;
-    fence_ci.flags = 0;
-    vkCreateFence(logical.device, &fence_ci, nullptr, &draw_fence);
+    // NOTE: Reset the fence only once work is guaranteed to be submitted, otherwise the next
+    // wait on this frame slot would never return.
+    if (frame.submitted) {
+        VK_CHECK(vkResetFences(logical.device, 1, &frame.in_flight_fence));
+    }
+
+    // Pending uploads go first, their barrier covers the frame's commands
+    STATUS_CHECK(uploader.flush());
+
+    VkSemaphore const render_finished_sema = swapchain_buffers[current_image].render_finished_sema;
 
     // Wait at the color attachment stage until swapchain image is available before writing colors.
-    const std::vector<VkCommandBuffer> cmd_bufs = { logical.gr_cmd_buf };
+    // Headless there is neither an image to wait for nor a present to signal.
     VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // stage when final color values are output from pipeline
     VkSubmitInfo submit_info[1] = {};
     submit_info[0].pNext = nullptr;
     submit_info[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info[0].waitSemaphoreCount = 1;
+    submit_info[0].waitSemaphoreCount = headless ? 0 : 1;
     submit_info[0].pWaitSemaphores = &image_acquired_sema;
     submit_info[0].pWaitDstStageMask = &pipe_stage_flags;
-    submit_info[0].commandBufferCount = static_cast<uint32_t>(cmd_bufs.size());
-    submit_info[0].pCommandBuffers = cmd_bufs.data();
-    submit_info[0].signalSemaphoreCount = 0;
-    submit_info[0].pSignalSemaphores = nullptr;
-    VK_CHECK(vkQueueSubmit(gr_queue, 1, submit_info, draw_fence));
-
-    // Wait for GPU completion
-    static constexpr uint64_t fence_timeout = 100000000;
-
-    VkResult res;
-    do {
-        res = vkWaitForFences(logical.device, 1, &draw_fence, VK_TRUE, fence_timeout);
-    } while (res == VK_TIMEOUT);
-    VK_CHECK(res);
+    submit_info[0].commandBufferCount = num_submit_cmd_bufs;
+    submit_info[0].pCommandBuffers = submit_cmd_bufs;
+    submit_info[0].signalSemaphoreCount = headless ? 0 : 1;
+    submit_info[0].pSignalSemaphores = &render_finished_sema;
+    VK_CHECK(vkQueueSubmit(gr_queue, 1, submit_info, frame.in_flight_fence));
+    frame.submitted = true;
+    frame.frame_number = ++num_submitted_frames;
+    phase_times.submit_ms = get_perf_counter_ms() - phase_start_ms;
 
     // Present
     //
-    VkPresentInfoKHR present_info;
-    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    present_info.pNext = nullptr;
-    present_info.swapchainCount = 1;
-    present_info.pSwapchains = &swapchain;
-    present_info.pImageIndices = &current_image;
-    present_info.pWaitSemaphores = nullptr;
-    present_info.waitSemaphoreCount = 0;
-    present_info.pResults = nullptr;
-    VK_CHECK(vkQueuePresentKHR(present_queue, &present_info));
-
-    // TODO: move to single instantiation
-    vkDestroyFence(logical.device, draw_fence, nullptr);
+    // Present waits on the GPU, not the host, so the CPU is free to record the next frame.
+    if (!headless) {
+        phase_start_ms = get_perf_counter_ms();
+        PROFILE_NEXT_PHASE(phase_zone, "present");
+        VkPresentInfoKHR present_info;
+        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        present_info.pNext = nullptr;
+        present_info.swapchainCount = 1;
+        present_info.pSwapchains = &swapchain;
+        present_info.pImageIndices = &current_image;
+        present_info.pWaitSemaphores = &render_finished_sema;
+        present_info.waitSemaphoreCount = 1;
+        present_info.pResults = nullptr;
+        const VkResult present_res = vkQueuePresentKHR(present_queue, &present_info);
+        if (present_res == VK_ERROR_OUT_OF_DATE_KHR || present_res == VK_SUBOPTIMAL_KHR) {
+            // The frame was rendered, it may or may not have been shown
+            swapchain_dirty = true;
+        }
+        else {
+            VK_CHECK(present_res);
+        }
+        const double present_end_ms = get_perf_counter_ms();
+        phase_times.present_ms = present_end_ms - phase_start_ms;
+        present_stats.acquire_to_present.add(present_end_ms - acquire_start_ms);
+    }
+
+    current_frame = (current_frame + 1) % static_cast<uint32_t>(frames.size());
+
+    PROFILE_NEXT_PHASE(phase_zone, "pipeline cache");
+    STATUS_CHECK(pipeline_cache.save_if_due(get_perf_counter_ms()));
+
+    return STATUS_OK;
+}
+
+/**
+ * Return the sync objects used by a frame slot's last submission to the pool.
+ *
+ * \param frame Frame slot whose fence has signaled.
+ */
+Status Vulkan_Instance_Info::retire_frame(Frame_Data& frame) {
+    for (VkSemaphore sema : frame.pending_semas) {
+        sync_pool.release_semaphore(sema);
+    }
+    frame.pending_semas.clear();
+
+    STATUS_CHECK(reset_record_pools(frame));
+
+    // Frames complete in submission order
+    num_completed_frames = std::max(num_completed_frames, frame.frame_number);
 
     return STATUS_OK;
 }
 
+void Vulkan_Instance_Info::log_present_stats() const {
+    Frame_Time_Histogram const& wait = present_stats.acquire_wait;
+    Frame_Time_Histogram const& latency = present_stats.acquire_to_present;
+    log_info("Present (%s): acquire wait p50 %.1f ms p99 %.1f ms, acquire to present p50 %.1f ms p99 %.1f ms\n",
+        present_mode_name(present_mode), wait.percentile(0.50), wait.percentile(0.99),
+        latency.percentile(0.50), latency.percentile(0.99));
+}
+
 void Vulkan_Instance_Info::cleanup() {
-    vkDestroyPipeline(logical.device, pipeline, nullptr);
+    // Frames may still be in flight
+    vkDeviceWaitIdle(logical.device);
+
+    if (!headless) {
+        log_present_stats();
+    }
+    gpu_profiler.log_rolling_stats();
+    gpu_profiler.destroy();
+    mem_allocator.log_stats("at exit");
+
+    // Waits for compiles still running
+    pipelines.wait_all();
+    pipelines.log_stats();
+    pipelines.destroy();
+    thread_pool.destroy();
+
+    // A failed save only costs the next start its warm cache
+    pipeline_cache.log_stats();
+    pipeline_cache.save();
+    pipeline_cache.destroy();
+
+    for (Frame_Data& frame : frames) {
+        retire_frame(frame);
+        sync_pool.release_fence(frame.in_flight_fence);
+        vkFreeCommandBuffers(logical.device, logical.gr_cmd_pool, 1, &frame.cmd_buf);
+        if (frame.timestamp_cmd_buf != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(logical.device, logical.gr_cmd_pool, 1, &frame.timestamp_cmd_buf);
+        }
+        for (VkCommandPool pool : frame.record_pools) {
+            vkDestroyCommandPool(logical.device, pool, nullptr);
+        }
+    }
+	uploader.destroy();
 
-	vkDestroySemaphore(logical.device, image_acquired_sema, nullptr);
-	vkFreeMemory(logical.device, vertex_buffer.mem, nullptr);
 	vkDestroyBuffer(logical.device, vertex_buffer.buf, nullptr);
+	mem_allocator.free(&vertex_buffer.alloc);
+
+	vkDestroyBuffer(logical.device, index_buffer.buf, nullptr);
+	mem_allocator.free(&index_buffer.alloc);
+
+	vkDestroyBuffer(logical.device, instance_buffer.buf, nullptr);
+	mem_allocator.free(&instance_buffer.alloc);
 
 
-	for (uint32_t i = 0; i < framebuffers.size(); ++i) {
-		vkDestroyFramebuffer(logical.device, framebuffers[i], nullptr);
+	Retired_Swapchain current;
+	current.swapchain = swapchain;
+	current.buffers = std::move(swapchain_buffers);
+	current.framebuffers = std::move(framebuffers);
+	current.depth_buf = depth_buf;
+	current.image_cmd_bufs = std::move(image_cmd_bufs);
+	destroy_swapchain_resources(current);
+	for (Retired_Swapchain& retired : retired_swapchains) {
+		destroy_swapchain_resources(retired);
 	}
+	retired_swapchains.clear();
 
-	vkDestroyShaderModule(logical.device, shader_stages_ci[0].module, nullptr);
-	vkDestroyShaderModule(logical.device, shader_stages_ci[1].module, nullptr);
+	shader_cache.log_stats();
+	shader_cache.destroy();
 
     vkDestroyRenderPass(logical.device, render_pass, nullptr);
     vkDestroyDescriptorPool(logical.device, desc_pool, nullptr);
@@ -1131,34 +2406,28 @@ void Vulkan_Instance_Info::cleanup() {
         vkDestroyDescriptorSetLayout(logical.device, desc_set_layout, nullptr);
     }
 
-    vkFreeMemory(logical.device, uniform_data.mem, nullptr);
-    vkDestroyBuffer(logical.device, uniform_data.buf, nullptr);
+    uniform_data.ring.log_stats();
+    uniform_data.ring.destroy();
 
-    vkFreeMemory(logical.device, depth_buf.mem, nullptr);
-    vkDestroyImageView(logical.device, depth_buf.view, nullptr);
-    vkDestroyImage(logical.device, depth_buf.image, nullptr);
-
-    for (Swapchain_Buffer& buf : swapchain_buffers) {
-        vkDestroyImageView(logical.device, buf.view, nullptr);
-    }
-    vkDestroySwapchainKHR(logical.device, swapchain, nullptr);
+    sync_pool.log_stats();
+    sync_pool.destroy();
 
-    vkFreeCommandBuffers(logical.device, logical.gr_cmd_pool, 1 /*TODO: gr_cmd_buf_alloc_info.commandBufferCount*/, &logical.gr_cmd_buf);
     vkDestroyCommandPool(logical.device, logical.gr_cmd_pool, nullptr);
+    mem_allocator.destroy();
     vkDestroyDevice(logical.device, nullptr);
     vkDestroyInstance(instance, nullptr);
 }
 
-VkResult Vulkan_Instance_Info::exec_begin_gr_command_buffer() {
+VkResult Vulkan_Instance_Info::exec_begin_gr_command_buffer(VkCommandBuffer cmd_buf, VkCommandBufferUsageFlags flags) {
 	VkCommandBufferBeginInfo cmd_buf_begin_info = {};
 	cmd_buf_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	cmd_buf_begin_info.pNext = nullptr;
-	cmd_buf_begin_info.flags = 0;
+	cmd_buf_begin_info.flags = flags;
 	cmd_buf_begin_info.pInheritanceInfo = nullptr;
 
-	return vkBeginCommandBuffer(logical.gr_cmd_buf, &cmd_buf_begin_info);
+	return vkBeginCommandBuffer(cmd_buf, &cmd_buf_begin_info);
 }
 
-VkResult Vulkan_Instance_Info::exec_end_gr_command_buffer() {
-	return vkEndCommandBuffer(logical.gr_cmd_buf);
+VkResult Vulkan_Instance_Info::exec_end_gr_command_buffer(VkCommandBuffer cmd_buf) {
+	return vkEndCommandBuffer(cmd_buf);
 }
@@ -1,6 +1,19 @@
 #pragma once
 
+#include "device_memory.h"
+#include "frame_pacer.h"
 #include "glm/glm.hpp"
+#include "gpu_profiler.h"
+#include "job_system.h"
+#include "pipeline_cache.h"
+#include "pipeline_manager.h"
+#include "present_policy.h"
+#include "shader_cache.h"
+#include "specialization.h"
+#include "sync_pool.h"
+#include "uniform_ring.h"
+#include "upload.h"
+#include "vertex_layout.h"
 #include "vk_error.h"
 #include <vulkan/vulkan.h>
 #include <vector>
@@ -8,23 +21,214 @@
 struct Swapchain_Buffer {
     VkImage image;
     VkImageView view;
+    VkSemaphore render_finished_sema; //!< Signaled when rendering to the image is complete and it can be presented, null when headless
+    Device_Allocation alloc;          //!< Headless only, swapchain images belong to the swapchain
 };
 
 struct Depth_Buffer {
 	VkImage image;
 	VkImageView view;
-	VkDeviceMemory mem;
+	Device_Allocation alloc;
+};
+
+/**
+ * A swapchain and everything built on its images, kept after recreation until the frames that
+ * used them have completed.
+ */
+struct Retired_Swapchain {
+    VkSwapchainKHR swapchain;
+    std::vector<Swapchain_Buffer> buffers;
+    std::vector<VkFramebuffer> framebuffers;
+    Depth_Buffer depth_buf;
+    std::vector<VkCommandBuffer> image_cmd_bufs; //!< Pre-recorded for its framebuffers, empty if never recorded
+    uint64_t last_frame; //!< Number of the last frame submitted while it was current
 };
 
 struct Uniform_Data {
-    VkBuffer buf;
-    VkDeviceMemory mem;
-    VkDescriptorBufferInfo buf_info;
+    Uniform_Ring ring;
+    VkDescriptorBufferInfo buf_info; //!< Range of one draw's data, bound at a dynamic offset
+};
+
+/**
+ * Buffer Device_Allocator::defragment() may move, passed as its allocation's owner. Points back
+ * at the handle and allocation the renderer draws with, both are replaced by a move.
+ */
+struct Movable_Buffer {
+	VkBuffer* buf;
+	Device_Allocation* alloc;
+	VkBufferUsageFlags usage; //!< To recreate the buffer, includes the transfer usages a move copies with
+	VkDeviceSize size;
 };
 
 struct Vertex_Buffer {
 	VkBuffer buf;
-	VkDeviceMemory mem;
+	Device_Allocation alloc;
+	Movable_Buffer movable;
+};
+
+struct Index_Buffer {
+	VkBuffer buf;
+	Device_Allocation alloc;
+	Movable_Buffer movable;
+	uint32_t index_count;
+	VkIndexType index_type;
+};
+
+/**
+ * Resources owned by a single frame slot. The CPU records into a frame slot
+ * while the GPU is still executing the previous slots.
+ */
+struct Frame_Data {
+    VkCommandBuffer cmd_buf;
+    VkCommandBuffer timestamp_cmd_buf;     //!< Ends the GPU frame scope after a pre-recorded command buffer
+    VkFence in_flight_fence;               //!< Signaled when the GPU has finished the slot's submission
+    bool submitted;                        //!< The fence has been submitted at least once
+    uint64_t frame_number;                 //!< Of the slot's last submission
+    std::vector<VkSemaphore> pending_semas; //!< Returned to the sync pool once the slot's submission completes
+
+    // Parallel recording, one pool and secondary buffer per draw range
+    std::vector<VkCommandPool> record_pools;      //!< Reset once the slot's submission completes
+    std::vector<VkCommandBuffer> record_cmd_bufs; //!< Secondary, allocated from the matching pool
+};
+
+/**
+ * CPU side presentation timings, to compare present modes. A frame that has to wait for
+ * presentation to free an image waits in vkAcquireNextImageKHR.
+ */
+struct Present_Stats {
+    Frame_Time_Histogram acquire_wait;       //!< Blocked in vkAcquireNextImageKHR
+    Frame_Time_Histogram acquire_to_present; //!< From starting to acquire to vkQueuePresentKHR returning
+};
+
+/**
+ * CPU time spent in each part of a render() call.
+ */
+struct Frame_Phase_Times {
+    double wait_ms;    //!< Waiting for the frame slot's previous submission, retiring it
+    double acquire_ms; //!< Acquiring the image, including waiting for it to be free
+    double record_ms;  //!< Recording, or checking the pre-recorded buffers are current
+    double submit_ms;  //!< Flushing uploads and vkQueueSubmit
+    double present_ms; //!< vkQueuePresentKHR, 0 when headless
+};
+
+/**
+ * Mesh vertex as uploaded, 12 bytes instead of the 32 of the float Vertex.
+ */
+struct Packed_Vertex {
+    Snorm16x4 pos; //!< Model space position in [-1, 1], w = 1
+    Unorm8x4 col;
+};
+
+template <>
+struct Vertex_Layout<Packed_Vertex> {
+    static constexpr Vertex_Attrib attribs[] = {
+        VERTEX_ATTRIB(Packed_Vertex, pos, 0),
+        VERTEX_ATTRIB(Packed_Vertex, col, 1),
+    };
+};
+
+/**
+ * Mesh vertex uploaded unpacked, as a baseline for the packed format.
+ */
+struct Float_Vertex {
+    glm::vec4 pos;
+    glm::vec4 col;
+};
+
+template <>
+struct Vertex_Layout<Float_Vertex> {
+    static constexpr Vertex_Attrib attribs[] = {
+        VERTEX_ATTRIB(Float_Vertex, pos, 0),
+        VERTEX_ATTRIB(Float_Vertex, col, 1),
+    };
+};
+
+static_assert(vertex_location_count<Packed_Vertex>() == vertex_location_count<Float_Vertex>(),
+    "Vertex formats share the attribute array and the shaders");
+
+/**
+ * Vertex buffer layout of the mesh. The shaders read vec4s, so they work with either.
+ */
+enum class Vertex_Format : uint8_t {
+    Packed, //!< Packed_Vertex
+    Float,  //!< Float_Vertex
+};
+
+char const* vertex_format_name(Vertex_Format format);
+
+/**
+ * Per-instance vertex stream entry, read at VK_VERTEX_INPUT_RATE_INSTANCE.
+ */
+struct Instance_Data {
+    glm::mat4 model;
+    glm::vec4 color; //!< Multiplied with the vertex colour
+};
+
+template <>
+struct Vertex_Layout<Instance_Data> {
+    static constexpr Vertex_Attrib attribs[] = {
+        VERTEX_ATTRIB(Instance_Data, model, 2),
+        VERTEX_ATTRIB(Instance_Data, color, 6),
+    };
+};
+
+/**
+ * Persistently mapped instance stream with one region per frame in flight, plus a static
+ * region read by pre-recorded command buffers.
+ */
+struct Instance_Buffer {
+    VkBuffer buf;
+    Device_Allocation alloc;
+    Movable_Buffer movable;
+    uint32_t capacity;             //!< Instances per region
+    std::vector<uint32_t> counts;  //!< Instances written to each region
+    uint32_t latest_region;        //!< Written by the latest write_instances()
+};
+
+/**
+ * How per-draw transforms reach the vertex shader.
+ */
+enum class Draw_Path : uint8_t {
+    Uniform_Dynamic, //!< Uniform ring allocation, bound with a dynamic offset per draw
+    Push_Constant,   //!< vkCmdPushConstants per draw, uses simple.vert specialized with push_transform
+    Instanced,       //!< One draw for every instance in the instance buffer, uses simple_instanced.vert
+};
+static constexpr uint32_t num_draw_paths = 3;
+
+/**
+ * Specialization constants of simple.vert.
+ */
+namespace Simple_Vert_Spec {
+    constexpr Spec_Constant<bool> push_transform = { 0 }; //!< Transform from push constants instead of the uniform buffer
+}
+
+char const* draw_path_name(Draw_Path path);
+glm::mat4 scene_projection(uint32_t width, uint32_t height);
+
+/**
+ * Pipeline state of a draw path, its pipeline is created the first time the path is drawn.
+ */
+struct Draw_Path_Pipeline {
+    Graphics_Pipeline_State state;
+    Pipeline_Key key; //!< Of state, computed once
+};
+
+/**
+ * State of one scene recording, shared by every thread recording part of it.
+ *
+ * Uniform data is reserved before any draw is recorded, so recording threads write their own
+ * slots and never touch the uniform ring.
+ */
+struct Scene_Draws {
+    Draw_Path path;            //!< Path recorded, the uniform path while draw_path's pipeline compiles
+    VkPipeline pipeline;
+    glm::mat4 view_projection;
+    uint32_t num_draws;        //!< Draw calls, at most 1 for Draw_Path::Instanced
+    uint8_t* mvp_data;         //!< Draw_Path::Uniform_Dynamic: mapped MVP slot of the first draw
+    uint32_t mvp_offset;       //!< Dynamic offset of mvp_data, or of view_projection when instanced
+    uint32_t mvp_stride;       //!< Distance between the MVP slots of consecutive draws
+    uint32_t instance_region;  //!< Draw_Path::Instanced: region of the instance buffer read
+    uint32_t instance_count;
 };
 
 struct Vulkan_Instance_Info
@@ -42,12 +246,22 @@ struct Vulkan_Instance_Info
     VkQueue gr_queue;
     VkQueue present_queue;
 
+    bool headless;                     //!< Render to offscreen images, no surface or swapchain
+
     VkSurfaceKHR surface;
     VkSurfaceCapabilitiesKHR surface_capabilities;
     VkSwapchainKHR swapchain;
     VkFormat swapchain_format;
     std::vector<Swapchain_Buffer> swapchain_buffers; //!< Swapchain image buffers
 	VkExtent2D swapchain_extent;
+	Present_Profile present_profile;
+	VkPresentModeKHR present_mode;     //!< Chosen for present_profile from the modes the surface supports
+	Present_Stats present_stats;
+	Frame_Phase_Times phase_times;     //!< Of the last render()
+	Gpu_Profiler gpu_profiler;         //!< GPU time of the render pass and draws, frames.size() frames late
+	bool swapchain_dirty;              //!< Out of date or suboptimal, recreated before the next frame
+	VkExtent2D requested_extent;       //!< Used when the surface leaves the extent to the swapchain
+	std::vector<Retired_Swapchain> retired_swapchains;
 
 	Depth_Buffer depth_buf;
 
@@ -57,6 +271,10 @@ struct Vulkan_Instance_Info
     glm::mat4 clip;
     glm::mat4 mvp;
 
+    std::vector<glm::mat4> draw_models; //!< Model transform of each cube drawn
+    Draw_Path draw_path;
+    Vertex_Format vertex_format;
+
     Uniform_Data uniform_data;
     
     std::vector<VkDescriptorSetLayout> desc_set_layouts;
@@ -68,28 +286,56 @@ struct Vulkan_Instance_Info
     VkRenderPass render_pass;
 
 	VkPipelineShaderStageCreateInfo shader_stages_ci[2];
+	VkShaderModule instanced_vert_module; //!< Vertex stage of the instanced draw path
+	Shader_Cache shader_cache;            //!< Owns the shader modules
 
 	std::vector<VkFramebuffer> framebuffers;
 
 	Vertex_Buffer vertex_buffer;
+	Index_Buffer index_buffer;
 	VkVertexInputBindingDescription vertex_input_binding;
-	VkVertexInputAttributeDescription vertex_input_attribs[2];
+	VkVertexInputAttributeDescription vertex_input_attribs[vertex_location_count<Packed_Vertex>()];
 
-    VkPipeline pipeline;
+	Instance_Buffer instance_buffer;
+	VkVertexInputBindingDescription instance_input_binding;
+	VkVertexInputAttributeDescription instance_input_attribs[vertex_location_count<Instance_Data>()];
+
+    Pipeline_Handle pipeline;        //!< Draw_Path::Uniform_Dynamic, created up front as the fallback while others compile
+    Draw_Path_Pipeline draw_path_pipelines[num_draw_paths];
+    Pipeline_Cache pipeline_cache;   //!< Shared by every pipeline creation
+    Thread_Pool thread_pool;
+    Pipeline_Manager pipelines;
+    uint32_t pipelines_completed;    //!< pipelines.num_completed when the command buffers were last recorded
 
-    VkViewport viewport;
-    VkRect2D scissor;
     static constexpr uint32_t num_viewports = 1;
     static constexpr uint32_t num_scissors = 1;
 
-	VkSemaphore image_acquired_sema;
 	uint32_t current_image;
 
+    std::vector<Frame_Data> frames;        //!< Frame-in-flight ring
+    uint32_t current_frame;                //!< Index of the frame slot being recorded
+    std::vector<VkFence> images_in_flight; //!< Fence of the last frame slot that rendered to each swapchain image
+    uint64_t num_submitted_frames;         //!< Frames are numbered from 1 in submission order
+    uint64_t num_completed_frames;         //!< Every frame up to this number has completed
+
+    Sync_Pool sync_pool;
+    Device_Allocator mem_allocator;
+    Upload_Service uploader;
+
+    bool prerecord_cmd_bufs;                     //!< Record one command buffer per swapchain image once and resubmit it
+    std::vector<VkCommandBuffer> image_cmd_bufs; //!< Pre-recorded command buffer for each framebuffer
+    bool image_cmd_bufs_dirty;                   //!< Pre-recorded command buffers must be re-recorded
+    uint32_t static_region;                      //!< Uniform_Ring static region image_cmd_bufs read
+    uint64_t static_region_last_frame[Uniform_Ring::num_static_regions]; //!< Number of the last frame reading each
+
+    bool parallel_recording;                     //!< Record per-frame draws as jobs into secondary buffers
+    Job_System* jobs;                            //!< Not owned
+    uint32_t max_record_ranges;                  //!< Caps the ranges a recording is split into, 0 for one per job thread
+
     struct Logical_Device
     {
         VkDevice device;
         VkCommandPool gr_cmd_pool;
-        VkCommandBuffer gr_cmd_buf;
     } logical;
     
     struct System
@@ -98,6 +344,7 @@ struct Vulkan_Instance_Info
         struct Physical_Device
         {
             VkPhysicalDevice device;
+            VkPhysicalDeviceProperties properties;
             std::vector<VkQueueFamilyProperties> queue_family_properties;
 			VkPhysicalDeviceMemoryProperties memory_properties;
 
@@ -115,30 +362,68 @@ struct Vulkan_Instance_Info
     Status create_logical_device();
     Status setup_device_queue();
     Status create_command_pool();
-    Status create_command_buffer();
+    Status setup_frames_in_flight(uint32_t num_frames_in_flight);
+    Status setup_upload_service(VkDeviceSize staging_size);
+    Status setup_pipeline_cache(char const* path);
+    Status setup_pipeline_manager(uint32_t num_compile_threads);
+    Status setup_parallel_recording(Job_System* job_system);
+    Status setup_gpu_profiler();
 
 #ifdef _WIN32
     Status create_surface(Window const& window);
-#else
-#   error Unsupported platform
 #endif
 
-    Status setup_swapchain(uint32_t num_buf_frames, uint32_t image_width, uint32_t image_height);
+    Status setup_swapchain(Present_Profile profile, uint32_t image_width, uint32_t image_height);
+    Status setup_offscreen_target(uint32_t image_width, uint32_t image_height);
+    Status create_swapchain();
+    void request_swapchain_resize(uint32_t width, uint32_t height);
+    Status recreate_swapchain(bool* recreated);
+    Status wait_for_frame(uint64_t frame_number);
+    void release_retired_swapchains();
+    void destroy_swapchain_resources(Retired_Swapchain& retired);
     bool memory_type_from_properties(uint32_t type_bits, VkFlags requirements_mask, uint32_t* type_index);
+    Status allocate_buffer_memory(VkBuffer buf, VkFlags requirements_mask, Device_Allocation* alloc,
+        Movable_Buffer* movable = nullptr);
+    Status allocate_image_memory(VkImage image, VkFlags requirements_mask, Device_Allocation* alloc);
+    Status create_static_buffer(VkBufferUsageFlags usage, void const* data, VkDeviceSize size,
+        VkBuffer* buf, Device_Allocation* alloc, Movable_Buffer* movable = nullptr);
+    Status defragment_device_memory();
+    Status move_buffer(Movable_Buffer* movable, Device_Allocation const& new_alloc);
     Status setup_depth_buffer();
     Status setup_model_view_projection();
-    Status setup_uniform_buffer();
+    Status setup_uniform_buffer(uint32_t max_draws_per_frame);
     Status setup_pipeline();
     Status setup_render_pass();
 	Status setup_shaders();
 	Status setup_framebuffer();
-	Status setup_vertex_buffer();
+	Status setup_vertex_buffer(Vertex_Format format = Vertex_Format::Packed);
+	Status set_vertex_format(Vertex_Format format);
+	Status setup_instance_buffer(uint32_t max_instances);
+	Status write_instances(Instance_Data const* instances, uint32_t count);
+	Instance_Data const* latest_instances(uint32_t* count) const;
 	Status setup_graphics_pipeline();
+	Pipeline_Handle draw_path_pipeline(Draw_Path path);
 
     Status render();
+    Status retire_frame(Frame_Data& frame);
+    Status prepare_scene_draws(Scene_Draws* draws);
+    void begin_scene_render_pass(VkCommandBuffer cmd_buf, uint32_t image_index, VkSubpassContents contents);
+    void bind_scene_state(VkCommandBuffer cmd_buf, Scene_Draws const& draws);
+    void record_draws(VkCommandBuffer cmd_buf, Scene_Draws const& draws, uint32_t first_draw, uint32_t num_draws);
+    VkResult record_scene_secondary(VkCommandBuffer cmd_buf, VkCommandBufferInheritanceInfo const& inheritance,
+        Scene_Draws const& draws, uint32_t first_draw, uint32_t num_draws);
+    Status record_scene_commands(VkCommandBuffer cmd_buf, uint32_t image_index, Gpu_Profiler* profiler = nullptr);
+    void record_scene_commands(VkCommandBuffer cmd_buf, uint32_t image_index, Scene_Draws const& draws,
+        Gpu_Profiler* profiler = nullptr);
+    Status record_scene_commands_parallel(VkCommandBuffer cmd_buf, uint32_t image_index, Frame_Data& frame,
+        Gpu_Profiler* profiler = nullptr);
+    Status reset_record_pools(Frame_Data& frame);
+    void mark_cmd_bufs_dirty();
+    Status record_image_cmd_bufs();
 
+    void log_present_stats() const;
     void cleanup();
 
-	VkResult exec_begin_gr_command_buffer();
-	VkResult exec_end_gr_command_buffer();
+	VkResult exec_begin_gr_command_buffer(VkCommandBuffer cmd_buf, VkCommandBufferUsageFlags flags);
+	VkResult exec_end_gr_command_buffer(VkCommandBuffer cmd_buf);
 };
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "shader_cache.h"
+
+#include "hash.h"
+#include <cassert>
+#include <cstring>
+
+#ifdef EMBED_SHADERS
+// Generated by the pre-build step with glslangvalidator --vn
+#   include "simple.vert.spv.h"
+#   include "simple_instanced.vert.spv.h"
+#   include "simple.frag.spv.h"
+#endif
+
+// Directory the .spv files are loaded from, the CMake build points it at its build directory.
+// Empty loads them relative to the working directory, where the vcxproj post-build puts them.
+#ifndef SHADER_DIR
+#   define SHADER_DIR ""
+#endif
+
+namespace {
+    static constexpr uint32_t spirv_magic = 0x07230203;
+    static constexpr size_t spirv_header_size = 5 * sizeof(uint32_t);
+
+#ifdef EMBED_SHADERS
+    Embedded_Shader const embedded_shaders[] = {
+        { "simple.vert.spv", simple_vert_spv, sizeof(simple_vert_spv) },
+        { "simple_instanced.vert.spv", simple_instanced_vert_spv, sizeof(simple_instanced_vert_spv) },
+        { "simple.frag.spv", simple_frag_spv, sizeof(simple_frag_spv) },
+    };
+#endif
+}
+
+/**
+ * Check code is word sized and starts with the SPIR-V header in host byte order, which
+ * vkCreateShaderModule requires.
+ */
+bool validate_spirv(void const* code, size_t size, char const* name) {
+    if (size < spirv_header_size || size % sizeof(uint32_t) != 0) {
+        log_error("%s is not SPIR-V, size %zu is not a whole number of words\n", name, size);
+        return false;
+    }
+    if (reinterpret_cast<uintptr_t>(code) % alignof(uint32_t) != 0) {
+        log_error("%s is not word aligned in memory\n", name);
+        return false;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, code, sizeof(magic));
+    if (magic != spirv_magic) {
+        log_error("%s is not SPIR-V, bad magic 0x%08x\n", name, magic);
+        return false;
+    }
+    return true;
+}
+
+Embedded_Shader const* find_embedded_shader(char const* path) {
+#ifdef EMBED_SHADERS
+    for (Embedded_Shader const& shader : embedded_shaders) {
+        if (strcmp(shader.path, path) == 0) {
+            return &shader;
+        }
+    }
+#else
+    (void)path;
+#endif
+    return nullptr;
+}
+
+void Shader_Cache::init(VkDevice device) {
+    this->device = device;
+    stats = {};
+}
+
+void Shader_Cache::destroy() {
+    for (auto& hash_modules : by_hash) {
+        for (Module& module : hash_modules.second) {
+            vkDestroyShaderModule(device, module.module, nullptr);
+            unmap_file(&module.file);
+        }
+    }
+    by_hash.clear();
+    by_path.clear();
+}
+
+/**
+ * Module for a SPIR-V file in SHADER_DIR, embedded code is used instead if the binary has it.
+ */
+Status Shader_Cache::load(char const* path, VkShaderModule* module) {
+    assert(path && module);
+    ++stats.num_loads;
+
+    auto it = by_path.find(path);
+    if (it != by_path.end()) {
+        ++stats.num_path_hits;
+        *module = it->second;
+        return STATUS_OK;
+    }
+
+    Embedded_Shader const* embedded = find_embedded_shader(path);
+    if (embedded) {
+        ++stats.num_embedded;
+        STATUS_CHECK(create_module(embedded->code, embedded->size, path, nullptr, module));
+    }
+    else {
+        const std::string file_path = std::string(SHADER_DIR) + path;
+        Mapped_File file;
+        if (!map_file(file_path.c_str(), &file)) {
+            return !STATUS_OK;
+        }
+        stats.bytes_mapped += file.size;
+
+        // Views start on a page boundary, so the code is word aligned. A new module takes the
+        // mapping, it is only left to unmap here if the code matched an existing module.
+        const Status status = create_module(static_cast<uint32_t const*>(file.data), file.size, path, &file, module);
+        unmap_file(&file);
+        STATUS_CHECK(status);
+    }
+
+    by_path.emplace(path, *module);
+    return STATUS_OK;
+}
+
+/**
+ * Module for SPIR-V in memory, shared with any earlier module of identical code. The code
+ * must stay valid until destroy(), later calls compare against it.
+ *
+ * \param name For error messages.
+ */
+Status Shader_Cache::create(uint32_t const* code, size_t size, char const* name, VkShaderModule* module) {
+    ++stats.num_loads;
+    return create_module(code, size, name, nullptr, module);
+}
+
+/**
+ * \param file Mapping code points into, or nullptr. Moved into the module if one is created.
+ */
+Status Shader_Cache::create_module(uint32_t const* code, size_t size, char const* name, Mapped_File* file,
+    VkShaderModule* module)
+{
+    assert(code && name && module);
+
+    if (!validate_spirv(code, size, name)) {
+        return !STATUS_OK;
+    }
+
+    const uint64_t hash = hash_bytes(code, size);
+    std::vector<Module>& modules = by_hash[hash];
+    for (Module const& existing : modules) {
+        if (existing.size == size && memcmp(existing.code, code, size) == 0) {
+            ++stats.num_content_hits;
+            *module = existing.module;
+            return STATUS_OK;
+        }
+    }
+
+    VkShaderModuleCreateInfo module_ci = {};
+    module_ci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_ci.pNext = nullptr;
+    module_ci.flags = 0;
+    module_ci.codeSize = size;
+    module_ci.pCode = code;
+    VK_CHECK(vkCreateShaderModule(device, &module_ci, nullptr, module));
+
+    Module new_module = {};
+    new_module.module = *module;
+    new_module.code = code;
+    new_module.size = size;
+    if (file) {
+        new_module.file = *file;
+        *file = {};
+    }
+    modules.push_back(new_module);
+    ++stats.num_modules;
+    return STATUS_OK;
+}
+
+void Shader_Cache::log_stats() const {
+    log_info("Shader cache: %u modules, %u loads, %u path hits, %u content hits, %u embedded, %zu bytes mapped\n",
+        stats.num_modules, stats.num_loads, stats.num_path_hits, stats.num_content_hits, stats.num_embedded,
+        stats.bytes_mapped);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "status.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Shader_Cache_Stats {
+    uint32_t num_loads;        //!< load() and create() calls
+    uint32_t num_path_hits;    //!< Loads answered by a path seen before, no file access
+    uint32_t num_content_hits; //!< Distinct sources with identical code sharing a module
+    uint32_t num_embedded;     //!< Loads served from SPIR-V compiled into the binary
+    uint32_t num_modules;
+    size_t bytes_mapped;
+};
+
+/**
+ * SPIR-V compiled into the binary, see EMBED_SHADERS.
+ */
+struct Embedded_Shader {
+    char const* path;      //!< File the code would otherwise be loaded from
+    uint32_t const* code;
+    size_t size;           //!< In bytes
+};
+
+/**
+ * Owns every VkShaderModule, one per distinct SPIR-V blob.
+ *
+ * Files are mapped and handed to vkCreateShaderModule without an intermediate copy. Modules
+ * are deduplicated by content, found by hash and then compared, so pipelines referencing the
+ * same code share a module however it was loaded. The comparison reads the code where it
+ * already lives, files stay mapped while their module exists and embedded code is static, so
+ * nothing is copied. Modules live until destroy().
+ *
+ * With EMBED_SHADERS defined, code generated into <shader>.spv.h at build time is used for
+ * known paths and nothing is read from disk.
+ */
+struct Shader_Cache {
+    struct Module {
+        VkShaderModule module;
+        uint32_t const* code; //!< Compared on a hash match, the hash alone can collide
+        size_t size;          //!< In bytes
+        Mapped_File file;     //!< Holds code when it was loaded from a file, unmapped by destroy()
+    };
+
+    VkDevice device;
+    std::unordered_map<std::string, VkShaderModule> by_path;
+    std::unordered_map<uint64_t, std::vector<Module>> by_hash; //!< Content hash to modules
+    Shader_Cache_Stats stats;
+
+    void init(VkDevice device);
+    void destroy();
+
+    Status load(char const* path, VkShaderModule* module);
+    Status create(uint32_t const* code, size_t size, char const* name, VkShaderModule* module);
+
+    void log_stats() const;
+
+    Status create_module(uint32_t const* code, size_t size, char const* name, Mapped_File* file,
+        VkShaderModule* module);
+};
+
+bool validate_spirv(void const* code, size_t size, char const* name);
+Embedded_Shader const* find_embedded_shader(char const* path);
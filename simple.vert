@@ -2,15 +2,28 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+// Where the transform comes from, set per pipeline, see Simple_Vert_Spec in renderer.h
+layout (constant_id = 0) const bool push_transform = false;
+
 layout (std140, binding = 0) uniform buffer_vals {
 	mat4 mvp;
 } buf_vals;
 
+layout (push_constant) uniform push_vals {
+	mat4 mvp;
+} push_vals;
+
 layout (location = 0) in vec4 pos;
 layout (location = 1) in vec4 in_color;
 layout (location = 0) out vec4 out_color;
 
 void main() {
 	out_color = in_color;
-	gl_Position = buf_vals.mvp * pos;
-}
\ No newline at end of file
+	// Folded when the pipeline is created, only one branch is left
+	if (push_transform) {
+		gl_Position = push_vals.mvp * pos;
+	}
+	else {
+		gl_Position = buf_vals.mvp * pos;
+	}
+}
@@ -0,0 +1,19 @@
+#version 400
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// mvp holds view projection, the model transform comes from the instance stream
+layout (std140, binding = 0) uniform buffer_vals {
+	mat4 mvp;
+} buf_vals;
+
+layout (location = 0) in vec4 pos;
+layout (location = 1) in vec4 in_color;
+layout (location = 2) in mat4 instance_model; // locations 2 to 5
+layout (location = 6) in vec4 instance_color;
+layout (location = 0) out vec4 out_color;
+
+void main() {
+	out_color = in_color * instance_color;
+	gl_Position = buf_vals.mvp * instance_model * pos;
+}
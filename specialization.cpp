@@ -0,0 +1,43 @@
+#include "specialization.h"
+
+#include <cassert>
+
+/**
+ * Set a constant's value, replacing any previous one.
+ */
+void Specialization::set_bytes(uint32_t constant_id, void const* value, size_t size) {
+    assert(value && size > 0);
+
+    for (VkSpecializationMapEntry const& entry : map) {
+        if (entry.constantID == constant_id) {
+            assert(entry.size == size);
+            memcpy(data.data() + entry.offset, value, size);
+            return;
+        }
+    }
+
+    VkSpecializationMapEntry entry;
+    entry.constantID = constant_id;
+    entry.offset = static_cast<uint32_t>(data.size());
+    entry.size = size;
+    map.push_back(entry);
+
+    uint8_t const* bytes = static_cast<uint8_t const*>(value);
+    data.insert(data.end(), bytes, bytes + size);
+}
+
+/**
+ * \return Info to put in VkPipelineShaderStageCreateInfo::pSpecializationInfo, null if no
+ *  constant is set. Valid until the next set().
+ */
+VkSpecializationInfo const* Specialization::get_info() {
+    if (map.empty()) {
+        return nullptr;
+    }
+
+    info.mapEntryCount = static_cast<uint32_t>(map.size());
+    info.pMapEntries = map.data();
+    info.dataSize = data.size();
+    info.pData = data.data();
+    return &info;
+}
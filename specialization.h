@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/**
+ * How a specialization constant of type T is laid out in VkSpecializationInfo::pData. GLSL bools
+ * are 32-bit.
+ */
+template <typename T>
+struct Spec_Storage {
+    static_assert(std::is_same<T, int32_t>::value || std::is_same<T, uint32_t>::value
+        || std::is_same<T, float>::value, "Unsupported specialization constant type");
+    using Type = T;
+};
+
+template <>
+struct Spec_Storage<bool> {
+    using Type = VkBool32;
+};
+
+/**
+ * A constant declared in a shader with layout (constant_id = id). Declare them next to the code
+ * that uses the shader so the id and type are written down once:
+ *   constexpr Spec_Constant<bool> push_transform = { 0 };
+ */
+template <typename T>
+struct Spec_Constant {
+    uint32_t id;
+};
+
+/**
+ * Values for the specialization constants of one shader stage.
+ *
+ * Constants left unset keep the default from the shader. Different values give different
+ * pipelines, the driver folds the constants and removes branches depending on them.
+ */
+struct Specialization {
+    std::vector<VkSpecializationMapEntry> map;
+    std::vector<uint8_t> data;
+    VkSpecializationInfo info;
+
+    template <typename T>
+    void set(Spec_Constant<T> constant, T value) {
+        const typename Spec_Storage<T>::Type stored = static_cast<typename Spec_Storage<T>::Type>(value);
+        set_bytes(constant.id, &stored, sizeof(stored));
+    }
+
+    void set_bytes(uint32_t constant_id, void const* value, size_t size);
+    VkSpecializationInfo const* get_info();
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Fixed capacity lock-free queue between exactly one producer thread and one consumer thread.
+ * Neither side ever blocks, push() fails when the queue is full.
+ */
+template <typename T, uint32_t Capacity>
+struct Spsc_Queue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    // Each index on its own cache line, it is only written by one side
+    alignas(64) std::atomic<uint32_t> head; //!< Next item to pop, written by the consumer
+    alignas(64) std::atomic<uint32_t> tail; //!< Next slot to push, written by the producer
+    alignas(64) T items[Capacity];
+
+    void init() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Producer only.
+     */
+    bool push(T const& item) {
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer only.
+     */
+    bool pop(T* item) {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *item = items[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
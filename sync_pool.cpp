@@ -0,0 +1,107 @@
+#include "sync_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+void Sync_Pool::init(VkDevice device) {
+    this->device = device;
+    free_semaphores.clear();
+    free_fences.clear();
+    stats = {};
+}
+
+/**
+ * Live counts equal to the peaks show the pool stopped creating objects once warmed up.
+ */
+void Sync_Pool::log_stats() const {
+    log_info("Sync pool: %u semaphores (peak %u, %u in use), %u fences (peak %u, %u in use)\n",
+        stats.live_semaphores, stats.peak_semaphores, stats.in_use_semaphores,
+        stats.live_fences, stats.peak_fences, stats.in_use_fences);
+}
+
+void Sync_Pool::destroy() {
+    if (stats.in_use_semaphores != 0 || stats.in_use_fences != 0) {
+        log_error("Sync pool destroyed with %u semaphores and %u fences still in use\n",
+            stats.in_use_semaphores, stats.in_use_fences);
+    }
+
+    for (VkSemaphore sema : free_semaphores) {
+        vkDestroySemaphore(device, sema, nullptr);
+    }
+    for (VkFence fence : free_fences) {
+        vkDestroyFence(device, fence, nullptr);
+    }
+
+    stats.live_semaphores -= static_cast<uint32_t>(free_semaphores.size());
+    stats.live_fences -= static_cast<uint32_t>(free_fences.size());
+    free_semaphores.clear();
+    free_fences.clear();
+}
+
+Status Sync_Pool::acquire_semaphore(VkSemaphore* sema) {
+    assert(sema);
+
+    if (!free_semaphores.empty()) {
+        *sema = free_semaphores.back();
+        free_semaphores.pop_back();
+    }
+    else {
+        VkSemaphoreCreateInfo sema_ci = {};
+        sema_ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        sema_ci.pNext = nullptr;
+        sema_ci.flags = 0;
+        VK_CHECK(vkCreateSemaphore(device, &sema_ci, nullptr, sema));
+
+        ++stats.live_semaphores;
+        stats.peak_semaphores = std::max(stats.peak_semaphores, stats.live_semaphores);
+    }
+
+    ++stats.in_use_semaphores;
+    return STATUS_OK;
+}
+
+/**
+ * \param sema Semaphore with no pending signal or wait operations.
+ */
+void Sync_Pool::release_semaphore(VkSemaphore sema) {
+    assert(sema != VK_NULL_HANDLE);
+    assert(stats.in_use_semaphores > 0);
+
+    free_semaphores.push_back(sema);
+    --stats.in_use_semaphores;
+}
+
+Status Sync_Pool::acquire_fence(VkFence* fence) {
+    assert(fence);
+
+    if (!free_fences.empty()) {
+        *fence = free_fences.back();
+        free_fences.pop_back();
+    }
+    else {
+        VkFenceCreateInfo fence_ci = {};
+        fence_ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_ci.pNext = nullptr;
+        fence_ci.flags = 0;
+        VK_CHECK(vkCreateFence(device, &fence_ci, nullptr, fence));
+
+        ++stats.live_fences;
+        stats.peak_fences = std::max(stats.peak_fences, stats.live_fences);
+    }
+
+    ++stats.in_use_fences;
+    return STATUS_OK;
+}
+
+/**
+ * \param fence Fence that is signaled or was never submitted. Reset before being pooled.
+ */
+Status Sync_Pool::release_fence(VkFence fence) {
+    assert(fence != VK_NULL_HANDLE);
+    assert(stats.in_use_fences > 0);
+
+    VK_CHECK(vkResetFences(device, 1, &fence));
+    free_fences.push_back(fence);
+    --stats.in_use_fences;
+    return STATUS_OK;
+}
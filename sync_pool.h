@@ -0,0 +1,40 @@
+#pragma once
+
+#include "status.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+#include <vector>
+
+struct Sync_Pool_Stats {
+    uint32_t live_semaphores;   //!< Semaphores currently created, pooled or in use
+    uint32_t peak_semaphores;   //!< High water mark of live_semaphores
+    uint32_t in_use_semaphores; //!< Semaphores handed out and not yet released
+    uint32_t live_fences;
+    uint32_t peak_fences;
+    uint32_t in_use_fences;
+};
+
+/**
+ * Recycles semaphores and fences instead of creating them every frame.
+ *
+ * Objects are handed out unsignaled. Callers release them once the GPU is
+ * known to be done with them (ie. the fence of the submission that used them
+ * has signaled). Live counts stay flat once the working set has been created.
+ */
+struct Sync_Pool {
+    VkDevice device;
+    std::vector<VkSemaphore> free_semaphores;
+    std::vector<VkFence> free_fences;
+    Sync_Pool_Stats stats;
+
+    void init(VkDevice device);
+    void destroy();
+
+    Status acquire_semaphore(VkSemaphore* sema);
+    void release_semaphore(VkSemaphore sema);
+
+    Status acquire_fence(VkFence* fence);
+    Status release_fence(VkFence fence);
+
+    void log_stats() const;
+};
@@ -0,0 +1,79 @@
+#include "thread_pool.h"
+
+#include "cpu_profiler.h"
+#include <cassert>
+
+/**
+ * \param num_threads Number of workers, at least 1.
+ */
+void Thread_Pool::init(uint32_t num_threads) {
+    assert(num_threads > 0);
+    num_running = 0;
+    stopping = false;
+
+    workers.reserve(num_threads);
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        workers.emplace_back(&Thread_Pool::worker_loop, this);
+    }
+}
+
+/**
+ * Finish the queued tasks and join the workers.
+ */
+void Thread_Pool::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_cv.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void Thread_Pool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        assert(!stopping);
+        tasks.push_back(std::move(task));
+    }
+    task_cv.notify_one();
+}
+
+/**
+ * Block until every submitted task has finished.
+ */
+void Thread_Pool::wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle_cv.wait(lock, [this] { return tasks.empty() && num_running == 0; });
+}
+
+void Thread_Pool::worker_loop() {
+    PROFILE_THREAD_NAME("compile worker");
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        task_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+            // Stopping and drained
+            return;
+        }
+
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        ++num_running;
+
+        lock.unlock();
+        {
+            PROFILE_ZONE("pool task");
+            task();
+        }
+        lock.lock();
+
+        --num_running;
+        if (tasks.empty() && num_running == 0) {
+            idle_cv.notify_all();
+        }
+    }
+}
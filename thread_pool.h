@@ -0,0 +1,32 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads running tasks in submission order.
+ *
+ * For long running work (pipeline compilation, file IO) that must stay off the render thread.
+ * Tasks must not throw.
+ */
+struct Thread_Pool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable task_cv; //!< Signaled when a task is queued or the pool stops
+    std::condition_variable idle_cv; //!< Signaled when the last running task finishes
+    std::deque<std::function<void()>> tasks;
+    uint32_t num_running;
+    bool stopping;
+
+    void init(uint32_t num_threads);
+    void destroy();
+
+    void submit(std::function<void()> task);
+    void wait_idle();
+
+    void worker_loop();
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Latest-value handoff from one writer thread to one reader thread through three copies of T.
+ *
+ * The writer fills its back buffer and publishes it, the reader picks up the most recently
+ * published buffer. Each side always owns one buffer outright and the third is swapped with a
+ * single atomic exchange, so neither side ever waits for the other. Values published faster
+ * than they are read are skipped.
+ *
+ * NOTE: The back buffer holds an older value after publish(), the writer must write every
+ * field it cares about each time.
+ */
+template <typename T>
+struct Triple_Buffer {
+    static constexpr uint8_t index_mask = 0x3;
+    static constexpr uint8_t fresh_bit = 0x4; //!< Set in middle when it was published and not read yet
+
+    T buffers[3];
+    std::atomic<uint8_t> middle; //!< Index of the buffer owned by neither side
+    uint8_t back;                //!< Writer's buffer
+    uint8_t front;               //!< Reader's buffer
+
+    void init() {
+        back = 0;
+        middle.store(1, std::memory_order_relaxed);
+        front = 2;
+    }
+
+    /**
+     * Writer only.
+     */
+    T& write_buffer() {
+        return buffers[back];
+    }
+
+    /**
+     * Writer only. Hand the back buffer to the reader.
+     */
+    void publish() {
+        back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    /**
+     * Reader only. Switch to the latest published buffer.
+     *
+     * \return false if nothing was published since the last call, read_buffer() is unchanged.
+     */
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & fresh_bit)) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    /**
+     * Reader only.
+     */
+    T const& read_buffer() const {
+        return buffers[front];
+    }
+};
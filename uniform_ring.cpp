@@ -0,0 +1,144 @@
+#include "uniform_ring.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+    VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+/**
+ * \param region_size Bytes of uniform data available to a frame, rounded up to the offset alignment.
+ * \param num_frame_regions Number of frames in flight.
+ */
+Status Uniform_Ring::init(VkDevice device, Device_Allocator* allocator, VkPhysicalDeviceLimits const& limits,
+    VkDeviceSize region_size, uint32_t num_frame_regions)
+{
+    assert(allocator);
+    assert(region_size > 0 && num_frame_regions > 0);
+
+    this->device = device;
+    this->allocator = allocator;
+    this->num_frame_regions = num_frame_regions;
+    alignment = std::max<VkDeviceSize>(limits.minUniformBufferOffsetAlignment, 1);
+    this->region_size = align_up(region_size, alignment);
+    region_begin = 0;
+    region_head = 0;
+    stats = {};
+
+    // Frame regions followed by the static regions
+    VkBufferCreateInfo buf_ci = {};
+    buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buf_ci.pNext = nullptr;
+    buf_ci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    buf_ci.size = this->region_size * (num_frame_regions + num_static_regions);
+    buf_ci.queueFamilyIndexCount = 0;
+    buf_ci.pQueueFamilyIndices = nullptr;
+    buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buf_ci.flags = 0;
+    VK_CHECK(vkCreateBuffer(device, &buf_ci, nullptr, &buf));
+
+    VkMemoryRequirements mem_reqs = {};
+    vkGetBufferMemoryRequirements(device, buf, &mem_reqs);
+
+    // Coherent so writes never need an explicit flush
+    uint32_t memory_type = 0;
+    if (!allocator->find_memory_type(mem_reqs.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memory_type))
+    {
+        log_error("Unable to find suitable memory for the uniform ring\n");
+        return !STATUS_OK;
+    }
+
+    // Lives as long as the device and is never moved, a linear block avoids the free list
+    STATUS_CHECK(allocator->allocate(memory_type, mem_reqs, Resource_Kind::Linear, Alloc_Strategy::Linear,
+        nullptr, &alloc));
+    VK_CHECK(vkBindBufferMemory(device, buf, alloc.mem, alloc.offset));
+    assert(alloc.mapped);
+
+    return STATUS_OK;
+}
+
+void Uniform_Ring::destroy() {
+    vkDestroyBuffer(device, buf, nullptr);
+    allocator->free(&alloc);
+}
+
+void Uniform_Ring::log_stats() const {
+    log_info("Uniform ring: %llu of %llu bytes used at peak in a region, %u overflows\n",
+        static_cast<unsigned long long>(stats.peak_region_bytes), static_cast<unsigned long long>(region_size),
+        stats.num_overflows);
+}
+
+/**
+ * Start allocating from the region of a frame slot, discarding what it held.
+ *
+ * NOTE: The caller must ensure the frame slot's previous submission has completed.
+ */
+void Uniform_Ring::begin_frame(uint32_t frame_index) {
+    assert(frame_index < num_frame_regions);
+    region_begin = region_size * frame_index;
+    region_head = region_begin;
+}
+
+/**
+ * Start allocating from a static region, discarding what it held. Used while recording
+ * command buffers that are submitted more than once.
+ *
+ * NOTE: The caller must ensure no submission using that static region is pending.
+ */
+void Uniform_Ring::begin_static(uint32_t static_index) {
+    assert(static_index < num_static_regions);
+    region_begin = region_size * (num_frame_regions + static_index);
+    region_head = region_begin;
+}
+
+/**
+ * Reserve uniform data in the current region.
+ *
+ * \param data Receives the host address to write the data to.
+ * \param dynamic_offset Receives the offset to bind the descriptor with.
+ */
+Status Uniform_Ring::allocate(VkDeviceSize size, void** data, uint32_t* dynamic_offset) {
+    assert(data && dynamic_offset);
+
+    const VkDeviceSize offset = align_up(region_head, alignment);
+    if (offset + size > region_begin + region_size) {
+        ++stats.num_overflows;
+        log_error("Uniform ring region full, %llu bytes requested\n", static_cast<unsigned long long>(size));
+        return !STATUS_OK;
+    }
+
+    region_head = offset + size;
+    stats.peak_region_bytes = std::max(stats.peak_region_bytes, region_head - region_begin);
+
+    *data = static_cast<uint8_t*>(alloc.mapped) + offset;
+    *dynamic_offset = static_cast<uint32_t>(offset);
+    return STATUS_OK;
+}
+
+/**
+ * Reserve count elements in one go, each at an offset usable as a dynamic offset. Lets
+ * several threads write their own elements without touching the ring.
+ *
+ * \param data Receives the host address of the first element, element i is at i * stride.
+ * \param first_offset Receives the dynamic offset of the first element.
+ * \param stride Receives element_size rounded up to the offset alignment.
+ */
+Status Uniform_Ring::allocate_array(VkDeviceSize element_size, uint32_t count, void** data, uint32_t* first_offset,
+    uint32_t* stride)
+{
+    assert(stride);
+    *stride = static_cast<uint32_t>(align_up(element_size, alignment));
+    return allocate(static_cast<VkDeviceSize>(*stride) * count, data, first_offset);
+}
+
+Status Uniform_Ring::push(void const* data, VkDeviceSize size, uint32_t* dynamic_offset) {
+    void* dst;
+    STATUS_CHECK(allocate(size, &dst, dynamic_offset));
+    memcpy(dst, data, size);
+    return STATUS_OK;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "device_memory.h"
+#include "status.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+
+struct Uniform_Ring_Stats {
+    VkDeviceSize peak_region_bytes; //!< Most bytes handed out from a single region
+    uint32_t num_overflows;         //!< Allocations refused because their region was full
+};
+
+/**
+ * Persistently mapped uniform buffer split into one region per frame in flight, plus static
+ * regions for pre-recorded command buffers. There are two, so new recordings can be made while
+ * those recorded into the other are still executing.
+ *
+ * Per-draw data is bump allocated from the current region and bound through a
+ * VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC descriptor with the returned offset, so an update
+ * costs a memcpy and no descriptor writes. A frame region is only reused once the fence of the
+ * frame slot that last used it has signaled.
+ */
+struct Uniform_Ring {
+    static constexpr uint32_t num_static_regions = 2;
+
+    VkDevice device;
+    Device_Allocator* allocator;
+    VkBuffer buf;
+    Device_Allocation alloc;
+
+    VkDeviceSize alignment;    //!< minUniformBufferOffsetAlignment
+    VkDeviceSize region_size;  //!< Multiple of alignment
+    uint32_t num_frame_regions;
+
+    VkDeviceSize region_begin; //!< Offset of the region being allocated from
+    VkDeviceSize region_head;  //!< Next free byte, relative to the buffer
+
+    Uniform_Ring_Stats stats;
+
+    Status init(VkDevice device, Device_Allocator* allocator, VkPhysicalDeviceLimits const& limits,
+        VkDeviceSize region_size, uint32_t num_frame_regions);
+    void destroy();
+
+    void log_stats() const;
+
+    void begin_frame(uint32_t frame_index);
+    void begin_static(uint32_t static_index);
+
+    Status allocate(VkDeviceSize size, void** data, uint32_t* dynamic_offset);
+    Status allocate_array(VkDeviceSize element_size, uint32_t count, void** data, uint32_t* first_offset,
+        uint32_t* stride);
+    Status push(void const* data, VkDeviceSize size, uint32_t* dynamic_offset);
+
+    template <typename T>
+    Status push(T const& value, uint32_t* dynamic_offset) {
+        return push(&value, sizeof(T), dynamic_offset);
+    }
+};
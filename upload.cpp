@@ -0,0 +1,406 @@
+#include "upload.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+    VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    VkResult wait_for_fence(VkDevice device, VkFence fence) {
+        static constexpr uint64_t fence_timeout = 100000000;
+
+        VkResult res;
+        do {
+            res = vkWaitForFences(device, 1, &fence, VK_TRUE, fence_timeout);
+        } while (res == VK_TIMEOUT);
+        return res;
+    }
+}
+
+/**
+ * \param queue_family_index Family of queue, resources are used on the same family so no
+ *  ownership transfer is needed.
+ * \param ring_size Staging memory in bytes. Bigger uploads are split, or wait for space.
+ */
+Status Upload_Service::init(VkDevice device, VkQueue queue, uint32_t queue_family_index,
+    VkPhysicalDeviceLimits const& limits, Device_Allocator* allocator, Sync_Pool* sync_pool, VkDeviceSize ring_size)
+{
+    assert(allocator && sync_pool);
+    assert(ring_size > 0);
+
+    this->device = device;
+    this->queue = queue;
+    this->allocator = allocator;
+    this->sync_pool = sync_pool;
+    this->ring_size = ring_size;
+
+    // Buffer to image copies need offsets aligned to the texel size and 4, the optimal
+    // alignment covers both for the formats in use.
+    copy_offset_alignment = std::max<VkDeviceSize>(limits.optimalBufferCopyOffsetAlignment, 16);
+
+    ring_head = 0;
+    ring_tail = 0;
+    open_batch = {};
+    in_flight.clear();
+    free_cmd_bufs.clear();
+    release_buf_barriers.clear();
+    release_image_barriers.clear();
+    release_dst_stages = 0;
+    stats = {};
+
+    VkCommandPoolCreateInfo cmd_pool_ci = {};
+    cmd_pool_ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmd_pool_ci.pNext = nullptr;
+    cmd_pool_ci.queueFamilyIndex = queue_family_index;
+    cmd_pool_ci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VK_CHECK(vkCreateCommandPool(device, &cmd_pool_ci, nullptr, &cmd_pool));
+
+    VkBufferCreateInfo staging_buf_ci = {};
+    staging_buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    staging_buf_ci.pNext = nullptr;
+    staging_buf_ci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    staging_buf_ci.size = ring_size;
+    staging_buf_ci.queueFamilyIndexCount = 0;
+    staging_buf_ci.pQueueFamilyIndices = nullptr;
+    staging_buf_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    staging_buf_ci.flags = 0;
+    VK_CHECK(vkCreateBuffer(device, &staging_buf_ci, nullptr, &staging_buf));
+
+    VkMemoryRequirements mem_reqs = {};
+    vkGetBufferMemoryRequirements(device, staging_buf, &mem_reqs);
+
+    // Coherent so staging writes never need an explicit flush
+    uint32_t memory_type = 0;
+    if (!allocator->find_memory_type(mem_reqs.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memory_type))
+    {
+        log_error("Unable to find suitable memory for the staging buffer\n");
+        return !STATUS_OK;
+    }
+
+    // Lives as long as the device and is never moved, a linear block avoids the free list
+    STATUS_CHECK(allocator->allocate(memory_type, mem_reqs, Resource_Kind::Linear, Alloc_Strategy::Linear,
+        nullptr, &staging_alloc));
+    VK_CHECK(vkBindBufferMemory(device, staging_buf, staging_alloc.mem, staging_alloc.offset));
+    assert(staging_alloc.mapped);
+
+    return STATUS_OK;
+}
+
+/**
+ * NOTE: The caller must ensure the queue is idle.
+ */
+void Upload_Service::destroy() {
+    if (open_batch.cmd_buf != VK_NULL_HANDLE) {
+        log_error("Upload service destroyed with unflushed uploads\n");
+        free_cmd_bufs.push_back(open_batch.cmd_buf);
+        open_batch = {};
+    }
+
+    for (Batch& batch : in_flight) {
+        sync_pool->release_fence(batch.fence);
+        free_cmd_bufs.push_back(batch.cmd_buf);
+    }
+    in_flight.clear();
+
+    if (!free_cmd_bufs.empty()) {
+        vkFreeCommandBuffers(device, cmd_pool, static_cast<uint32_t>(free_cmd_bufs.size()), free_cmd_bufs.data());
+        free_cmd_bufs.clear();
+    }
+    vkDestroyCommandPool(device, cmd_pool, nullptr);
+
+    vkDestroyBuffer(device, staging_buf, nullptr);
+    allocator->free(&staging_alloc);
+}
+
+/**
+ * Copy data into a buffer. The buffer must have been created with VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+ *
+ * \param dst_stages Pipeline stages that will consume the data.
+ * \param dst_access Access types of those stages, eg. VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT.
+ */
+Status Upload_Service::upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, void const* data, VkDeviceSize size,
+    VkPipelineStageFlags dst_stages, VkAccessFlags dst_access)
+{
+    assert(dst != VK_NULL_HANDLE);
+    assert(data || size == 0);
+    if (size == 0) {
+        return STATUS_OK;
+    }
+
+    // Keep chunks well below the ring size so a large upload streams through the ring instead
+    // of needing all of it at once.
+    const VkDeviceSize max_chunk_size = std::max<VkDeviceSize>(ring_size / 4, copy_offset_alignment);
+    uint8_t const* src = static_cast<uint8_t const*>(data);
+
+    for (VkDeviceSize done = 0; done < size;) {
+        const VkDeviceSize chunk_size = std::min(size - done, max_chunk_size);
+
+        VkDeviceSize staging_offset;
+        STATUS_CHECK(reserve_staging(chunk_size, copy_offset_alignment, &staging_offset));
+        STATUS_CHECK(begin_batch());
+
+        memcpy(static_cast<uint8_t*>(staging_alloc.mapped) + staging_offset, src + done, chunk_size);
+
+        VkBufferCopy region = {};
+        region.srcOffset = staging_offset;
+        region.dstOffset = dst_offset + done;
+        region.size = chunk_size;
+        vkCmdCopyBuffer(open_batch.cmd_buf, staging_buf, dst, 1, &region);
+
+        done += chunk_size;
+    }
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = dst;
+    barrier.offset = dst_offset;
+    barrier.size = size;
+    release_buf_barriers.push_back(barrier);
+    release_dst_stages |= dst_stages;
+
+    stats.bytes_uploaded += size;
+    ++stats.num_uploads;
+    return STATUS_OK;
+}
+
+/**
+ * Copy tightly packed texels into mip level 0, array layer 0 of an image. The image must have
+ * been created with VK_IMAGE_USAGE_TRANSFER_DST_BIT, its previous contents are discarded.
+ *
+ * \param size Size of data in bytes, must fit in the staging ring.
+ * \param final_layout Layout the image is left in once the batch has executed.
+ */
+Status Upload_Service::upload_image(VkImage dst, VkImageAspectFlags aspect, VkExtent3D extent, void const* data,
+    VkDeviceSize size, VkImageLayout final_layout, VkPipelineStageFlags dst_stages, VkAccessFlags dst_access)
+{
+    assert(dst != VK_NULL_HANDLE);
+    assert(data && size > 0);
+
+    VkDeviceSize staging_offset;
+    STATUS_CHECK(reserve_staging(size, copy_offset_alignment, &staging_offset));
+    STATUS_CHECK(begin_batch());
+
+    memcpy(static_cast<uint8_t*>(staging_alloc.mapped) + staging_offset, data, size);
+
+    VkImageSubresourceRange subresource_range = {};
+    subresource_range.aspectMask = aspect;
+    subresource_range.baseMipLevel = 0;
+    subresource_range.levelCount = 1;
+    subresource_range.baseArrayLayer = 0;
+    subresource_range.layerCount = 1;
+
+    VkImageMemoryBarrier to_transfer = {};
+    to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    to_transfer.pNext = nullptr;
+    to_transfer.srcAccessMask = 0;
+    to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_transfer.image = dst;
+    to_transfer.subresourceRange = subresource_range;
+    vkCmdPipelineBarrier(open_batch.cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &to_transfer);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = staging_offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = aspect;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = extent;
+    vkCmdCopyBufferToImage(open_batch.cmd_buf, staging_buf, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    VkImageMemoryBarrier to_final = to_transfer;
+    to_final.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    to_final.dstAccessMask = dst_access;
+    to_final.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    to_final.newLayout = final_layout;
+    release_image_barriers.push_back(to_final);
+    release_dst_stages |= dst_stages;
+
+    stats.bytes_uploaded += size;
+    ++stats.num_uploads;
+    return STATUS_OK;
+}
+
+/**
+ * Submit the uploads recorded since the last flush as one batch. No-op if there are none.
+ *
+ * NOTE: Submissions made to the same queue afterwards see the uploaded data.
+ */
+Status Upload_Service::flush() {
+    if (open_batch.cmd_buf == VK_NULL_HANDLE) {
+        return STATUS_OK;
+    }
+
+    // Make the transfer writes visible to their consumers
+    if (!release_buf_barriers.empty() || !release_image_barriers.empty()) {
+        vkCmdPipelineBarrier(open_batch.cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, release_dst_stages, 0,
+            0, nullptr,
+            static_cast<uint32_t>(release_buf_barriers.size()), release_buf_barriers.data(),
+            static_cast<uint32_t>(release_image_barriers.size()), release_image_barriers.data());
+    }
+    release_buf_barriers.clear();
+    release_image_barriers.clear();
+    release_dst_stages = 0;
+
+    VK_CHECK(vkEndCommandBuffer(open_batch.cmd_buf));
+
+    STATUS_CHECK(sync_pool->acquire_fence(&open_batch.fence));
+    open_batch.ring_end = ring_head;
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = nullptr;
+    submit_info.pWaitDstStageMask = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &open_batch.cmd_buf;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = nullptr;
+    VK_CHECK(vkQueueSubmit(queue, 1, &submit_info, open_batch.fence));
+
+    in_flight.push_back(open_batch);
+    open_batch = {};
+    ++stats.num_batches;
+    return STATUS_OK;
+}
+
+/**
+ * Reclaim the staging space and command buffers of completed batches, without blocking.
+ */
+Status Upload_Service::retire() {
+    while (!in_flight.empty()) {
+        const VkResult res = vkGetFenceStatus(device, in_flight.front().fence);
+        if (res == VK_NOT_READY) {
+            break;
+        }
+        VK_CHECK(res);
+        STATUS_CHECK(retire_oldest_batch());
+    }
+    return STATUS_OK;
+}
+
+/**
+ * Submit pending uploads and block until all of them have completed.
+ */
+Status Upload_Service::wait_idle() {
+    STATUS_CHECK(flush());
+    while (!in_flight.empty()) {
+        VK_CHECK(wait_for_fence(device, in_flight.front().fence));
+        STATUS_CHECK(retire_oldest_batch());
+    }
+    return STATUS_OK;
+}
+
+Status Upload_Service::begin_batch() {
+    if (open_batch.cmd_buf != VK_NULL_HANDLE) {
+        return STATUS_OK;
+    }
+
+    if (!free_cmd_bufs.empty()) {
+        open_batch.cmd_buf = free_cmd_bufs.back();
+        free_cmd_bufs.pop_back();
+    }
+    else {
+        VkCommandBufferAllocateInfo cmd_buf_alloc_info = {};
+        cmd_buf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmd_buf_alloc_info.pNext = nullptr;
+        cmd_buf_alloc_info.commandPool = cmd_pool;
+        cmd_buf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmd_buf_alloc_info.commandBufferCount = 1;
+        VK_CHECK(vkAllocateCommandBuffers(device, &cmd_buf_alloc_info, &open_batch.cmd_buf));
+    }
+
+    VkCommandBufferBeginInfo cmd_buf_info = {};
+    cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmd_buf_info.pNext = nullptr;
+    cmd_buf_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    cmd_buf_info.pInheritanceInfo = nullptr;
+    VK_CHECK(vkBeginCommandBuffer(open_batch.cmd_buf, &cmd_buf_info));
+    return STATUS_OK;
+}
+
+/**
+ * Find room for size bytes in the staging ring, waiting for the GPU to release space if needed.
+ *
+ * The ring is written from head and released from tail. It is wrapped while head < tail, in
+ * that state head may never catch up with tail or a full ring would look empty.
+ */
+Status Upload_Service::reserve_staging(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) {
+    assert(offset);
+    if (size > ring_size) {
+        log_error("Upload of %llu bytes does not fit the %llu byte staging ring\n",
+            static_cast<unsigned long long>(size), static_cast<unsigned long long>(ring_size));
+        return !STATUS_OK;
+    }
+
+    for (;;) {
+        const VkDeviceSize aligned_head = align_up(ring_head, alignment);
+        if (ring_head >= ring_tail) {
+            if (aligned_head + size <= ring_size) {
+                *offset = aligned_head;
+                ring_head = aligned_head + size;
+                return STATUS_OK;
+            }
+            if (size < ring_tail) {
+                *offset = 0;
+                ring_head = size;
+                return STATUS_OK;
+            }
+        }
+        else if (aligned_head + size < ring_tail) {
+            *offset = aligned_head;
+            ring_head = aligned_head + size;
+            return STATUS_OK;
+        }
+
+        // Out of space. The open batch holds staging space too, submit it so it can be released.
+        if (in_flight.empty()) {
+            STATUS_CHECK(flush());
+        }
+        if (in_flight.empty()) {
+            // Nothing in use, start over at the beginning of the ring
+            ring_head = 0;
+            ring_tail = 0;
+            continue;
+        }
+
+        ++stats.num_stalls;
+        VK_CHECK(wait_for_fence(device, in_flight.front().fence));
+        STATUS_CHECK(retire_oldest_batch());
+    }
+}
+
+Status Upload_Service::retire_oldest_batch() {
+    assert(!in_flight.empty());
+    Batch batch = in_flight.front();
+    in_flight.erase(in_flight.begin());
+
+    STATUS_CHECK(sync_pool->release_fence(batch.fence));
+    VK_CHECK(vkResetCommandBuffer(batch.cmd_buf, 0));
+    free_cmd_bufs.push_back(batch.cmd_buf);
+
+    ring_tail = batch.ring_end;
+    if (in_flight.empty() && open_batch.cmd_buf == VK_NULL_HANDLE) {
+        // Ring is empty, rewinding keeps uploads contiguous
+        ring_head = 0;
+        ring_tail = 0;
+    }
+    return STATUS_OK;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "device_memory.h"
+#include "status.h"
+#include "sync_pool.h"
+#include "vk_error.h"
+#include <vulkan/vulkan.h>
+#include <vector>
+
+struct Upload_Stats {
+    uint64_t bytes_uploaded;
+    uint32_t num_uploads;
+    uint32_t num_batches;  //!< Submissions made
+    uint32_t num_stalls;   //!< Times the CPU waited on the GPU for staging space
+};
+
+/**
+ * Copies data from the host into DEVICE_LOCAL buffers and images through a host visible
+ * staging ring.
+ *
+ * Uploads are recorded into the current batch and only submitted on flush(), so any number
+ * of uploads share one submission. Staging space of a batch is reclaimed once its fence has
+ * signaled. A barrier at the end of each batch makes the writes visible to the stages given
+ * with the upload, later submissions on the same queue can use the resources directly.
+ */
+struct Upload_Service {
+    struct Batch {
+        VkCommandBuffer cmd_buf;
+        VkFence fence;
+        VkDeviceSize ring_end; //!< Ring head after the batch's last staging write
+    };
+
+    VkDevice device;
+    VkQueue queue;
+    Device_Allocator* allocator;
+    Sync_Pool* sync_pool;
+    VkDeviceSize copy_offset_alignment;
+
+    VkCommandPool cmd_pool;
+    std::vector<VkCommandBuffer> free_cmd_bufs;
+
+    VkBuffer staging_buf;
+    Device_Allocation staging_alloc;
+    VkDeviceSize ring_size;
+    VkDeviceSize ring_head; //!< Next byte to write
+    VkDeviceSize ring_tail; //!< First byte still in use by the GPU or the open batch
+
+    Batch open_batch;                  //!< Batch being recorded, cmd_buf is VK_NULL_HANDLE if none
+    std::vector<Batch> in_flight;      //!< Submitted batches, oldest first
+    std::vector<VkBufferMemoryBarrier> release_buf_barriers;
+    std::vector<VkImageMemoryBarrier> release_image_barriers;
+    VkPipelineStageFlags release_dst_stages;
+
+    Upload_Stats stats;
+
+    Status init(VkDevice device, VkQueue queue, uint32_t queue_family_index, VkPhysicalDeviceLimits const& limits,
+        Device_Allocator* allocator, Sync_Pool* sync_pool, VkDeviceSize ring_size);
+    void destroy();
+
+    Status upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, void const* data, VkDeviceSize size,
+        VkPipelineStageFlags dst_stages, VkAccessFlags dst_access);
+    Status upload_image(VkImage dst, VkImageAspectFlags aspect, VkExtent3D extent, void const* data, VkDeviceSize size,
+        VkImageLayout final_layout, VkPipelineStageFlags dst_stages, VkAccessFlags dst_access);
+
+    Status flush();
+    Status retire();
+    Status wait_idle();
+
+    Status begin_batch();
+    Status reserve_staging(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+    Status retire_oldest_batch();
+};
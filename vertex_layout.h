@@ -0,0 +1,228 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+// Packed attribute types
+//
+// Stored the way the vertex input unit reads them. Values are converted back to float before
+// reaching the shader, so vec4 inputs work with any of them.
+
+struct Half4 {
+    uint16_t v[4];
+};
+
+struct Snorm16x4 {
+    int16_t v[4];
+};
+
+struct Unorm8x4 {
+    uint8_t v[4];
+};
+
+/**
+ * Unit normal folded onto an octahedron and stored as two snorm16, see oct_encode(). The
+ * shader must unfold it:
+ *   vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+ *   if (n.z < 0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+ *   n = normalize(n);
+ */
+struct Oct_Normal {
+    int16_t v[2];
+};
+
+/**
+ * Vertex input format of an attribute type. Matrices take one location per column.
+ */
+template <typename T>
+struct Attrib_Format;
+
+template <> struct Attrib_Format<float>      { static constexpr VkFormat format = VK_FORMAT_R32_SFLOAT;           static constexpr uint32_t num_locations = 1; };
+template <> struct Attrib_Format<glm::vec2>  { static constexpr VkFormat format = VK_FORMAT_R32G32_SFLOAT;        static constexpr uint32_t num_locations = 1; };
+template <> struct Attrib_Format<glm::vec3>  { static constexpr VkFormat format = VK_FORMAT_R32G32B32_SFLOAT;     static constexpr uint32_t num_locations = 1; };
+template <> struct Attrib_Format<glm::vec4>  { static constexpr VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;  static constexpr uint32_t num_locations = 1; };
+template <> struct Attrib_Format<glm::mat4>  { static constexpr VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;  static constexpr uint32_t num_locations = 4; };
+template <> struct Attrib_Format<Half4>      { static constexpr VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT;  static constexpr uint32_t num_locations = 1; };
+template <> struct Attrib_Format<Snorm16x4>  { static constexpr VkFormat format = VK_FORMAT_R16G16B16A16_SNORM;   static constexpr uint32_t num_locations = 1; };
+template <> struct Attrib_Format<Unorm8x4>   { static constexpr VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;       static constexpr uint32_t num_locations = 1; };
+template <> struct Attrib_Format<Oct_Normal> { static constexpr VkFormat format = VK_FORMAT_R16G16_SNORM;         static constexpr uint32_t num_locations = 1; };
+
+struct Vertex_Attrib {
+    uint32_t location;      //!< First shader location
+    VkFormat format;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t num_locations; //!< Consecutive locations taken, offset advances by size / num_locations
+};
+
+/**
+ * Attribute table of a vertex type. Specialise with
+ *   static constexpr Vertex_Attrib attribs[] = { VERTEX_ATTRIB(Vertex_T, member, location), ... };
+ * next to the vertex struct. Offsets and formats come from the members, so the table can't go
+ * stale when the struct changes, and check_vertex_layout() catches members left out.
+ */
+template <typename Vertex_T>
+struct Vertex_Layout;
+
+#define VERTEX_ATTRIB(Vertex_T, Member, Location)                                  \
+    Vertex_Attrib{                                                                 \
+        (Location),                                                                \
+        Attrib_Format<decltype(Vertex_T::Member)>::format,                         \
+        static_cast<uint32_t>(offsetof(Vertex_T, Member)),                         \
+        static_cast<uint32_t>(sizeof(Vertex_T::Member)),                           \
+        Attrib_Format<decltype(Vertex_T::Member)>::num_locations }
+
+template <typename Vertex_T>
+constexpr uint32_t vertex_attrib_count() {
+    return static_cast<uint32_t>(std::size(Vertex_Layout<Vertex_T>::attribs));
+}
+
+/**
+ * Number of VkVertexInputAttributeDescription entries, one per location.
+ */
+template <typename Vertex_T>
+constexpr uint32_t vertex_location_count() {
+    uint32_t count = 0;
+    for (Vertex_Attrib const& attrib : Vertex_Layout<Vertex_T>::attribs) {
+        count += attrib.num_locations;
+    }
+    return count;
+}
+
+/**
+ * True if the attributes cover every byte of the vertex exactly once. Fails on members missing
+ * from the table, overlapping entries and padding (packed vertices should have none).
+ */
+template <typename Vertex_T>
+constexpr bool check_vertex_layout() {
+    constexpr auto& attribs = Vertex_Layout<Vertex_T>::attribs;
+    uint32_t covered = 0;
+    for (size_t i = 0; i < std::size(attribs); ++i) {
+        covered += attribs[i].size;
+        for (size_t j = i + 1; j < std::size(attribs); ++j) {
+            const bool disjoint = attribs[i].offset + attribs[i].size <= attribs[j].offset
+                || attribs[j].offset + attribs[j].size <= attribs[i].offset;
+            if (!disjoint) {
+                return false;
+            }
+        }
+    }
+    return covered == sizeof(Vertex_T);
+}
+
+template <typename Vertex_T>
+constexpr VkVertexInputBindingDescription vertex_binding(uint32_t binding, VkVertexInputRate input_rate) {
+    static_assert(check_vertex_layout<Vertex_T>(), "Vertex_Layout does not match the vertex struct");
+    return VkVertexInputBindingDescription{ binding, static_cast<uint32_t>(sizeof(Vertex_T)), input_rate };
+}
+
+/**
+ * \param attribs Receives vertex_location_count<Vertex_T>() descriptions.
+ */
+template <typename Vertex_T>
+void vertex_attribs(uint32_t binding, VkVertexInputAttributeDescription* attribs) {
+    static_assert(check_vertex_layout<Vertex_T>(), "Vertex_Layout does not match the vertex struct");
+    for (Vertex_Attrib const& attrib : Vertex_Layout<Vertex_T>::attribs) {
+        const uint32_t location_size = attrib.size / attrib.num_locations;
+        for (uint32_t i = 0; i < attrib.num_locations; ++i) {
+            attribs->location = attrib.location + i;
+            attribs->binding = binding;
+            attribs->format = attrib.format;
+            attribs->offset = attrib.offset + i * location_size;
+            ++attribs;
+        }
+    }
+}
+
+// Packing
+//
+
+inline int16_t pack_snorm16(float value) {
+    return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+inline uint8_t pack_unorm8(float value) {
+    return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+/**
+ * IEEE 754 binary16, round to nearest even. Overflow becomes infinity.
+ */
+inline uint16_t pack_half(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t abs_bits = bits & 0x7fffffffu;
+
+    if (abs_bits >= 0x7f800000u) {
+        // Inf or NaN, keep NaNs quiet
+        return static_cast<uint16_t>(sign | 0x7c00u | (abs_bits > 0x7f800000u ? 0x200u : 0u));
+    }
+    if (abs_bits >= 0x477ff000u) {
+        // Rounds past the largest half
+        return static_cast<uint16_t>(sign | 0x7c00u);
+    }
+    if (abs_bits < 0x38800000u) {
+        // Half denormal or zero, shift the mantissa with the implicit bit into place
+        if (abs_bits < 0x33000000u) {
+            return static_cast<uint16_t>(sign);
+        }
+        const uint32_t exponent = abs_bits >> 23;
+        const uint32_t mantissa = (abs_bits & 0x7fffffu) | 0x800000u;
+        const uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u))) {
+            ++half;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    // Normal, rebias the exponent from 127 to 15 and round the dropped 13 mantissa bits
+    uint32_t half = (abs_bits - 0x38000000u) >> 13;
+    const uint32_t remainder = abs_bits & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) {
+        ++half;
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+inline Half4 pack_half4(glm::vec4 const& v) {
+    return Half4{ { pack_half(v.x), pack_half(v.y), pack_half(v.z), pack_half(v.w) } };
+}
+
+/**
+ * \param v Components in [-1, 1], eg. positions of a mesh normalized to its bounds.
+ */
+inline Snorm16x4 pack_snorm16x4(glm::vec4 const& v) {
+    return Snorm16x4{ { pack_snorm16(v.x), pack_snorm16(v.y), pack_snorm16(v.z), pack_snorm16(v.w) } };
+}
+
+inline Unorm8x4 pack_unorm8x4(glm::vec4 const& v) {
+    return Unorm8x4{ { pack_unorm8(v.x), pack_unorm8(v.y), pack_unorm8(v.z), pack_unorm8(v.w) } };
+}
+
+/**
+ * Project a unit vector onto the octahedron |x| + |y| + |z| = 1 and unfold the lower half
+ * over the upper one, giving two components in [-1, 1].
+ */
+inline Oct_Normal oct_encode(glm::vec3 const& n) {
+    const float inv_l1 = 1.0f / (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+    float x = n.x * inv_l1;
+    float y = n.y * inv_l1;
+    if (n.z < 0.0f) {
+        const float folded_x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float folded_y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+    return Oct_Normal{ { pack_snorm16(x), pack_snorm16(y) } };
+}